@@ -0,0 +1,144 @@
+#include "BroadcastRing.h"
+
+#include <cerrno>
+#include <cstring>
+#include <new>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static const uint64_t BROADCAST_MAGIC = 0x3154534143444142; // "BADCAST1"
+
+BroadcastRing::BroadcastRing(const std::string &name, size_t count)
+    : next(0), shmName(name) {
+  slotCount = 1;
+  while(slotCount < count) {
+    slotCount *= 2;
+  }
+  mappedSize = sizeof(BroadcastHeader) + slotCount * sizeof(BroadcastSlot);
+  int fd = shm_open(shmName.c_str(), O_CREAT | O_RDWR, 0644);
+  if(fd == -1) {
+    throw std::runtime_error("Couldn't open shared memory " + shmName + ": " + strerror(errno));
+  }
+  // Truncating first zeroes a ring left behind by an earlier run.
+  if(ftruncate(fd, 0) == -1 || ftruncate(fd, mappedSize) == -1) {
+    close(fd);
+    shm_unlink(shmName.c_str());
+    throw std::runtime_error("Couldn't size shared memory " + shmName + ": " + strerror(errno));
+  }
+  void* memory = mmap(nullptr, mappedSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if(memory == MAP_FAILED) {
+    shm_unlink(shmName.c_str());
+    throw std::runtime_error("Couldn't map shared memory " + shmName + ": " + strerror(errno));
+  }
+  header = new (memory) BroadcastHeader();
+  header->slotSize = sizeof(BroadcastSlot);
+  header->slotCount = slotCount;
+  header->published.store(0, std::memory_order_relaxed);
+  slots = reinterpret_cast<BroadcastSlot*>(header + 1);
+  for(size_t i = 0; i < slotCount; i++) {
+    new (&slots[i]) BroadcastSlot();
+    slots[i].seq.store(0, std::memory_order_relaxed);
+  }
+  // Readers check this last.
+  __atomic_store_n(&header->magic, BROADCAST_MAGIC, __ATOMIC_RELEASE);
+}
+
+BroadcastRing::~BroadcastRing() {
+  munmap(header, mappedSize);
+  shm_unlink(shmName.c_str());
+}
+
+char* BroadcastRing::reserve(size_t len) {
+  if(len > MAX_RECORD_SIZE) {
+    throw std::invalid_argument("Record too long.");
+  }
+  BroadcastSlot &slot = slots[next & (slotCount - 1)];
+  // Readers still copying the slot's last record will see it change.
+  slot.seq.store(2 * next + 1, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+  return slot.record;
+}
+
+void BroadcastRing::commit(size_t len) {
+  BroadcastSlot &slot = slots[next & (slotCount - 1)];
+  slot.len = len;
+  slot.seq.store(2 * next + 2, std::memory_order_release);
+  next++;
+  header->published.store(next, std::memory_order_release);
+}
+
+BroadcastReader::BroadcastReader(const std::string &shmName, bool fromOldest)
+    : lostRecords(0) {
+  int fd = shm_open(shmName.c_str(), O_RDONLY, 0);
+  if(fd == -1) {
+    throw std::runtime_error("Couldn't open shared memory " + shmName + ": " + strerror(errno));
+  }
+  struct stat st;
+  if(fstat(fd, &st) == -1 || (size_t) st.st_size < sizeof(BroadcastHeader)) {
+    close(fd);
+    throw std::runtime_error("No broadcast ring in " + shmName);
+  }
+  mappedSize = st.st_size;
+  // Readers never write, so any number can map the ring read only.
+  mapping = mmap(nullptr, mappedSize, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if(mapping == MAP_FAILED) {
+    throw std::runtime_error("Couldn't map shared memory " + shmName + ": " + strerror(errno));
+  }
+  header = static_cast<const BroadcastHeader*>(mapping);
+  slotCount = header->slotCount;
+  if(__atomic_load_n(&header->magic, __ATOMIC_ACQUIRE) != BROADCAST_MAGIC ||
+      header->slotSize != sizeof(BroadcastSlot) ||
+      sizeof(BroadcastHeader) + slotCount * sizeof(BroadcastSlot) != mappedSize) {
+    munmap(mapping, mappedSize);
+    throw std::runtime_error("No broadcast ring in " + shmName);
+  }
+  slots = reinterpret_cast<const BroadcastSlot*>(header + 1);
+
+  next = header->published.load(std::memory_order_acquire);
+  if(fromOldest) {
+    // Not the full lap; that slot is the next to be overwritten.
+    next = next >= slotCount ? next - slotCount + 1 : 0;
+  }
+}
+
+BroadcastReader::~BroadcastReader() {
+  munmap(mapping, mappedSize);
+}
+
+BroadcastReadResult BroadcastReader::read(char* record, size_t* len) {
+  const BroadcastSlot &slot = slots[next & (slotCount - 1)];
+  uint64_t expected = 2 * next + 2;
+  uint64_t seq = slot.seq.load(std::memory_order_acquire);
+  if(seq < expected) {
+    return BROADCAST_NONE;
+  }
+  if(seq == expected) {
+    size_t length = slot.len;
+    if(length > OutputSink::MAX_RECORD_SIZE) {
+      length = OutputSink::MAX_RECORD_SIZE;
+    }
+    memcpy(record, slot.record, length);
+    // The copy is only good if the writer didn't start on the slot since.
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if(slot.seq.load(std::memory_order_relaxed) == expected) {
+      *len = length;
+      next++;
+      return BROADCAST_RECORD;
+    }
+  }
+  // Lapped; skip ahead to the next record published.
+  uint64_t published = header->published.load(std::memory_order_acquire);
+  lostRecords += published - next;
+  next = published;
+  return BROADCAST_OVERRUN;
+}
+
+uint64_t BroadcastReader::getLostRecords() const {
+  return lostRecords;
+}
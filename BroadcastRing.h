@@ -0,0 +1,93 @@
+#pragma once
+
+#include "OutputSink.h"
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// Start of a broadcast ring's shared memory, followed by the slots.
+struct BroadcastHeader {
+  uint64_t magic;
+  uint64_t slotSize;
+  uint64_t slotCount;
+  // Records published so far; the next record's number.
+  alignas(64) std::atomic<uint64_t> published;
+};
+
+// One record. seq is odd while record number (seq - 1) / 2 is being
+// written, and 2 * (number + 1) once it is complete.
+struct BroadcastSlot {
+  alignas(64) std::atomic<uint64_t> seq;
+  uint32_t len;
+  char record[OutputSink::MAX_RECORD_SIZE];
+};
+
+static_assert(sizeof(BroadcastHeader) == 128, "Broadcast header layout is shared.");
+static_assert(sizeof(BroadcastSlot) == 128, "Broadcast slot layout is shared.");
+
+// Publishes output records to any number of reader processes through a
+// POSIX shared memory object. The writer never waits for readers: it
+// overwrites the oldest slot, and each reader follows at its own pace,
+// noticing from the slot sequence numbers if it fell a lap behind.
+class BroadcastRing : public OutputSink {
+  BroadcastHeader* header;
+  BroadcastSlot* slots;
+  // Always a power of two.
+  size_t slotCount;
+  uint64_t next;
+
+  std::string shmName;
+  size_t mappedSize;
+
+  public:
+    // Creates or replaces the shared memory object shmName with room for
+    // at least slotCount records. It is unlinked on destruction.
+    BroadcastRing(const std::string &shmName, size_t slotCount);
+    ~BroadcastRing();
+
+    BroadcastRing(const BroadcastRing&) = delete;
+    BroadcastRing& operator=(const BroadcastRing&) = delete;
+
+    char* reserve(size_t len) override;
+    void commit(size_t len) override;
+};
+
+enum BroadcastReadResult {
+  BROADCAST_RECORD,
+  // Nothing new published yet.
+  BROADCAST_NONE,
+  // The writer lapped the reader, which skipped ahead to the next record
+  // to be published.
+  BROADCAST_OVERRUN
+};
+
+// Follows a BroadcastRing from this or another process.
+class BroadcastReader {
+  const BroadcastHeader* header;
+  const BroadcastSlot* slots;
+  size_t slotCount;
+  uint64_t next;
+  uint64_t lostRecords;
+
+  void* mapping;
+  size_t mappedSize;
+
+  public:
+    // Maps the ring in shmName. Starts with the next record published, or
+    // with the oldest still in the ring if fromOldest. Throws
+    // std::runtime_error if there's no ring there.
+    explicit BroadcastReader(const std::string &shmName, bool fromOldest = false);
+    ~BroadcastReader();
+
+    BroadcastReader(const BroadcastReader&) = delete;
+    BroadcastReader& operator=(const BroadcastReader&) = delete;
+
+    // Copies the next record into record, which must hold
+    // OutputSink::MAX_RECORD_SIZE bytes. A record can't be read in place
+    // since the writer may overwrite it at any time.
+    BroadcastReadResult read(char* record, size_t* len);
+    // Records skipped over after overruns.
+    uint64_t getLostRecords() const;
+};
@@ -0,0 +1,145 @@
+#include "Decoders.h"
+#include "MessageLayout.h"
+#include "Parser.h"
+
+#include <cstddef>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HAVE_SSSE3_DECODERS 1
+#endif
+
+static void decodeAddOrder(const char* in, InputAddOrder* msg) {
+  typedef InputAddLayout L;
+  msg->msgType = in[L::msgType::offset];
+  decodeField<L::timestamp>(in, &msg->timestamp);
+  decodeField<L::orderRef>(in, &msg->orderRef);
+  msg->side = in[L::side::offset];
+  decodeField<L::size>(in, &msg->size);
+  decodeBytes<L::ticker>(in, msg->ticker);
+  decodeField<L::price>(in, &msg->price);
+}
+
+static void decodeOrderExecuted(const char* in, InputOrderExecuted* msg) {
+  typedef InputExecutedLayout L;
+  msg->msgType = in[L::msgType::offset];
+  decodeField<L::timestamp>(in, &msg->timestamp);
+  decodeField<L::orderRef>(in, &msg->orderRef);
+  decodeField<L::size>(in, &msg->size);
+}
+
+static void decodeOrderCanceled(const char* in, InputOrderCanceled* msg) {
+  typedef InputCanceledLayout L;
+  msg->msgType = in[L::msgType::offset];
+  decodeField<L::timestamp>(in, &msg->timestamp);
+  decodeField<L::orderRef>(in, &msg->orderRef);
+  decodeField<L::size>(in, &msg->size);
+}
+
+static void decodeOrderReplaced(const char* in, InputOrderReplaced* msg) {
+  typedef InputReplacedLayout L;
+  msg->msgType = in[L::msgType::offset];
+  decodeField<L::timestamp>(in, &msg->timestamp);
+  decodeField<L::originalOrderRef>(in, &msg->originalOrderRef);
+  decodeField<L::newOrderRef>(in, &msg->newOrderRef);
+  decodeField<L::size>(in, &msg->size);
+  decodeField<L::price>(in, &msg->price);
+}
+
+const MessageDecoders &scalarDecoders() {
+  static const MessageDecoders decoders = {
+    decodeAddOrder, decodeOrderExecuted, decodeOrderCanceled, decodeOrderReplaced
+  };
+  return decoders;
+}
+
+#ifdef HAVE_SSSE3_DECODERS
+
+// The shuffles store several decoded fields at once, so the structs must
+// lay them out back to back as the wire does.
+static_assert(offsetof(InputAddOrder, orderRef) == offsetof(InputAddOrder, timestamp) + 8 &&
+    offsetof(InputAddOrder, ticker) == offsetof(InputAddOrder, size) + 4 &&
+    offsetof(InputAddOrder, price) == offsetof(InputAddOrder, ticker) + 8,
+    "Add Order fields decoded together must be adjacent.");
+static_assert(offsetof(InputOrderExecuted, orderRef) == offsetof(InputOrderExecuted, timestamp) + 8,
+    "Order Executed fields decoded together must be adjacent.");
+static_assert(offsetof(InputOrderCanceled, orderRef) == offsetof(InputOrderCanceled, timestamp) + 8,
+    "Order Canceled fields decoded together must be adjacent.");
+static_assert(offsetof(InputOrderReplaced, originalOrderRef) ==
+    offsetof(InputOrderReplaced, timestamp) + 8,
+    "Order Replaced fields decoded together must be adjacent.");
+// Every message starts with a timestamp and a ref, swapped as a pair.
+static_assert(InputAddLayout::orderRef::end == 17 && InputExecutedLayout::orderRef::end == 17 &&
+    InputReplacedLayout::originalOrderRef::end == 17, "Messages start with timestamp, ref.");
+
+#define SSSE3 __attribute__((target("ssse3")))
+
+// Reverses the bytes of the two 8 byte halves.
+SSSE3 static __m128i swap64x2(__m128i v) {
+  return _mm_shuffle_epi8(v, _mm_setr_epi8(7, 6, 5, 4, 3, 2, 1, 0, 15, 14, 13, 12, 11, 10, 9, 8));
+}
+
+SSSE3 static void decodeAddOrderSsse3(const char* in, InputAddOrder* msg) {
+  typedef InputAddLayout L;
+  msg->msgType = in[L::msgType::offset];
+  __m128i head = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + L::timestamp::offset));
+  _mm_storeu_si128(reinterpret_cast<__m128i*>(&msg->timestamp), swap64x2(head));
+  msg->side = in[L::side::offset];
+  // Size, ticker and price are the last 16 bytes; only the ticker keeps
+  // its byte order.
+  static_assert(L::price::end - L::size::offset == 16, "Size to price spans 16 bytes.");
+  __m128i tail = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + L::size::offset));
+  tail = _mm_shuffle_epi8(tail, _mm_setr_epi8(3, 2, 1, 0, 4, 5, 6, 7, 8, 9, 10, 11, 15, 14, 13, 12));
+  _mm_storeu_si128(reinterpret_cast<__m128i*>(&msg->size), tail);
+}
+
+template <typename Layout, typename Msg>
+SSSE3 static void decodeRefSizeSsse3(const char* in, Msg* msg) {
+  msg->msgType = in[Layout::msgType::offset];
+  __m128i head = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + Layout::timestamp::offset));
+  _mm_storeu_si128(reinterpret_cast<__m128i*>(&msg->timestamp), swap64x2(head));
+  decodeField<typename Layout::size>(in, &msg->size);
+}
+
+SSSE3 static void decodeOrderExecutedSsse3(const char* in, InputOrderExecuted* msg) {
+  decodeRefSizeSsse3<InputExecutedLayout>(in, msg);
+}
+
+SSSE3 static void decodeOrderCanceledSsse3(const char* in, InputOrderCanceled* msg) {
+  decodeRefSizeSsse3<InputCanceledLayout>(in, msg);
+}
+
+SSSE3 static void decodeOrderReplacedSsse3(const char* in, InputOrderReplaced* msg) {
+  typedef InputReplacedLayout L;
+  msg->msgType = in[L::msgType::offset];
+  __m128i head = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + L::timestamp::offset));
+  _mm_storeu_si128(reinterpret_cast<__m128i*>(&msg->timestamp), swap64x2(head));
+  // New ref, size and price are the last 16 bytes.
+  static_assert(L::price::end - L::newOrderRef::offset == 16, "New ref to price spans 16 bytes.");
+  __m128i tail = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + L::newOrderRef::offset));
+  tail = _mm_shuffle_epi8(tail, _mm_setr_epi8(7, 6, 5, 4, 3, 2, 1, 0, 11, 10, 9, 8, 15, 14, 13, 12));
+  _mm_storel_epi64(reinterpret_cast<__m128i*>(&msg->newOrderRef), tail);
+  msg->size = _mm_cvtsi128_si32(_mm_srli_si128(tail, 8));
+  msg->price = (uint32_t) _mm_cvtsi128_si32(_mm_srli_si128(tail, 12));
+}
+
+const MessageDecoders *ssse3Decoders() {
+  static const MessageDecoders decoders = {
+    decodeAddOrderSsse3, decodeOrderExecutedSsse3, decodeOrderCanceledSsse3,
+    decodeOrderReplacedSsse3
+  };
+  return __builtin_cpu_supports("ssse3") ? &decoders : nullptr;
+}
+
+#else
+
+const MessageDecoders *ssse3Decoders() {
+  return nullptr;
+}
+
+#endif
+
+const MessageDecoders &bestDecoders() {
+  static const MessageDecoders &best = ssse3Decoders() ? *ssse3Decoders() : scalarDecoders();
+  return best;
+}
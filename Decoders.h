@@ -0,0 +1,24 @@
+#pragma once
+
+struct InputAddOrder;
+struct InputOrderExecuted;
+struct InputOrderCanceled;
+struct InputOrderReplaced;
+
+// Decoders of each input message type, from its wire bytes to its struct.
+// There is a portable set, byte swapping one field at a time, and an
+// SSSE3 set that swaps every integer field of a message with one or two
+// pshufb shuffles. All messages fit within two 16 byte loads, so AVX2's
+// wider shuffles, which can't cross 16 byte lanes, have nothing to add.
+struct MessageDecoders {
+  void (*addOrder)(const char* in, InputAddOrder* msg);
+  void (*orderExecuted)(const char* in, InputOrderExecuted* msg);
+  void (*orderCanceled)(const char* in, InputOrderCanceled* msg);
+  void (*orderReplaced)(const char* in, InputOrderReplaced* msg);
+};
+
+const MessageDecoders &scalarDecoders();
+// Null if the CPU doesn't support SSSE3.
+const MessageDecoders *ssse3Decoders();
+// The fastest decoders this CPU supports, picked once at startup.
+const MessageDecoders &bestDecoders();
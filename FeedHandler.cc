@@ -0,0 +1,401 @@
+#include "FeedHandler.h"
+#include "MessageLayout.h"
+#include "RecordRing.h"
+#include "SpscQueue.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <stdexcept>
+
+#include <pthread.h>
+#include <sched.h>
+
+// Packets a channel, or records the writer, takes between checks.
+const size_t CHANNEL_BATCH_SIZE = 64;
+
+static uint64_t steadyNanos() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+      std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static void pin(std::thread &thread, int cpu) {
+  if(cpu < 0) {
+    return;
+  }
+  cpu_set_t cpus;
+  CPU_ZERO(&cpus);
+  CPU_SET(cpu, &cpus);
+  int err = pthread_setaffinity_np(thread.native_handle(), sizeof(cpus), &cpus);
+  if(err != 0) {
+    throw std::runtime_error("Couldn't pin a thread to CPU " + std::to_string(cpu) +
+        ": " + strerror(err));
+  }
+}
+
+// A channel's parser, its thread, and what it reads from and writes to.
+class FeedHandler::Channel {
+  public:
+    struct Packet {
+      char* buf;
+      size_t len;
+    };
+
+    std::unique_ptr<Parser> parser;
+    // Set if the channel receives from a socket.
+    std::unique_ptr<UDPReceiver> receiver;
+    // When merging, the channel's records, for the writer.
+    std::unique_ptr<RecordRing> ring;
+    std::unique_ptr<RecordRingReader> reader;
+
+    // Packets handed in, and their buffers once parsed, for reuse.
+    SpscQueue<Packet> packets;
+    SpscQueue<char*> freeBuffers;
+    // Every buffer, allocated by the caller as needed up to maxBuffers.
+    std::vector<std::unique_ptr<char[]>> buffers;
+    size_t maxBuffers;
+    // Packets handed in, and parsed.
+    std::atomic<uint64_t> pushed;
+    std::atomic<uint64_t> processed;
+    // Output timestamp of the latest message parsed; the channel writes no
+    // earlier records from here on.
+    std::atomic<uint64_t> watermark;
+    // Last flush request done.
+    std::atomic<uint64_t> flushed;
+    // The writer's: watermark as last seen, and when it last moved or the
+    // channel had records to merge.
+    uint64_t seenWatermark;
+    uint64_t seenNanos;
+
+    int cpu;
+    std::thread thread;
+
+    explicit Channel(size_t queueSize)
+        : packets(queueSize), freeBuffers(queueSize), maxBuffers(queueSize),
+          pushed(0), processed(0), watermark(0), flushed(0), seenWatermark(0),
+          seenNanos(0), cpu(-1) {}
+
+    // Whether packets handed in are still to be parsed.
+    bool pending() const {
+      uint64_t done = processed.load(std::memory_order_acquire);
+      return done != pushed.load(std::memory_order_acquire);
+    }
+
+    // Publishes the watermark, after the records written before it.
+    void advance() {
+      uint64_t latest = parser->getMidnightNanos() + parser->getLastTimestamp();
+      if(latest != watermark.load(std::memory_order_relaxed)) {
+        watermark.store(latest, std::memory_order_release);
+      }
+    }
+};
+
+FeedHandler::FeedHandler(int date, const std::string &outputFilename,
+    const FeedHandlerConfig &config)
+    : FeedHandler(date, config, std::vector<OutputSink*>()) {
+  ownedOutput.reset(new OutputWriter(outputFilename, config.parser.flush));
+  output = ownedOutput.get();
+  start();
+}
+
+FeedHandler::FeedHandler(int date, OutputSink &sink, const FeedHandlerConfig &config)
+    : FeedHandler(date, config, std::vector<OutputSink*>()) {
+  output = &sink;
+  start();
+}
+
+FeedHandler::FeedHandler(int date, const std::vector<OutputSink*> &channelSinks,
+    const FeedHandlerConfig &config)
+    : FeedHandler(date, config, channelSinks) {
+  if(channelSinks.empty()) {
+    throw std::invalid_argument("Unmerged output needs a sink per channel.");
+  }
+  start();
+}
+
+FeedHandler::FeedHandler(int date, const FeedHandlerConfig &config,
+    const std::vector<OutputSink*> &channelSinks)
+    : maxPacketSize(config.maxPacketSize), output(nullptr), writerCpu(config.writerCpu),
+      idleTimeoutNanos(config.idleTimeoutNanos), lastMerged(0), orderViolations(0), flushes(0),
+      flushRequest(0), writerFlushed(0), stopping(false), started(false), failed(false) {
+  if(config.channels.empty()) {
+    throw std::invalid_argument("A feed handler needs a channel.");
+  }
+  if(!channelSinks.empty() && channelSinks.size() != config.channels.size()) {
+    throw std::invalid_argument("There must be a sink per channel.");
+  }
+  for(size_t i = 0; i < config.channels.size(); i++) {
+    const ChannelConfig &channelConfig = config.channels[i];
+    channels.emplace_back(new Channel(config.queueSize));
+    Channel &channel = *channels.back();
+    channel.cpu = channelConfig.cpu;
+    OutputSink* sink;
+    if(channelSinks.empty()) {
+      channel.ring.reset(new RecordRing(config.outputRingSize));
+      channel.reader.reset(new RecordRingReader(*channel.ring));
+      sink = channel.ring.get();
+    } else {
+      sink = channelSinks[i];
+    }
+    channel.parser.reset(new Parser(date, *sink, config.parser));
+    if(channelConfig.receive) {
+      channel.receiver.reset(new UDPReceiver(channelConfig.receiver));
+    }
+  }
+}
+
+void FeedHandler::start() {
+  for(std::unique_ptr<Channel> &channel : channels) {
+    Channel* worker = channel.get();
+    channel->thread = std::thread([this, worker]() { runChannel(*worker); });
+    pin(channel->thread, channel->cpu);
+  }
+  if(output) {
+    writer = std::thread([this]() { runWriter(); });
+    pin(writer, writerCpu);
+  }
+  started = true;
+}
+
+FeedHandler::~FeedHandler() {
+  if(started) {
+    sync();
+  }
+  stopping.store(true, std::memory_order_release);
+  for(std::unique_ptr<Channel> &channel : channels) {
+    if(channel->thread.joinable()) {
+      channel->thread.join();
+    }
+  }
+  if(writer.joinable()) {
+    writer.join();
+  }
+}
+
+void FeedHandler::onUDPPacket(size_t index, const char *buf, size_t len) {
+  if(index >= channels.size()) {
+    throw std::invalid_argument("No channel " + std::to_string(index) + ".");
+  }
+  Channel &channel = *channels[index];
+  if(channel.receiver) {
+    throw std::invalid_argument("Channel " + std::to_string(index) + " receives its own packets.");
+  }
+  if(len > maxPacketSize) {
+    throw std::invalid_argument("Packet is longer than maxPacketSize.");
+  }
+  char* buffer;
+  if(!channel.freeBuffers.tryPop(&buffer)) {
+    if(channel.buffers.size() < channel.maxBuffers) {
+      channel.buffers.emplace_back(new char[maxPacketSize]);
+      buffer = channel.buffers.back().get();
+    } else {
+      while(!channel.freeBuffers.tryPop(&buffer)) {
+        std::this_thread::yield();
+      }
+    }
+  }
+  memcpy(buffer, buf, len);
+  channel.packets.push({buffer, len});
+  channel.pushed.store(channel.pushed.load(std::memory_order_relaxed) + 1,
+      std::memory_order_release);
+  rethrow();
+}
+
+void FeedHandler::flush() {
+  sync();
+  rethrow();
+}
+
+void FeedHandler::sync() {
+  for(std::unique_ptr<Channel> &channel : channels) {
+    while(channel->pending()) {
+      std::this_thread::yield();
+    }
+  }
+  uint64_t request = ++flushes;
+  flushRequest.store(request, std::memory_order_release);
+  for(std::unique_ptr<Channel> &channel : channels) {
+    while(channel->flushed.load(std::memory_order_acquire) != request) {
+      std::this_thread::yield();
+    }
+  }
+  while(output && writerFlushed.load(std::memory_order_acquire) != request) {
+    std::this_thread::yield();
+  }
+}
+
+uint64_t FeedHandler::getOrderViolations() const {
+  return orderViolations.load(std::memory_order_relaxed);
+}
+
+size_t FeedHandler::getChannelCount() const {
+  return channels.size();
+}
+
+uint16_t FeedHandler::getPort(size_t channel) const {
+  const UDPReceiver* receiver = channels.at(channel)->receiver.get();
+  return receiver ? receiver->getPort() : 0;
+}
+
+void FeedHandler::fail(std::exception_ptr e) {
+  std::lock_guard<std::mutex> guard(errorLock);
+  if(!error) {
+    error = e;
+  }
+  failed.store(true, std::memory_order_release);
+}
+
+void FeedHandler::rethrow() {
+  if(!failed.load(std::memory_order_acquire)) {
+    return;
+  }
+  std::exception_ptr first;
+  {
+    std::lock_guard<std::mutex> guard(errorLock);
+    first = error;
+    error = nullptr;
+    failed.store(false, std::memory_order_relaxed);
+  }
+  std::rethrow_exception(first);
+}
+
+void FeedHandler::runChannel(Channel &channel) {
+  Channel::Packet packet;
+  uint64_t processed = 0;
+  while(!stopping.load(std::memory_order_acquire)) {
+    if(channel.receiver) {
+      try {
+        channel.receiver->receive(*channel.parser);
+      } catch(...) {
+        fail(std::current_exception());
+      }
+      channel.advance();
+    } else {
+      size_t n = 0;
+      while(n < CHANNEL_BATCH_SIZE && channel.packets.tryPop(&packet)) {
+        try {
+          channel.parser->onUDPPacket(packet.buf, packet.len);
+        } catch(...) {
+          fail(std::current_exception());
+        }
+        channel.freeBuffers.push(packet.buf);
+        n++;
+      }
+      if(n > 0) {
+        channel.advance();
+        processed += n;
+        channel.processed.store(processed, std::memory_order_release);
+        continue;
+      }
+      try {
+        channel.parser->poll();
+      } catch(...) {
+        fail(std::current_exception());
+      }
+      // Skipping a gap may have parsed stashed packets.
+      channel.advance();
+      std::this_thread::yield();
+    }
+
+    // Flush between packets, when asked.
+    uint64_t request = flushRequest.load(std::memory_order_acquire);
+    if(request != channel.flushed.load(std::memory_order_relaxed)) {
+      try {
+        channel.parser->flush();
+      } catch(...) {
+        fail(std::current_exception());
+      }
+      channel.flushed.store(request, std::memory_order_release);
+    }
+  }
+}
+
+void FeedHandler::runWriter() {
+  uint64_t now = steadyNanos();
+  for(std::unique_ptr<Channel> &channel : channels) {
+    channel->seenNanos = now;
+  }
+  while(true) {
+    uint64_t request = flushRequest.load(std::memory_order_acquire);
+    bool flushing = request != writerFlushed.load(std::memory_order_relaxed);
+    now = steadyNanos();
+    size_t n = 0;
+    while(n < CHANNEL_BATCH_SIZE && mergeOne(flushing, now)) {
+      n++;
+    }
+    if(n > 0) {
+      continue;
+    }
+    try {
+      if(flushing) {
+        // Every channel's records are merged.
+        output->flush();
+      } else {
+        output->poll();
+      }
+    } catch(...) {
+      fail(std::current_exception());
+    }
+    if(flushing) {
+      writerFlushed.store(request, std::memory_order_release);
+    } else if(stopping.load(std::memory_order_acquire)) {
+      return;
+    } else {
+      std::this_thread::yield();
+    }
+  }
+}
+
+bool FeedHandler::mergeOne(bool flushing, uint64_t now) {
+  Channel* earliest = nullptr;
+  uint64_t earliestTimestamp = 0;
+  // Lowest watermark of the live channels with nothing to merge.
+  uint64_t bound = UINT64_MAX;
+  const char* record;
+  size_t len;
+  for(std::unique_ptr<Channel> &channel : channels) {
+    // Read before peeking, so records written up to it are seen.
+    uint64_t watermark = channel->watermark.load(std::memory_order_acquire);
+    if(channel->reader->peek(&record, &len)) {
+      uint64_t timestamp;
+      memcpy(&timestamp, record + OutputHeaderLayout::timestamp::offset, sizeof(timestamp));
+      if(!earliest || timestamp < earliestTimestamp) {
+        earliest = channel.get();
+        earliestTimestamp = timestamp;
+      }
+      channel->seenWatermark = watermark;
+      channel->seenNanos = now;
+      continue;
+    }
+    if(flushing) {
+      continue;
+    }
+    if(watermark != channel->seenWatermark) {
+      channel->seenWatermark = watermark;
+      channel->seenNanos = now;
+    } else if(idleTimeoutNanos != 0 && now - channel->seenNanos >= idleTimeoutNanos) {
+      // Idle, so not waited on.
+      continue;
+    }
+    bound = std::min(bound, watermark);
+  }
+  // Unless a channel may yet write an earlier record.
+  if(!earliest || earliestTimestamp > bound) {
+    return false;
+  }
+  if(earliestTimestamp < lastMerged) {
+    orderViolations.store(orderViolations.load(std::memory_order_relaxed) + 1,
+        std::memory_order_relaxed);
+  } else {
+    lastMerged = earliestTimestamp;
+  }
+  earliest->reader->peek(&record, &len);
+  try {
+    memcpy(output->reserve(len), record, len);
+    output->commit(len);
+  } catch(...) {
+    fail(std::current_exception());
+  }
+  earliest->reader->release();
+  return true;
+}
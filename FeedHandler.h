@@ -0,0 +1,146 @@
+#pragma once
+
+#include <atomic>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "Parser.h"
+#include "UDPReceiver.h"
+
+struct ChannelConfig {
+  // Receive the channel from a socket on its own thread. Otherwise its
+  // packets are handed in through FeedHandler::onUDPPacket.
+  bool receive = false;
+  ReceiverConfig receiver;
+  // CPU to pin the channel's thread to, or -1 for any.
+  int cpu = -1;
+};
+
+// Tunables of a FeedHandler. The defaults suit a full trading day.
+struct FeedHandlerConfig {
+  std::vector<ChannelConfig> channels;
+  // Config of each channel's Parser. Callbacks, like onGap, are called on
+  // the channel's thread.
+  ParserConfig parser;
+  // CPU to pin the merging writer to, or -1 for any.
+  int writerCpu = -1;
+  // Packets handed in that can be queued per channel, and their longest.
+  size_t queueSize = 1024;
+  size_t maxPacketSize = 2048;
+  // Bytes of output records each channel can get ahead of the merge by.
+  size_t outputRingSize = 1 << 20;
+  // How long the merge waits on a channel with nothing to merge whose
+  // watermark hasn't moved, before merging the other channels' records
+  // without it. 0 waits forever, which stalls every channel once one's
+  // ring fills while another has nothing to parse.
+  uint64_t idleTimeoutNanos = 1000000;
+};
+
+// Parses several channels of a feed, each with its own sequence numbers,
+// on a thread per channel. Every channel owns its Parser, and with it its
+// own order table, symbols and book, rather than sharing one table among
+// channels, so its reordering, gap recovery and orders are independent of
+// the others'. Channels partition the feed by symbol, so their orders
+// never meet, and keeping them apart saves locking a shared order table
+// on every message.
+//
+// Output is either merged into one stream by a writer thread, ordered by
+// the output messages' timestamps, or written by each channel to a sink
+// of its own. Each channel publishes a watermark, the timestamp of the
+// latest message it parsed, after every batch of packets; since a
+// channel's timestamps never decrease, its later records can't be earlier.
+// The merge takes the earliest record among channels once it is no later
+// than the watermark of every channel with nothing to merge. A channel
+// whose watermark stays put for idleTimeoutNanos isn't waited on, so a
+// quiet or stalled one, say waiting out a gap, doesn't hold up the rest;
+// its later records can then be merged after later ones of other channels,
+// which #getOrderViolations counts. #flush merges everything parsed so
+// far, whatever the watermarks.
+//
+// Errors parsing a channel are rethrown on the next call to #onUDPPacket
+// or #flush, as std::runtime_error or std::invalid_argument.
+class FeedHandler {
+  class Channel;
+
+  std::vector<std::unique_ptr<Channel>> channels;
+  size_t maxPacketSize;
+
+  // Merged output: the file, if writing to one, and where records go.
+  std::unique_ptr<OutputWriter> ownedOutput;
+  OutputSink* output;
+  int writerCpu;
+  uint64_t idleTimeoutNanos;
+  std::thread writer;
+  // Timestamp of the latest record merged, the writer's.
+  uint64_t lastMerged;
+  // Records merged with an earlier timestamp than one merged before.
+  std::atomic<uint64_t> orderViolations;
+
+  // Flushes asked of the threads, and done by the writer.
+  uint64_t flushes;
+  std::atomic<uint64_t> flushRequest;
+  std::atomic<uint64_t> writerFlushed;
+  std::atomic<bool> stopping;
+  // Whether every thread started.
+  bool started;
+
+  // First error found on a channel since the last rethrow.
+  std::mutex errorLock;
+  std::exception_ptr error;
+  std::atomic<bool> failed;
+
+  // Shared by the public constructors.
+  FeedHandler(int date, const FeedHandlerConfig &config,
+      const std::vector<OutputSink*> &channelSinks);
+  // Starts the threads, once the output is set.
+  void start();
+
+  void runChannel(Channel &channel);
+  void runWriter();
+  // Takes the earliest record if no live channel could still write an
+  // earlier one, or the earliest whatever the watermarks if flushing.
+  // now is the writer's monotonic time. Returns false if there is none.
+  bool mergeOne(bool flushing, uint64_t now);
+  void fail(std::exception_ptr e);
+  void rethrow();
+  // Waits for handed in packets to be parsed, then flushes every thread.
+  void sync();
+
+  public:
+    // Merges the channels' output into outputFilename, buffered per
+    // config.parser.flush.
+    FeedHandler(int date, const std::string &outputFilename, const FeedHandlerConfig &config);
+    // Merges the channels' output into sink, which must outlive the
+    // handler.
+    FeedHandler(int date, OutputSink &sink, const FeedHandlerConfig &config);
+    // Each channel writes its output to the sink of the same index, from
+    // the channel's thread.
+    FeedHandler(int date, const std::vector<OutputSink*> &channelSinks,
+        const FeedHandlerConfig &config);
+    // Parses what was handed in, and stops the threads.
+    ~FeedHandler();
+
+    FeedHandler(const FeedHandler&) = delete;
+    FeedHandler& operator=(const FeedHandler&) = delete;
+
+    // Copies a packet for channel's thread to parse, waiting while the
+    // channel's queue is full. Only for channels that don't receive.
+    void onUDPPacket(size_t channel, const char *buf, size_t len);
+
+    // Waits for the packets handed in so far to be parsed, and flushes the
+    // output, merged or not.
+    void flush();
+
+    // Records merged out of timestamp order, after a channel passed over
+    // as idle or by a flush wrote earlier ones than already merged. Exact
+    // as of the last #flush.
+    uint64_t getOrderViolations() const;
+
+    size_t getChannelCount() const;
+    // Port a receiving channel is bound to, or 0 if it doesn't receive.
+    uint16_t getPort(size_t channel) const;
+};
@@ -0,0 +1,179 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+
+// Compile time descriptions of the wire layout of each input and output
+// message. A field only states its width; its offset follows from the
+// field before it, so a layout can't have gaps or overlaps, and the
+// message sizes fall out of the layouts rather than being kept in sync
+// by hand. Decoders and encoders address fields through these, which
+// compiles to a fixed-offset load, byte swap and store per field.
+
+// A field of width bytes at offset.
+template <size_t Offset, size_t Width>
+struct Field {
+  static constexpr size_t offset = Offset;
+  static constexpr size_t width = Width;
+  static constexpr size_t end = Offset + Width;
+};
+
+// The field of width bytes straight after Prev.
+template <typename Prev, size_t Width>
+using Next = Field<Prev::end, Width>;
+
+template <size_t Width> struct UintOf;
+template <> struct UintOf<1> { typedef uint8_t type; };
+template <> struct UintOf<2> { typedef uint16_t type; };
+template <> struct UintOf<4> { typedef uint32_t type; };
+template <> struct UintOf<8> { typedef uint64_t type; };
+
+inline uint8_t byteSwap(uint8_t v) { return v; }
+inline uint16_t byteSwap(uint16_t v) { return __builtin_bswap16(v); }
+inline uint32_t byteSwap(uint32_t v) { return __builtin_bswap32(v); }
+inline uint64_t byteSwap(uint64_t v) { return __builtin_bswap64(v); }
+
+// Reads big endian integer field F of an input message.
+template <typename F>
+inline typename UintOf<F::width>::type readField(const char* in) {
+  typename UintOf<F::width>::type value;
+  memcpy(&value, in + F::offset, F::width);
+  return byteSwap(value);
+}
+
+// Decodes big endian integer field F of an input message into dest.
+template <typename F, typename T>
+inline void decodeField(const char* in, T* dest) {
+  static_assert(std::is_floating_point<T>::value || sizeof(T) >= F::width,
+      "Field is wider than its destination.");
+  *dest = readField<F>(in);
+}
+
+// Copies byte field F, like a ticker, of an input message into dest.
+template <typename F>
+inline void decodeBytes(const char* in, char (&dest)[F::width]) {
+  memcpy(dest, in + F::offset, F::width);
+}
+
+// Writes value as field F of an output message. Output fields are in
+// host byte order.
+template <typename F, typename T>
+inline void encodeField(char* out, const T &value) {
+  static_assert(!std::is_pointer<T>::value, "Use encodeBytes to copy what a pointer points to.");
+  static_assert(sizeof(T) == F::width, "Field width doesn't match its value.");
+  memcpy(out + F::offset, &value, F::width);
+}
+
+// Copies byte field F, like a ticker, of an output message from src.
+template <typename F>
+inline void encodeBytes(char* out, const char* src) {
+  memcpy(out + F::offset, src, F::width);
+}
+
+// Header of each packet: its length, header included, and sequence
+// number.
+struct PacketHeaderLayout {
+  typedef Field<0, 2> length;
+  typedef Next<length, 4> sequenceNumber;
+  static constexpr size_t SIZE = sequenceNumber::end;
+};
+
+// Add Order, 'A'.
+struct InputAddLayout {
+  typedef Field<0, 1> msgType;
+  typedef Next<msgType, 8> timestamp;
+  typedef Next<timestamp, 8> orderRef;
+  typedef Next<orderRef, 1> side;
+  typedef Next<side, 4> size;
+  typedef Next<size, 8> ticker;
+  typedef Next<ticker, 4> price;
+  static constexpr size_t SIZE = price::end;
+};
+
+// Order Executed, 'E'.
+struct InputExecutedLayout {
+  typedef Field<0, 1> msgType;
+  typedef Next<msgType, 8> timestamp;
+  typedef Next<timestamp, 8> orderRef;
+  typedef Next<orderRef, 4> size;
+  static constexpr size_t SIZE = size::end;
+};
+
+// Order Canceled, 'X'.
+typedef InputExecutedLayout InputCanceledLayout;
+
+// Order Replaced, 'R'.
+struct InputReplacedLayout {
+  typedef Field<0, 1> msgType;
+  typedef Next<msgType, 8> timestamp;
+  typedef Next<timestamp, 8> originalOrderRef;
+  typedef Next<originalOrderRef, 8> newOrderRef;
+  typedef Next<newOrderRef, 4> size;
+  typedef Next<size, 4> price;
+  static constexpr size_t SIZE = price::end;
+};
+
+// Every output message starts with its type, size, ticker and timestamp.
+struct OutputHeaderLayout {
+  typedef Field<0, 2> msgType;
+  typedef Next<msgType, 2> msgSize;
+  typedef Next<msgSize, 8> ticker;
+  typedef Next<ticker, 8> timestamp;
+};
+
+// Type 1, Order Added.
+struct OutputAddLayout : OutputHeaderLayout {
+  typedef Next<timestamp, 8> orderRef;
+  typedef Next<orderRef, 1> side;
+  typedef Next<side, 3> padding;
+  typedef Next<padding, 4> size;
+  typedef Next<size, 8> price;
+  static constexpr size_t SIZE = price::end;
+};
+
+// Type 2, Order Executed.
+struct OutputExecutedLayout : OutputHeaderLayout {
+  typedef Next<timestamp, 8> orderRef;
+  typedef Next<orderRef, 4> size;
+  typedef Next<size, 8> price;
+  static constexpr size_t SIZE = price::end;
+};
+
+// Type 3, Order Reduced.
+struct OutputReducedLayout : OutputHeaderLayout {
+  typedef Next<timestamp, 8> orderRef;
+  typedef Next<orderRef, 4> sizeRemaining;
+  static constexpr size_t SIZE = sizeRemaining::end;
+};
+
+// Type 4, Order Replaced.
+struct OutputReplacedLayout : OutputHeaderLayout {
+  typedef Next<timestamp, 8> oldOrderRef;
+  typedef Next<oldOrderRef, 8> newOrderRef;
+  typedef Next<newOrderRef, 4> newSize;
+  typedef Next<newSize, 8> newPrice;
+  static constexpr size_t SIZE = newPrice::end;
+};
+
+// Type 5, Best Bid and Offer changed. Sizes are the aggregate of the
+// orders at the best price; a side with no orders has price and size 0.
+struct OutputBboLayout : OutputHeaderLayout {
+  typedef Next<timestamp, 8> bidPrice;
+  typedef Next<bidPrice, 8> bidSize;
+  typedef Next<bidSize, 8> askPrice;
+  typedef Next<askPrice, 8> askSize;
+  static constexpr size_t SIZE = askSize::end;
+};
+
+// Sizes from the feed specifications.
+static_assert(InputAddLayout::SIZE == 34, "Add Order is 34 bytes.");
+static_assert(InputExecutedLayout::SIZE == 21, "Order Executed is 21 bytes.");
+static_assert(InputCanceledLayout::SIZE == 21, "Order Canceled is 21 bytes.");
+static_assert(InputReplacedLayout::SIZE == 33, "Order Replaced is 33 bytes.");
+static_assert(OutputAddLayout::SIZE == 44, "Order Added is 44 bytes.");
+static_assert(OutputExecutedLayout::SIZE == 40, "Order Executed is 40 bytes.");
+static_assert(OutputReducedLayout::SIZE == 32, "Order Reduced is 32 bytes.");
+static_assert(OutputReplacedLayout::SIZE == 48, "Order Replaced is 48 bytes.");
+static_assert(OutputBboLayout::SIZE == 52, "BBO is 52 bytes.");
@@ -0,0 +1,407 @@
+#include "OrderBook.h"
+
+#include <algorithm>
+#include <cstring>
+#include <iterator>
+
+// Highest set bit at or below offset in a bitmap, or -1.
+static int highestAtOrBelow(const uint64_t* bitmap, int offset) {
+  for(int word = offset / 64; word >= 0; --word) {
+    uint64_t bits = bitmap[word];
+    if(word == offset / 64) {
+      bits &= ~0ull >> (63 - offset % 64);
+    }
+    if(bits) {
+      return word * 64 + 63 - __builtin_clzll(bits);
+    }
+  }
+  return -1;
+}
+
+// Lowest set bit at or above offset in a bitmap of words words, or -1.
+static int lowestAtOrAbove(const uint64_t* bitmap, int words, int offset) {
+  for(int word = offset / 64; word < words; ++word) {
+    uint64_t bits = bitmap[word];
+    if(word == offset / 64) {
+      bits &= ~0ull << (offset % 64);
+    }
+    if(bits) {
+      return word * 64 + __builtin_ctzll(bits);
+    }
+  }
+  return -1;
+}
+
+OrderBook::Side::Side(bool bids) : firstPage(0), bids(bids), best(0), hasBest(false) {
+  memset(pagesOccupied, 0, sizeof(pagesOccupied));
+}
+
+OrderBook::Side::~Side() {
+  for(Page* page : window) {
+    delete page;
+  }
+}
+
+OrderBook::Side::Side(Side&& other) noexcept
+  : window(std::move(other.window)), firstPage(other.firstPage),
+    outliers(std::move(other.outliers)), bids(other.bids), best(other.best),
+    hasBest(other.hasBest) {
+  memcpy(pagesOccupied, other.pagesOccupied, sizeof(pagesOccupied));
+  other.window.clear();
+}
+
+bool OrderBook::Side::inWindow(uint32_t price) const {
+  uint32_t pageNo = price / PAGE_TICKS;
+  return !window.empty() && pageNo >= firstPage && pageNo - firstPage < WINDOW_PAGES;
+}
+
+std::vector<OrderBook::Outlier>::iterator OrderBook::Side::lowerOutlier(uint64_t price) {
+  return std::lower_bound(outliers.begin(), outliers.end(), price,
+      [](const Outlier &outlier, uint64_t price) { return outlier.price < price; });
+}
+
+std::vector<OrderBook::Outlier>::const_iterator OrderBook::Side::lowerOutlier(
+    uint64_t price) const {
+  return std::lower_bound(outliers.begin(), outliers.end(), price,
+      [](const Outlier &outlier, uint64_t price) { return outlier.price < price; });
+}
+
+OrderBook::Level& OrderBook::Side::level(uint32_t price) {
+  Page*& page = window[price / PAGE_TICKS - firstPage];
+  if(!page) {
+    page = new Page();
+  }
+  return page->levels[price % PAGE_TICKS];
+}
+
+void OrderBook::Side::occupy(uint32_t price) {
+  size_t index = price / PAGE_TICKS - firstPage;
+  Page* page = window[index];
+  size_t offset = price % PAGE_TICKS;
+  page->occupied[offset / 64] |= 1ull << (offset % 64);
+  if(page->count++ == 0) {
+    pagesOccupied[index / 64] |= 1ull << (index % 64);
+  }
+}
+
+void OrderBook::Side::vacate(uint32_t price) {
+  size_t index = price / PAGE_TICKS - firstPage;
+  Page* page = window[index];
+  size_t offset = price % PAGE_TICKS;
+  page->occupied[offset / 64] &= ~(1ull << (offset % 64));
+  if(--page->count == 0) {
+    pagesOccupied[index / 64] &= ~(1ull << (index % 64));
+  }
+}
+
+void OrderBook::Side::recenter(uint32_t price) {
+  uint32_t pageNo = price / PAGE_TICKS;
+  uint32_t newFirst = pageNo > WINDOW_PAGES / 2 ? pageNo - WINDOW_PAGES / 2 : 0;
+  if(window.empty()) {
+    window.resize(WINDOW_PAGES, nullptr);
+  } else if(newFirst == firstPage) {
+    return;
+  }
+
+  // Pages staying in the window keep their levels; the levels of the rest
+  // become outliers, appended in price order and then merged in.
+  size_t kept = outliers.size();
+  std::vector<Page*> moved(WINDOW_PAGES, nullptr);
+  for(size_t i = 0; i < WINDOW_PAGES; i++) {
+    Page* page = window[i];
+    if(!page) {
+      continue;
+    }
+    uint64_t oldPageNo = uint64_t(firstPage) + i;
+    if(oldPageNo >= newFirst && oldPageNo - newFirst < WINDOW_PAGES) {
+      moved[oldPageNo - newFirst] = page;
+      continue;
+    }
+    for(size_t word = 0; word < PAGE_TICKS / 64; word++) {
+      for(uint64_t bits = page->occupied[word]; bits; bits &= bits - 1) {
+        size_t offset = word * 64 + __builtin_ctzll(bits);
+        outliers.push_back({uint32_t(oldPageNo * PAGE_TICKS + offset), page->levels[offset]});
+      }
+    }
+    delete page;
+  }
+  std::inplace_merge(outliers.begin(), outliers.begin() + kept, outliers.end(),
+      [](const Outlier &a, const Outlier &b) { return a.price < b.price; });
+  window.swap(moved);
+  firstPage = newFirst;
+  memset(pagesOccupied, 0, sizeof(pagesOccupied));
+  for(size_t i = 0; i < WINDOW_PAGES; i++) {
+    if(window[i] && window[i]->count) {
+      pagesOccupied[i / 64] |= 1ull << (i % 64);
+    }
+  }
+
+  // Outliers now inside the window move into it.
+  uint64_t start = uint64_t(firstPage) * PAGE_TICKS;
+  uint64_t end = start + WINDOW_PAGES * PAGE_TICKS;
+  auto first = lowerOutlier(start);
+  auto last = lowerOutlier(end);
+  for(auto it = first; it != last; ++it) {
+    level(it->price) = it->level;
+    occupy(it->price);
+  }
+  outliers.erase(first, last);
+}
+
+const OrderBook::Level* OrderBook::Side::find(uint32_t price) const {
+  if(inWindow(price)) {
+    const Page* page = window[price / PAGE_TICKS - firstPage];
+    return page ? &page->levels[price % PAGE_TICKS] : nullptr;
+  }
+  auto it = lowerOutlier(price);
+  return it == outliers.end() || it->price != price ? nullptr : &it->level;
+}
+
+void OrderBook::Side::add(uint32_t price, uint32_t size) {
+  if(!hasBest || (bids ? price > best : price < best)) {
+    if(!inWindow(price)) {
+      recenter(price);
+    }
+    best = price;
+    hasBest = true;
+  }
+  Level* entry;
+  if(inWindow(price)) {
+    entry = &level(price);
+    if(entry->orders == 0) {
+      occupy(price);
+    }
+  } else {
+    auto it = lowerOutlier(price);
+    if(it == outliers.end() || it->price != price) {
+      it = outliers.insert(it, {price, {0, 0}});
+    }
+    entry = &it->level;
+  }
+  entry->orders++;
+  entry->size += size;
+}
+
+void OrderBook::Side::reduce(uint32_t price, uint32_t size, bool removesOrder) {
+  Level* entry = const_cast<Level*>(find(price));
+  if(!entry || entry->orders == 0) {
+    return;
+  }
+  entry->size -= std::min<uint64_t>(size, entry->size);
+  if(removesOrder) {
+    entry->orders--;
+  }
+  if(entry->orders != 0) {
+    return;
+  }
+  if(inWindow(price)) {
+    entry->size = 0;
+    vacate(price);
+  } else {
+    outliers.erase(lowerOutlier(price));
+  }
+  if(hasBest && price == best) {
+    hasBest = nextBest(price, &best);
+    if(hasBest && !inWindow(best)) {
+      recenter(best);
+    }
+  }
+}
+
+bool OrderBook::Side::nextBestInWindow(uint32_t price, uint32_t* next) const {
+  if(window.empty()) {
+    return false;
+  }
+  const int pageWords = PAGE_TICKS / 64;
+  const int windowWords = WINDOW_PAGES / 64;
+  uint64_t start = uint64_t(firstPage) * PAGE_TICKS;
+  uint64_t end = start + WINDOW_PAGES * PAGE_TICKS;
+  int index;
+  int found;
+  if(bids) {
+    if(price <= start) {
+      return false;
+    }
+    uint64_t from = std::min<uint64_t>(price - 1, end - 1) - start;
+    index = from / PAGE_TICKS;
+    const Page* page = window[index];
+    found = page && page->count ? highestAtOrBelow(page->occupied, from % PAGE_TICKS) : -1;
+    if(found < 0 && index > 0) {
+      // The page summary skips empty pages a word of them at a time.
+      index = highestAtOrBelow(pagesOccupied, index - 1);
+      if(index >= 0) {
+        found = highestAtOrBelow(window[index]->occupied, PAGE_TICKS - 1);
+      }
+    }
+  } else {
+    if(uint64_t(price) + 1 >= end) {
+      return false;
+    }
+    uint64_t from = std::max<uint64_t>(uint64_t(price) + 1, start) - start;
+    index = from / PAGE_TICKS;
+    const Page* page = window[index];
+    found = page && page->count ? lowestAtOrAbove(page->occupied, pageWords, from % PAGE_TICKS) : -1;
+    if(found < 0 && index + 1 < static_cast<int>(WINDOW_PAGES)) {
+      index = lowestAtOrAbove(pagesOccupied, windowWords, index + 1);
+      if(index >= 0) {
+        found = lowestAtOrAbove(window[index]->occupied, pageWords, 0);
+      }
+    }
+  }
+  if(found < 0) {
+    return false;
+  }
+  *next = start + index * PAGE_TICKS + found;
+  return true;
+}
+
+bool OrderBook::Side::nextBest(uint32_t price, uint32_t* next) const {
+  uint32_t windowed;
+  bool inWindow = nextBestInWindow(price, &windowed);
+  uint32_t outlier = 0;
+  bool outside = false;
+  if(bids) {
+    auto it = lowerOutlier(price);
+    if(it != outliers.begin()) {
+      outlier = std::prev(it)->price;
+      outside = true;
+    }
+  } else {
+    auto it = lowerOutlier(uint64_t(price) + 1);
+    if(it != outliers.end()) {
+      outlier = it->price;
+      outside = true;
+    }
+  }
+  if(inWindow && outside) {
+    *next = bids ? std::max(windowed, outlier) : std::min(windowed, outlier);
+  } else if(inWindow || outside) {
+    *next = inWindow ? windowed : outlier;
+  }
+  return inWindow || outside;
+}
+
+size_t OrderBook::Side::depth(BookLevel* out, size_t max) const {
+  size_t count = 0;
+  uint32_t price = best;
+  bool more = hasBest;
+  while(more && count < max) {
+    const Level* entry = find(price);
+    out[count++] = {price, entry->orders, entry->size};
+    more = nextBest(price, &price);
+  }
+  return count;
+}
+
+OrderBook::OrderBook() {
+  for(auto &chunk : tops) {
+    chunk.store(nullptr, std::memory_order_relaxed);
+  }
+}
+
+OrderBook::~OrderBook() {
+  for(auto &chunk : tops) {
+    delete[] chunk.load(std::memory_order_relaxed);
+  }
+}
+
+OrderBook::SymbolBook& OrderBook::book(symbol_id_t symbol) {
+  if(symbol >= books.size()) {
+    books.resize(symbol + 1);
+  }
+  auto &chunk = tops[symbol / TOP_CHUNK];
+  if(!chunk.load(std::memory_order_relaxed)) {
+    chunk.store(new PublishedTop[TOP_CHUNK](), std::memory_order_release);
+  }
+  return books[symbol];
+}
+
+OrderBook::Side& OrderBook::side(symbol_id_t symbol, char side) {
+  SymbolBook &symbolBook = books[symbol];
+  return side == 'B' ? symbolBook.bids : symbolBook.asks;
+}
+
+void OrderBook::publish(symbol_id_t symbol, const SymbolBook &symbolBook) {
+  TopOfBook top = {};
+  if(symbolBook.bids.hasBest) {
+    top.bidPrice = symbolBook.bids.best;
+    top.bidSize = symbolBook.bids.find(top.bidPrice)->size;
+  }
+  if(symbolBook.asks.hasBest) {
+    top.askPrice = symbolBook.asks.best;
+    top.askSize = symbolBook.asks.find(top.askPrice)->size;
+  }
+  PublishedTop &slot = tops[symbol / TOP_CHUNK].load(std::memory_order_relaxed)[symbol % TOP_CHUNK];
+  uint64_t seq = slot.seq.load(std::memory_order_relaxed);
+  if(seq != 0 &&
+      slot.bidPrice.load(std::memory_order_relaxed) == top.bidPrice &&
+      slot.askPrice.load(std::memory_order_relaxed) == top.askPrice &&
+      slot.bidSize.load(std::memory_order_relaxed) == top.bidSize &&
+      slot.askSize.load(std::memory_order_relaxed) == top.askSize) {
+    return;
+  }
+  slot.seq.store(seq + 1, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+  slot.bidPrice.store(top.bidPrice, std::memory_order_relaxed);
+  slot.askPrice.store(top.askPrice, std::memory_order_relaxed);
+  slot.bidSize.store(top.bidSize, std::memory_order_relaxed);
+  slot.askSize.store(top.askSize, std::memory_order_relaxed);
+  slot.seq.store(seq + 2, std::memory_order_release);
+}
+
+void OrderBook::add(symbol_id_t symbol, char side, uint32_t price, uint32_t size) {
+  SymbolBook &symbolBook = book(symbol);
+  this->side(symbol, side).add(price, size);
+  publish(symbol, symbolBook);
+}
+
+void OrderBook::reduce(symbol_id_t symbol, char side, uint32_t price, uint32_t size,
+    bool removesOrder) {
+  if(symbol >= books.size()) {
+    return;
+  }
+  this->side(symbol, side).reduce(price, size, removesOrder);
+  publish(symbol, books[symbol]);
+}
+
+bool OrderBook::topOfBook(symbol_id_t symbol, TopOfBook* top) const {
+  const PublishedTop* chunk = tops[symbol / TOP_CHUNK].load(std::memory_order_acquire);
+  if(!chunk) {
+    return false;
+  }
+  const PublishedTop &slot = chunk[symbol % TOP_CHUNK];
+  uint64_t before;
+  uint64_t after;
+  do {
+    before = slot.seq.load(std::memory_order_acquire);
+    top->bidPrice = slot.bidPrice.load(std::memory_order_relaxed);
+    top->askPrice = slot.askPrice.load(std::memory_order_relaxed);
+    top->bidSize = slot.bidSize.load(std::memory_order_relaxed);
+    top->askSize = slot.askSize.load(std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_acquire);
+    after = slot.seq.load(std::memory_order_relaxed);
+  } while(before != after || (before & 1));
+  return before != 0;
+}
+
+BookLevel OrderBook::level(symbol_id_t symbol, char side, uint32_t price) const {
+  BookLevel result = {price, 0, 0};
+  if(symbol >= books.size()) {
+    return result;
+  }
+  const SymbolBook &symbolBook = books[symbol];
+  const Level* entry = (side == 'B' ? symbolBook.bids : symbolBook.asks).find(price);
+  if(entry) {
+    result.orders = entry->orders;
+    result.size = entry->size;
+  }
+  return result;
+}
+
+size_t OrderBook::depth(symbol_id_t symbol, char side, BookLevel* out, size_t max) const {
+  if(symbol >= books.size()) {
+    return 0;
+  }
+  const SymbolBook &symbolBook = books[symbol];
+  return (side == 'B' ? symbolBook.bids : symbolBook.asks).depth(out, max);
+}
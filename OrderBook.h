@@ -0,0 +1,153 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "SymbolTable.h"
+
+// Aggregate of the live orders at one price on one side.
+struct BookLevel {
+  // Price in the feed's integer units.
+  uint32_t price;
+  uint32_t orders;
+  uint64_t size;
+};
+
+// Best bid and offer of a symbol. A side with no orders has price and
+// size 0.
+struct TopOfBook {
+  uint32_t bidPrice;
+  uint32_t askPrice;
+  uint64_t bidSize;
+  uint64_t askSize;
+};
+
+// Full-depth, per-symbol book of price levels, updated in O(1) per order
+// event near the best price. Each side keeps a window of pages of levels,
+// indexed by price, around its best price, allocated a page of ticks at a
+// time as prices are seen, so an update touches one level and finding the
+// next best price after the best empties is a scan of a bitmap of pages
+// and then of the page's bitmap of levels. Prices outside the window, like
+// stub quotes far from the market, are kept in a flat array sorted by
+// price instead, so they cost an entry each rather than pages spanning the
+// distance. They are few, so an update there is a binary search and a
+// short move, without an allocation per level. The window moves to the
+// best price when the best leaves it.
+//
+// Updates and depth queries belong to the thread feeding the parser.
+// #topOfBook is safe from any thread: each symbol's top is published
+// through a sequence lock, which readers retry rather than block on.
+class OrderBook {
+  static const size_t PAGE_TICKS = 256;
+  // Pages in each side's window, a multiple of 64.
+  static const size_t WINDOW_PAGES = 256;
+
+  struct Level {
+    uint64_t size;
+    uint32_t orders;
+  };
+  struct Outlier {
+    uint32_t price;
+    Level level;
+  };
+  struct Page {
+    Level levels[PAGE_TICKS];
+    // Bit per level with orders.
+    uint64_t occupied[PAGE_TICKS / 64];
+    size_t count;
+  };
+  // One side of a symbol's book.
+  class Side {
+    // Pages covering ticks from firstPage * PAGE_TICKS; empty until the
+    // first order, and null pages until used.
+    std::vector<Page*> window;
+    uint32_t firstPage;
+    // Bit per page of the window with orders.
+    uint64_t pagesOccupied[WINDOW_PAGES / 64];
+    // Levels with orders outside the window, by ascending price.
+    std::vector<Outlier> outliers;
+    bool bids;
+
+    // First outlier at or above price.
+    std::vector<Outlier>::iterator lowerOutlier(uint64_t price);
+    std::vector<Outlier>::const_iterator lowerOutlier(uint64_t price) const;
+
+    bool inWindow(uint32_t price) const;
+    // The level at price, which must be in the window.
+    Level& level(uint32_t price);
+    // Mark the level at price, in the window, with or without orders.
+    void occupy(uint32_t price);
+    void vacate(uint32_t price);
+    // Moves the window to be centred on price, trading levels with the
+    // outliers.
+    void recenter(uint32_t price);
+    // Best occupied price strictly worse than price, if any.
+    bool nextBest(uint32_t price, uint32_t* next) const;
+    // Best occupied price in the window strictly worse than price, if any.
+    bool nextBestInWindow(uint32_t price, uint32_t* next) const;
+
+    public:
+      // Valid when hasBest.
+      uint32_t best;
+      bool hasBest;
+
+      explicit Side(bool bids);
+      ~Side();
+      Side(Side&&) noexcept;
+      Side(const Side&) = delete;
+      Side& operator=(const Side&) = delete;
+
+      void add(uint32_t price, uint32_t size);
+      void reduce(uint32_t price, uint32_t size, bool removesOrder);
+      const Level* find(uint32_t price) const;
+      size_t depth(BookLevel* out, size_t max) const;
+  };
+  struct SymbolBook {
+    Side bids;
+    Side asks;
+    SymbolBook() : bids(true), asks(false) {}
+  };
+
+  // Top of book as readers see it. seq is odd while being written.
+  struct alignas(64) PublishedTop {
+    std::atomic<uint64_t> seq;
+    std::atomic<uint32_t> bidPrice;
+    std::atomic<uint32_t> askPrice;
+    std::atomic<uint64_t> bidSize;
+    std::atomic<uint64_t> askSize;
+  };
+  static const size_t TOP_CHUNK = 256;
+
+  std::vector<SymbolBook> books;
+  // Published tops in chunks that never move, so readers can index them
+  // while the writer adds symbols.
+  std::atomic<PublishedTop*> tops[65536 / TOP_CHUNK];
+
+  SymbolBook& book(symbol_id_t symbol);
+  void publish(symbol_id_t symbol, const SymbolBook &book);
+  Side& side(symbol_id_t symbol, char side);
+
+  public:
+    OrderBook();
+    ~OrderBook();
+
+    OrderBook(const OrderBook&) = delete;
+    OrderBook& operator=(const OrderBook&) = delete;
+
+    // A new order of size at price. side is 'B' for bids, else asks.
+    void add(symbol_id_t symbol, char side, uint32_t price, uint32_t size);
+    // Takes size off the level, and the order itself once it has none left.
+    void reduce(symbol_id_t symbol, char side, uint32_t price, uint32_t size,
+        bool removesOrder);
+
+    // Best bid and offer, from any thread. Returns false if the symbol has
+    // never had an order.
+    bool topOfBook(symbol_id_t symbol, TopOfBook* top) const;
+    // The level at price, empty if there are no orders at it.
+    BookLevel level(symbol_id_t symbol, char side, uint32_t price) const;
+    // Fills out with up to max levels from the best price outwards,
+    // returning how many.
+    size_t depth(symbol_id_t symbol, char side, BookLevel* out, size_t max) const;
+};
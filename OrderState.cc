@@ -0,0 +1,370 @@
+#include "OrderState.h"
+#include "MessageLayout.h"
+#include "Parser.h"
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+const char SPACE_CHAR = ' ';
+const char NUL_CHAR = '\0';
+
+const padding_t PADDING = {0x00,0x00,0x00};
+const msgtype_t MSG_TYPE_1 = { 0x00, 0x01 };
+const msgtype_t MSG_TYPE_2[] = { 0x00, 0x02 };
+const msgtype_t MSG_TYPE_3[] = { 0x00, 0x03 };
+const msgtype_t MSG_TYPE_4[] = { 0x00, 0x04 };
+const msgtype_t MSG_TYPE_5[] = { 0x00, 0x05 };
+
+OrderState::OrderState(const ParserConfig &config, uint64_t midnightNanos)
+    : epochToMidnightLocalNanos(midnightNanos),
+      orders(config.expectedOrders),
+      unknownRefPolicy(config.unknownRefPolicy),
+      retirePolicy(config.retirePolicy),
+      graveyardSize(config.graveyardSize),
+      graveyardNext(0),
+      filteredMessages(0),
+      trackMoves(config.bboOutput) {
+  if(retirePolicy == RETIRE_GRAVEYARD && graveyardSize == 0) {
+    throw std::invalid_argument("Graveyard size must be positive.");
+  }
+  if(!config.subscriptions.empty()) {
+    subscription.reset(new SubscriptionSet(config.subscriptions));
+  }
+  if(config.maintainBook || config.bboOutput) {
+    book.reset(new OrderBook());
+  }
+}
+
+bool OrderState::subscribed(const char* msg) {
+  if(!subscription) {
+    return true;
+  }
+  uint64_t ticker;
+  memcpy(&ticker, msg + InputAddLayout::ticker::offset, sizeof(ticker));
+  if(subscription->contains(ticker)) {
+    return true;
+  }
+  ignoredRefs.insert(readField<InputAddLayout::orderRef>(msg));
+  filteredMessages++;
+  return false;
+}
+
+size_t OrderState::addOrder(char* out, const InputAddOrder &inputMsg) {
+  typedef OutputAddLayout L;
+
+  ticker_t ticker;
+  memcpy(ticker, inputMsg.ticker, sizeof(ticker));
+  // Replace space with null.
+  for(int i = 0 ; i < 8; i++) {
+    if(ticker[i] == SPACE_CHAR) {
+      ticker[i] = NUL_CHAR;
+    }
+  }
+  double price = double(inputMsg.price);
+
+  encodeField<L::msgType>(out, MSG_TYPE_1);
+  encodeField<L::msgSize>(out, (uint16_t) L::SIZE);
+  encodeField<L::ticker>(out, ticker);
+  encodeField<L::timestamp>(out, epochToMidnightLocalNanos + inputMsg.timestamp);
+  encodeField<L::orderRef>(out, inputMsg.orderRef);
+  encodeField<L::side>(out, inputMsg.side);
+  encodeField<L::padding>(out, PADDING);
+  encodeField<L::size>(out, inputMsg.size);
+  encodeField<L::price>(out, price);
+
+  symbol_id_t symbol = symbols.intern(ticker);
+  orders.insert(inputMsg.orderRef, {
+    price,
+    inputMsg.size,
+    symbol,
+    inputMsg.side
+  });
+  if(book && inputMsg.size > 0) {
+    book->add(symbol, inputMsg.side, inputMsg.price, inputMsg.size);
+    move(symbol, inputMsg.timestamp);
+  }
+  if(inputMsg.size == 0) {
+    retireOrder(inputMsg.orderRef);
+  }
+  return L::SIZE;
+}
+
+size_t OrderState::orderExecuted(char* out, const InputOrderExecuted &inputMsg) {
+  typedef OutputExecutedLayout L;
+
+  // Inherit ticker symbol from original order.
+  PendingOrder_t* pendingOrder = lookupOrder(inputMsg.orderRef);
+  if(pendingOrder == nullptr) {
+    return 0;
+  }
+
+  uint32_t executionSize = inputMsg.size;
+  // Can execute at most the remaining size.
+  if(executionSize > pendingOrder->sizeRemaining) {
+    executionSize = pendingOrder->sizeRemaining;
+  }
+  pendingOrder->sizeRemaining -= executionSize;
+  if(book && executionSize > 0) {
+    book->reduce(pendingOrder->symbol, pendingOrder->side, uint32_t(pendingOrder->price),
+        executionSize, pendingOrder->sizeRemaining == 0);
+    move(pendingOrder->symbol, inputMsg.timestamp);
+  }
+
+  encodeField<L::msgType>(out, *MSG_TYPE_2);
+  encodeField<L::msgSize>(out, (uint16_t) L::SIZE);
+  encodeBytes<L::ticker>(out, symbols.ticker(pendingOrder->symbol));
+  encodeField<L::timestamp>(out, epochToMidnightLocalNanos + inputMsg.timestamp);
+  encodeField<L::orderRef>(out, inputMsg.orderRef);
+  encodeField<L::size>(out, executionSize);
+  encodeField<L::price>(out, pendingOrder->price);
+
+  if(executionSize > 0 && pendingOrder->sizeRemaining == 0) {
+    retireOrder(inputMsg.orderRef);
+  }
+  return L::SIZE;
+}
+
+size_t OrderState::orderReduced(char* out, const InputOrderCanceled &inputMsg) {
+  typedef OutputReducedLayout L;
+
+  // Inherit ticker symbol from original order.
+  PendingOrder_t* pendingOrder = lookupOrder(inputMsg.orderRef);
+  if(pendingOrder == nullptr) {
+    return 0;
+  }
+
+  // Reduce remaining size by the cancel amount.
+  uint32_t sizeRemaining = (inputMsg.size > pendingOrder->sizeRemaining ?
+      0 : pendingOrder->sizeRemaining - inputMsg.size);
+  bool retired = pendingOrder->sizeRemaining > 0 && sizeRemaining == 0;
+  if(book && sizeRemaining != pendingOrder->sizeRemaining) {
+    book->reduce(pendingOrder->symbol, pendingOrder->side, uint32_t(pendingOrder->price),
+        pendingOrder->sizeRemaining - sizeRemaining, retired);
+    move(pendingOrder->symbol, inputMsg.timestamp);
+  }
+  pendingOrder->sizeRemaining = sizeRemaining;
+
+  encodeField<L::msgType>(out, *MSG_TYPE_3);
+  encodeField<L::msgSize>(out, (uint16_t) L::SIZE);
+  encodeBytes<L::ticker>(out, symbols.ticker(pendingOrder->symbol));
+  encodeField<L::timestamp>(out, epochToMidnightLocalNanos + inputMsg.timestamp);
+  encodeField<L::orderRef>(out, inputMsg.orderRef);
+  encodeField<L::sizeRemaining>(out, sizeRemaining);
+
+  if(retired) {
+    retireOrder(inputMsg.orderRef);
+  }
+  return L::SIZE;
+}
+
+void OrderState::encodeReplaced(char* out, const InputOrderReplaced &inputMsg,
+    symbol_id_t symbol) {
+  typedef OutputReplacedLayout L;
+  encodeField<L::msgType>(out, *MSG_TYPE_4);
+  encodeField<L::msgSize>(out, (uint16_t) L::SIZE);
+  encodeBytes<L::ticker>(out, symbols.ticker(symbol));
+  encodeField<L::timestamp>(out, epochToMidnightLocalNanos + inputMsg.timestamp);
+  encodeField<L::oldOrderRef>(out, inputMsg.originalOrderRef);
+  encodeField<L::newOrderRef>(out, inputMsg.newOrderRef);
+  encodeField<L::newSize>(out, inputMsg.size);
+  encodeField<L::newPrice>(out, inputMsg.price);
+}
+
+size_t OrderState::orderReplaced(char* out, const InputOrderReplaced &inputMsg) {
+  // Inherit ticker symbol.
+  PendingOrder_t* pendingOrder = lookupOrder(inputMsg.originalOrderRef);
+  if(pendingOrder == nullptr) {
+    // The replacement of an ignored order is ignored too.
+    if(subscription && ignoredRefs.contains(inputMsg.originalOrderRef)) {
+      if(inputMsg.originalOrderRef != inputMsg.newOrderRef) {
+        retireIgnored(inputMsg.originalOrderRef);
+      }
+      ignoredRefs.insert(inputMsg.newOrderRef);
+    }
+    return 0;
+  }
+  encodeReplaced(out, inputMsg, pendingOrder->symbol);
+
+  // Update old order.
+  bool retired = pendingOrder->sizeRemaining > 0;
+  // The new order inherits the ticker and side.
+  symbol_id_t symbol = pendingOrder->symbol;
+  char side = pendingOrder->side;
+  if(book) {
+    if(retired) {
+      book->reduce(symbol, side, uint32_t(pendingOrder->price),
+          pendingOrder->sizeRemaining, true);
+    }
+    if(inputMsg.size > 0) {
+      book->add(symbol, side, inputMsg.price, inputMsg.size);
+    }
+    move(symbol, inputMsg.timestamp);
+  }
+  pendingOrder->sizeRemaining = 0;
+
+  orders.insert(inputMsg.newOrderRef, {
+    double(inputMsg.price),
+    inputMsg.size,
+    symbol,
+    side
+  });
+
+  if(retired && inputMsg.originalOrderRef != inputMsg.newOrderRef) {
+    retireOrder(inputMsg.originalOrderRef);
+  }
+  if(inputMsg.size == 0) {
+    retireOrder(inputMsg.newOrderRef);
+  }
+  return OutputReplacedLayout::SIZE;
+}
+
+size_t OrderState::replaceOld(char* out, const InputOrderReplaced &inputMsg,
+    Inheritance* inherited) {
+  inherited->found = false;
+  inherited->ignored = subscription && ignoredRefs.contains(inputMsg.originalOrderRef);
+  PendingOrder_t* pendingOrder = lookupOrder(inputMsg.originalOrderRef);
+  if(pendingOrder == nullptr) {
+    if(inherited->ignored && inputMsg.originalOrderRef != inputMsg.newOrderRef) {
+      retireIgnored(inputMsg.originalOrderRef);
+    }
+    return 0;
+  }
+  encodeReplaced(out, inputMsg, pendingOrder->symbol);
+
+  bool retired = pendingOrder->sizeRemaining > 0;
+  if(book && retired) {
+    book->reduce(pendingOrder->symbol, pendingOrder->side, uint32_t(pendingOrder->price),
+        pendingOrder->sizeRemaining, true);
+    move(pendingOrder->symbol, inputMsg.timestamp);
+  }
+  memcpy(inherited->ticker, symbols.ticker(pendingOrder->symbol), sizeof(ticker_t));
+  inherited->side = pendingOrder->side;
+  inherited->found = true;
+  pendingOrder->sizeRemaining = 0;
+  if(retired) {
+    retireOrder(inputMsg.originalOrderRef);
+  }
+  return OutputReplacedLayout::SIZE;
+}
+
+void OrderState::replaceNew(const InputOrderReplaced &inputMsg, const Inheritance &inherited) {
+  if(!inherited.found) {
+    if(inherited.ignored) {
+      ignoredRefs.insert(inputMsg.newOrderRef);
+    }
+    return;
+  }
+  symbol_id_t symbol = symbols.intern(inherited.ticker);
+  orders.insert(inputMsg.newOrderRef, {
+    double(inputMsg.price),
+    inputMsg.size,
+    symbol,
+    inherited.side
+  });
+  if(book && inputMsg.size > 0) {
+    book->add(symbol, inherited.side, inputMsg.price, inputMsg.size);
+    move(symbol, inputMsg.timestamp);
+  }
+  if(inputMsg.size == 0) {
+    retireOrder(inputMsg.newOrderRef);
+  }
+}
+
+size_t OrderState::bbo(char* out, symbol_id_t symbol, const TopOfBook &top,
+    uint64_t timestamp) const {
+  typedef OutputBboLayout L;
+  encodeField<L::msgType>(out, *MSG_TYPE_5);
+  encodeField<L::msgSize>(out, (uint16_t) L::SIZE);
+  encodeBytes<L::ticker>(out, symbols.ticker(symbol));
+  encodeField<L::timestamp>(out, epochToMidnightLocalNanos + timestamp);
+  encodeField<L::bidPrice>(out, double(top.bidPrice));
+  encodeField<L::bidSize>(out, top.bidSize);
+  encodeField<L::askPrice>(out, double(top.askPrice));
+  encodeField<L::askSize>(out, top.askSize);
+  return L::SIZE;
+}
+
+void OrderState::move(symbol_id_t symbol, uint64_t timestamp) {
+  if(!trackMoves) {
+    return;
+  }
+  if(symbol >= moves.size()) {
+    moves.resize(symbol + 1, Move());
+  }
+  Move &entry = moves[symbol];
+  entry.timestamp = timestamp;
+  if(!entry.moved) {
+    entry.moved = true;
+    moved.push_back(symbol);
+  }
+}
+
+void OrderState::clearMoved() {
+  for(symbol_id_t symbol : moved) {
+    moves[symbol].moved = false;
+  }
+  moved.clear();
+}
+
+PendingOrder_t* OrderState::lookupOrder(uint64_t orderRef) {
+  PendingOrder_t* order = orders.find(orderRef);
+  if(order == nullptr && subscription && ignoredRefs.contains(orderRef)) {
+    filteredMessages++;
+    return nullptr;
+  }
+  if(order == nullptr && unknownRefPolicy == UNKNOWN_REF_THROW) {
+    throw std::runtime_error("Order ref was not found: " +  std::to_string(orderRef));
+  }
+  return order;
+}
+
+void OrderState::retireOrder(uint64_t orderRef) {
+  switch(retirePolicy) {
+    case RETIRE_NEVER:
+      break;
+    case RETIRE_IMMEDIATELY:
+      orders.erase(orderRef);
+      break;
+    case RETIRE_GRAVEYARD:
+      if(graveyard.size() < graveyardSize) {
+        graveyard.push_back(orderRef);
+        break;
+      }
+      // Evict the oldest retired order, unless it was since re-added. One
+      // not in the table was ignored.
+      uint64_t evicted = graveyard[graveyardNext];
+      PendingOrder_t* order = orders.find(evicted);
+      if(order == nullptr) {
+        ignoredRefs.erase(evicted);
+      } else if(order->sizeRemaining == 0) {
+        orders.erase(evicted);
+      }
+      graveyard[graveyardNext] = orderRef;
+      graveyardNext = (graveyardNext + 1) % graveyardSize;
+      break;
+  }
+}
+
+void OrderState::retireIgnored(uint64_t orderRef) {
+  if(retirePolicy == RETIRE_IMMEDIATELY) {
+    ignoredRefs.erase(orderRef);
+  } else {
+    retireOrder(orderRef);
+  }
+}
+
+uint64_t OrderState::getFilteredMessages() const {
+  return filteredMessages;
+}
+
+const OrderBook* OrderState::getBook() const {
+  return book.get();
+}
+
+int OrderState::getSymbol(const std::string &ticker) const {
+  // Tickers are held nul padded.
+  ticker_t chars = {};
+  memcpy(chars, ticker.data(), std::min(ticker.size(), sizeof(chars)));
+  return ticker.size() > sizeof(chars) ? -1 : symbols.find(chars);
+}
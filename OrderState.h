@@ -0,0 +1,153 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "OrderBook.h"
+#include "OrderTable.h"
+#include "Subscription.h"
+#include "SymbolTable.h"
+
+struct InputAddOrder;
+struct InputOrderExecuted;
+struct InputOrderCanceled;
+struct InputOrderReplaced;
+struct ParserConfig;
+
+// What happens to an order once it has no size remaining, i.e. it was
+// fully executed, fully canceled or replaced.
+enum RetirePolicy {
+  // Keep every order for the whole session. Memory grows with order refs.
+  RETIRE_NEVER,
+  // Erase the order straight away.
+  RETIRE_IMMEDIATELY,
+  // Keep the most recently retired orders around for late references, and
+  // erase the oldest once more than ParserConfig::graveyardSize are kept.
+  RETIRE_GRAVEYARD,
+};
+
+// How Executed, Canceled and Replaced messages are handled when their order
+// ref is unknown, either because it was never added or it was retired.
+enum UnknownRefPolicy {
+  // Throw std::runtime_error.
+  UNKNOWN_REF_THROW,
+  // Drop the message without writing an output message.
+  UNKNOWN_REF_DROP,
+};
+
+// Live orders, and the output messages of the events applied to them.
+// Parser keeps one, and so does each worker of a ShardedParser, so both
+// track orders and serialize output the same way.
+//
+// Orders are applied in feed order. Each event serializes its output
+// message, which is at most OutputSink::MAX_RECORD_SIZE bytes, and returns
+// its length, or 0 if the message was dropped without output.
+class OrderState {
+  uint64_t epochToMidnightLocalNanos;
+
+  // Track Add Orders and their remaining order size.
+  OrderTable orders;
+  // Tickers of orders, with spaces replaced by nul.
+  SymbolTable symbols;
+  // Returns the order. Unknown refs are handled per unknownRefPolicy,
+  // returning nullptr when dropped.
+  PendingOrder_t* lookupOrder(uint64_t orderRef);
+  UnknownRefPolicy unknownRefPolicy;
+
+  // Reclaims an order whose remaining size dropped to 0 per retirePolicy.
+  void retireOrder(uint64_t orderRef);
+  // Likewise for the ref of an ignored order that was replaced, the only
+  // point at which an order whose size isn't tracked is known to be gone.
+  void retireIgnored(uint64_t orderRef);
+  RetirePolicy retirePolicy;
+  // Refs of retired orders still in the table or in ignoredRefs, in a
+  // circular buffer
+  // whose oldest entry is at graveyardNext once full.
+  std::vector<uint64_t> graveyard;
+  size_t graveyardSize;
+  size_t graveyardNext;
+
+  // Subscribed tickers, or null if parsing all of them.
+  std::unique_ptr<SubscriptionSet> subscription;
+  // Refs of orders skipped for their ticker, and of their replacements.
+  RefBitmap ignoredRefs;
+  // Messages skipped or dropped for an unsubscribed ticker.
+  uint64_t filteredMessages;
+
+  // Levels of live orders per ticker, or null unless config.maintainBook
+  // or config.bboOutput.
+  std::unique_ptr<OrderBook> book;
+  // Symbols whose book moved, see #getMovedSymbols. Only with bboOutput.
+  bool trackMoves;
+  struct Move {
+    // Timestamp of the latest message moving the symbol's book.
+    uint64_t timestamp;
+    bool moved;
+  };
+  // Indexed by symbol id.
+  std::vector<Move> moves;
+  std::vector<symbol_id_t> moved;
+  // Notes a book update to symbol by a message at timestamp.
+  void move(symbol_id_t symbol, uint64_t timestamp);
+
+  void encodeReplaced(char* out, const InputOrderReplaced &msg, symbol_id_t symbol);
+
+  public:
+    // What the new order of a Replaced inherits from the old one, when the
+    // two refs are kept by different OrderStates.
+    struct Inheritance {
+      ticker_t ticker;
+      char side;
+      // Whether the old ref was known; if not, neither is the new one.
+      bool found;
+      // Whether the old ref was skipped for its ticker, and so the new is.
+      bool ignored;
+    };
+
+    // midnightNanos - nanoseconds from the epoch to local midnight of the
+    // feed's date, which output timestamps count from.
+    OrderState(const ParserConfig &config, uint64_t midnightNanos);
+
+    OrderState(const OrderState&) = delete;
+    OrderState& operator=(const OrderState&) = delete;
+
+    // Whether config.subscriptions is set.
+    bool filtering() const { return subscription != nullptr; }
+    // Whether the Add Order in wire format at msg is of a subscribed
+    // ticker. If not, it is counted filtered and its ref ignored, so the
+    // order's later messages are dropped. Reads only the ticker, and the
+    // ref if the order is skipped.
+    bool subscribed(const char* msg);
+
+    // Unknown refs throw std::runtime_error under UNKNOWN_REF_THROW.
+    size_t addOrder(char* out, const InputAddOrder &msg);
+    size_t orderExecuted(char* out, const InputOrderExecuted &msg);
+    size_t orderReduced(char* out, const InputOrderCanceled &msg);
+    size_t orderReplaced(char* out, const InputOrderReplaced &msg);
+    // A Replaced whose new ref is kept by another OrderState, in two
+    // halves. The old ref's half writes the output message, retires the
+    // old order and fills in inherited, even when dropping the message or
+    // throwing. The new ref's half adds the new order from inherited.
+    size_t replaceOld(char* out, const InputOrderReplaced &msg, Inheritance* inherited);
+    void replaceNew(const InputOrderReplaced &msg, const Inheritance &inherited);
+    // A BBO message of symbol's top of book, for a message at timestamp.
+    size_t bbo(char* out, symbol_id_t symbol, const TopOfBook &top, uint64_t timestamp) const;
+
+    // Starts loading orderRef's slot into cache ahead of its event.
+    void prefetch(uint64_t orderRef) const { orders.prefetch(orderRef); }
+
+    // Symbols whose book moved since #clearMoved, in order of first move,
+    // if config.bboOutput.
+    const std::vector<symbol_id_t>& getMovedSymbols() const { return moved; }
+    // Timestamp of the latest message moving a symbol's book.
+    uint64_t getMovedAt(symbol_id_t symbol) const { return moves[symbol].timestamp; }
+    void clearMoved();
+
+    uint64_t getFilteredMessages() const;
+    const OrderBook* getBook() const;
+    // Id of ticker in the book, or -1 if no order has had it.
+    int getSymbol(const std::string &ticker) const;
+};
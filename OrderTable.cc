@@ -0,0 +1,144 @@
+#include "OrderTable.h"
+
+#include <cstring>
+#include <utility>
+
+// Kept low enough for Robin Hood probe distances to stay in a few slots.
+const size_t MAX_LOAD_NUMERATOR = 7;
+const size_t MAX_LOAD_DENOMINATOR = 8;
+
+const size_t MIN_CAPACITY = 16;
+
+// Control byte of an empty slot. Occupied slots store probe distance + 1.
+const uint8_t EMPTY = 0;
+// A probe distance that no longer fits a control byte forces a rehash.
+const uint8_t MAX_CONTROL = 255;
+
+OrderTable::OrderTable(size_t expectedOrders) {
+  entries = nullptr;
+  control = nullptr;
+  capacity = 0;
+  shift = 64;
+  count = 0;
+  reserve(expectedOrders);
+}
+
+OrderTable::~OrderTable() {
+  delete[] entries;
+  delete[] control;
+}
+
+size_t OrderTable::home(uint64_t orderRef) const {
+  // Fibonacci hashing: scatters dense, sequential refs across the table.
+  return (orderRef * 0x9E3779B97F4A7C15ULL) >> shift;
+}
+
+PendingOrder_t* OrderTable::find(uint64_t orderRef) {
+  size_t mask = capacity - 1;
+  size_t i = home(orderRef);
+  for(int ctrl = 1; ctrl <= control[i]; ctrl++) {
+    if(entries[i].orderRef == orderRef) {
+      return &entries[i].order;
+    }
+    i = (i + 1) & mask;
+  }
+  return nullptr;
+}
+
+PendingOrder_t* OrderTable::insert(uint64_t orderRef, const PendingOrder_t &order) {
+  PendingOrder_t* existing = find(orderRef);
+  if(existing != nullptr) {
+    *existing = order;
+    return existing;
+  }
+
+  if((count + 1) * MAX_LOAD_DENOMINATOR > capacity * MAX_LOAD_NUMERATOR) {
+    rehash(capacity * 2);
+  }
+  return place({orderRef, order});
+}
+
+PendingOrder_t* OrderTable::place(Entry entry) {
+  uint64_t orderRef = entry.orderRef;
+  size_t mask = capacity - 1;
+  size_t i = home(entry.orderRef);
+  uint8_t ctrl = 1;
+  PendingOrder_t* placed = nullptr;
+  while(control[i] != EMPTY) {
+    // Take the slot from an entry closer to its home, and carry on
+    // placing the displaced entry.
+    if(control[i] < ctrl) {
+      std::swap(entries[i], entry);
+      std::swap(control[i], ctrl);
+      if(placed == nullptr) {
+        placed = &entries[i].order;
+      }
+    }
+    if(ctrl == MAX_CONTROL) {
+      // Pathological clustering. Spread out and place the carried entry.
+      rehash(capacity * 2);
+      place(entry);
+      return find(orderRef);
+    }
+    i = (i + 1) & mask;
+    ctrl++;
+  }
+  entries[i] = entry;
+  control[i] = ctrl;
+  count++;
+  return placed != nullptr ? placed : &entries[i].order;
+}
+
+bool OrderTable::erase(uint64_t orderRef) {
+  size_t mask = capacity - 1;
+  size_t i = home(orderRef);
+  for(int ctrl = 1; ctrl <= control[i]; ctrl++) {
+    if(entries[i].orderRef == orderRef) {
+      // Shift the rest of the run back until an empty slot or an entry
+      // already in its home slot.
+      size_t next = (i + 1) & mask;
+      while(control[next] > 1) {
+        entries[i] = entries[next];
+        control[i] = control[next] - 1;
+        i = next;
+        next = (next + 1) & mask;
+      }
+      control[i] = EMPTY;
+      count--;
+      return true;
+    }
+    i = (i + 1) & mask;
+  }
+  return false;
+}
+
+void OrderTable::reserve(size_t n) {
+  size_t newCapacity = MIN_CAPACITY;
+  while(n * MAX_LOAD_DENOMINATOR > newCapacity * MAX_LOAD_NUMERATOR) {
+    newCapacity *= 2;
+  }
+  if(newCapacity > capacity) {
+    rehash(newCapacity);
+  }
+}
+
+void OrderTable::rehash(size_t newCapacity) {
+  Entry* oldEntries = entries;
+  uint8_t* oldControl = control;
+  size_t oldCapacity = capacity;
+
+  entries = new Entry[newCapacity];
+  control = new uint8_t[newCapacity];
+  memset(control, EMPTY, newCapacity);
+  capacity = newCapacity;
+  shift = 64 - __builtin_ctzll(newCapacity);
+  count = 0;
+
+  for(size_t i = 0; i < oldCapacity; i++) {
+    if(oldControl[i] != EMPTY) {
+      place(oldEntries[i]);
+    }
+  }
+  delete[] oldEntries;
+  delete[] oldControl;
+}
@@ -0,0 +1,77 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+
+#include "SymbolTable.h"
+
+// Plain, fixed-size state of a live order. Orders refer to their ticker
+// through the SymbolTable rather than owning a copy of it.
+struct PendingOrder_t {
+  double price;
+  uint32_t sizeRemaining;
+  symbol_id_t symbol;
+  // 'B' or 'S', as in the Add Order.
+  char side;
+};
+
+static_assert(sizeof(PendingOrder_t) == 16, "Pending orders should pack densely.");
+
+// Open-addressing hash index of pending orders, keyed by orderRef.
+//
+// Entries live in one flat array probed linearly with Robin Hood ordering:
+// an entry never sits further from its home slot than the entry it
+// displaced, which keeps probe sequences short even at high load. Each
+// slot has a control byte holding its probe distance + 1 (0 when empty),
+// so a lookup can stop as soon as it passes the distance the key would
+// have. Erasing shifts the following run back one slot instead of leaving
+// a tombstone.
+//
+// Pointers returned by #find and #insert are invalidated by any later
+// #insert or #erase.
+class OrderTable {
+  struct Entry {
+    uint64_t orderRef;
+    PendingOrder_t order;
+  };
+
+  Entry* entries;
+  uint8_t* control;
+  // Number of slots, always a power of two.
+  size_t capacity;
+  // Right shift taking the hash down to a slot index.
+  int shift;
+  size_t count;
+
+  size_t home(uint64_t orderRef) const;
+  // Places an entry known not to be in the table. Capacity must allow it.
+  PendingOrder_t* place(Entry entry);
+  void rehash(size_t newCapacity);
+
+  public:
+    // expectedOrders - number of live orders to reserve room for upfront.
+    // The table still grows beyond it.
+    explicit OrderTable(size_t expectedOrders = 0);
+    ~OrderTable();
+
+    OrderTable(const OrderTable&) = delete;
+    OrderTable& operator=(const OrderTable&) = delete;
+
+    // Returns the order, or nullptr if orderRef is not in the table.
+    PendingOrder_t* find(uint64_t orderRef);
+    // Inserts the order, overwriting any order with the same orderRef.
+    PendingOrder_t* insert(uint64_t orderRef, const PendingOrder_t &order);
+    // Returns whether orderRef was in the table.
+    bool erase(uint64_t orderRef);
+
+    // Starts loading orderRef's home slot into cache ahead of a lookup.
+    void prefetch(uint64_t orderRef) const {
+      size_t i = home(orderRef);
+      __builtin_prefetch(&control[i]);
+      __builtin_prefetch(&entries[i]);
+    }
+
+    // Grows the table to hold n orders without rehashing.
+    void reserve(size_t n);
+    size_t size() const { return count; }
+};
@@ -0,0 +1,30 @@
+#include "OutputSink.h"
+
+#include <stdexcept>
+
+CallbackSink::CallbackSink(const RecordCallback &callback) : callback(callback) {
+  if(!callback) {
+    throw std::invalid_argument("Callback sink needs a callback.");
+  }
+}
+
+char* CallbackSink::reserve(size_t len) {
+  if(len > MAX_RECORD_SIZE) {
+    throw std::invalid_argument("Record too long.");
+  }
+  return record;
+}
+
+void CallbackSink::commit(size_t len) {
+  callback(record, len);
+}
+
+char* DiscardSink::reserve(size_t len) {
+  if(len > MAX_RECORD_SIZE) {
+    throw std::invalid_argument("Record too long.");
+  }
+  return record;
+}
+
+void DiscardSink::commit(size_t) {
+}
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <cstddef>
+#include <functional>
+
+// Destination of serialized output messages, in the output file's wire
+// format. Records are built in place: the parser reserves space, encodes
+// the message straight into it, and commits it, so a sink that hands the
+// memory to its consumer never copies a record.
+class OutputSink {
+  public:
+    // No record is longer than this.
+    static constexpr size_t MAX_RECORD_SIZE = 64;
+
+    virtual ~OutputSink() {}
+
+    // Returns space for a record of up to len bytes. It is only valid
+    // until the next call on the sink; reserving again abandons it.
+    virtual char* reserve(size_t len) = 0;
+    // Publishes the first len bytes written to the last reservation.
+    virtual void commit(size_t len) = 0;
+    // Applies any time based thresholds, called once per packet or batch.
+    virtual void poll() {}
+    // Makes everything committed visible to the consumer.
+    virtual void flush() {}
+};
+
+// Drops every record, for a parser whose messages are decoded elsewhere.
+class DiscardSink : public OutputSink {
+  char record[MAX_RECORD_SIZE];
+
+  public:
+    char* reserve(size_t len) override;
+    void commit(size_t len) override;
+};
+
+typedef std::function<void(const char* record, size_t len)> RecordCallback;
+
+// Hands each record to a callback as it is committed. The record points
+// into the sink and is only valid for the duration of the call.
+class CallbackSink : public OutputSink {
+  RecordCallback callback;
+  char record[MAX_RECORD_SIZE];
+
+  public:
+    explicit CallbackSink(const RecordCallback &callback);
+
+    char* reserve(size_t len) override;
+    void commit(size_t len) override;
+};
@@ -0,0 +1,238 @@
+#include "OutputWriter.h"
+#include "UringFile.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <stdexcept>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+// Alignment O_DIRECT needs of buffers, lengths and offsets.
+static const size_t BLOCK_SIZE = 4096;
+
+static uint64_t monotonicNanos() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return 1000000000 * (uint64_t) ts.tv_sec + ts.tv_nsec;
+}
+
+static size_t roundUp(size_t n, size_t multiple) {
+  return (n + multiple - 1) / multiple * multiple;
+}
+
+// Writes len bytes at offset, retrying on EINTR and short writes.
+static void writeFully(int fd, const char* buf, size_t len, uint64_t offset) {
+  size_t written = 0;
+  while(written < len) {
+    ssize_t n = pwrite(fd, buf + written, len - written, offset + written);
+    if(n == -1) {
+      if(errno == EINTR) {
+        continue;
+      }
+      throw std::runtime_error(std::string("Output write failed: ") + strerror(errno));
+    }
+    written += n;
+  }
+}
+
+OutputWriter::OutputWriter(const std::string &filename, const FlushPolicy &flushPolicy) {
+  policy = flushPolicy;
+  if(policy.maxBytes == 0) {
+    throw std::invalid_argument("Output buffer size must be positive.");
+  }
+
+  bool async = policy.asyncBuffers > 0;
+  direct = async && policy.directIO;
+  int flags = O_WRONLY | O_CREAT | O_TRUNC;
+  fd = open(filename.c_str(), flags | (direct ? O_DIRECT : 0), 0644);
+  if(fd == -1 && direct && errno == EINVAL) {
+    // Filesystems like tmpfs don't do O_DIRECT.
+    direct = false;
+    fd = open(filename.c_str(), flags, 0644);
+  }
+  if(fd == -1) {
+    throw std::runtime_error("Couldn't open " + filename + ": " + strerror(errno));
+  }
+
+  // Always room to reserve the longest record.
+  capacity = std::max(policy.maxBytes, MAX_RECORD_SIZE);
+  if(async) {
+    // Room to carry a partial block over when writing O_DIRECT.
+    capacity = std::max(roundUp(capacity, BLOCK_SIZE), 2 * BLOCK_SIZE);
+    std::vector<struct iovec> iovecs;
+    for(size_t i = 0; i < policy.asyncBuffers; i++) {
+      void* aligned = aligned_alloc(BLOCK_SIZE, capacity);
+      if(aligned == nullptr) {
+        // The destructor won't run, so undo what's set up so far.
+        for(char* b : buffers) {
+          free(b);
+        }
+        close(fd);
+        throw std::bad_alloc();
+      }
+      buffers.push_back(static_cast<char*>(aligned));
+      iovecs.push_back({aligned, capacity});
+    }
+    try {
+      ring.reset(new UringFile(fd, iovecs));
+    } catch(const std::runtime_error&) {
+      // No io_uring; write synchronously from the first buffer.
+      for(size_t i = 1; i < buffers.size(); i++) {
+        free(buffers[i]);
+      }
+      buffers.resize(1);
+      if(direct) {
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) & ~O_DIRECT);
+        direct = false;
+      }
+    }
+  } else {
+    char* b = static_cast<char*>(malloc(capacity));
+    if(b == nullptr) {
+      close(fd);
+      throw std::bad_alloc();
+    }
+    buffers.push_back(b);
+  }
+  writeOffsets.resize(buffers.size());
+  writeLengths.resize(buffers.size());
+
+  current = 0;
+  buffer = buffers[0];
+  used = 0;
+  messages = 0;
+  oldestNanos = 0;
+  fileOffset = 0;
+}
+
+OutputWriter::~OutputWriter() {
+  // Destructors must not throw; a failed final flush loses the tail.
+  try {
+    flush();
+  } catch(const std::runtime_error&) {
+  }
+  // In-flight writes read from the buffers, so they must be reaped first.
+  while(ring && ring->pending() > 0) {
+    size_t index;
+    ring->wait(&index);
+  }
+  ring.reset();
+  for(char* b : buffers) {
+    free(b);
+  }
+  close(fd);
+}
+
+void OutputWriter::write(const char* msg, size_t len) {
+  memcpy(reserve(len), msg, len);
+  commit(len);
+}
+
+char* OutputWriter::reserve(size_t len) {
+  if(used + len > capacity) {
+    submit();
+  }
+  return buffer + used;
+}
+
+void OutputWriter::commit(size_t len) {
+  if(used == 0 && policy.maxDelayNanos != 0) {
+    oldestNanos = monotonicNanos();
+  }
+  used += len;
+  messages++;
+
+  if(used >= policy.maxBytes || (policy.maxMessages != 0 && messages >= policy.maxMessages)) {
+    submit();
+  }
+}
+
+void OutputWriter::poll() {
+  if(used != 0 && policy.maxDelayNanos != 0 &&
+      monotonicNanos() - oldestNanos >= policy.maxDelayNanos) {
+    submit();
+  }
+}
+
+void OutputWriter::submit() {
+  if(!ring) {
+    flush();
+    return;
+  }
+  // O_DIRECT writes whole blocks; the partial one moves to the next buffer.
+  size_t len = direct ? used / BLOCK_SIZE * BLOCK_SIZE : used;
+  if(len == 0) {
+    return;
+  }
+  ring->write(current, buffer, len, fileOffset);
+  writeOffsets[current] = fileOffset;
+  writeLengths[current] = len;
+
+  size_t next = (current + 1) % buffers.size();
+  while(writeLengths[next] != 0) {
+    reap();
+  }
+  size_t tail = used - len;
+  memmove(buffers[next], buffer + len, tail);
+  fileOffset += len;
+  current = next;
+  buffer = buffers[next];
+  used = tail;
+  messages = 0;
+}
+
+void OutputWriter::reap() {
+  size_t index;
+  int res = ring->wait(&index);
+  size_t len = writeLengths[index];
+  writeLengths[index] = 0;
+  if(res < 0) {
+    throw std::runtime_error(std::string("Output write failed: ") + strerror(-res));
+  }
+  if((size_t) res < len) {
+    writeFully(fd, buffers[index] + res, len - res, writeOffsets[index] + res);
+  }
+}
+
+void OutputWriter::flush() {
+  if(ring) {
+    submit();
+    while(ring->pending() > 0) {
+      reap();
+    }
+    if(direct && used > 0) {
+      // Write the partial block padded out, then trim the file back. The
+      // tail stays buffered and is rewritten whole once the block fills.
+      ring->write(current, buffer, roundUp(used, BLOCK_SIZE), fileOffset);
+      writeOffsets[current] = fileOffset;
+      writeLengths[current] = roundUp(used, BLOCK_SIZE);
+      reap();
+      if(ftruncate(fd, fileOffset + used) == -1) {
+        throw std::runtime_error(std::string("Output truncate failed: ") + strerror(errno));
+      }
+    }
+    messages = 0;
+    return;
+  }
+
+  size_t written = 0;
+  while(written < used) {
+    ssize_t n = ::write(fd, buffer + written, used - written);
+    if(n == -1) {
+      if(errno == EINTR) {
+        continue;
+      }
+      // Keep what was not written so a later flush can retry it.
+      memmove(buffer, buffer + written, used - written);
+      used -= written;
+      throw std::runtime_error(std::string("Output write failed: ") + strerror(errno));
+    }
+    written += n;
+  }
+  used = 0;
+  messages = 0;
+}
@@ -0,0 +1,88 @@
+#pragma once
+
+#include "OutputSink.h"
+
+#include <cstdint>
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <vector>
+
+class UringFile;
+
+// When buffered output messages are written out to the file. Thresholds
+// are checked as messages are written; whichever is hit first flushes.
+struct FlushPolicy {
+  // Size of the user-space buffer. A full buffer is always flushed.
+  size_t maxBytes = 1 << 20;
+  // Flush after this many buffered messages. 0 disables the threshold.
+  size_t maxMessages = 0;
+  // Flush once the oldest buffered message is this old, checked once per
+  // packet. 0 disables the threshold.
+  uint64_t maxDelayNanos = 0;
+  // Write through io_uring from a ring of this many buffers, so messages
+  // are buffered into one while the kernel drains the others and a slow
+  // disk doesn't stall decoding. 0 writes synchronously, as does a
+  // kernel without io_uring.
+  size_t asyncBuffers = 0;
+  // With asyncBuffers, open the file O_DIRECT to bypass the page cache.
+  // Only whole 4KiB blocks are written until an explicit flush, which
+  // pads and then trims the file. Ignored where unsupported.
+  bool directIO = false;
+};
+
+// Long-lived, buffered sink for the output file. Output messages are
+// copied into one large buffer, and written with a single syscall per
+// flush rather than per message or packet.
+//
+// In async mode a threshold being hit only submits the buffer and moves
+// on to the next in the ring; #flush still waits for everything to land.
+class OutputWriter : public OutputSink {
+  int fd;
+  FlushPolicy policy;
+
+  // A single buffer when writing synchronously.
+  std::vector<char*> buffers;
+  size_t capacity;
+  // The buffer being filled, buffers[current].
+  char* buffer;
+  size_t current;
+  size_t used;
+  size_t messages;
+  // Monotonic time the first message after the last flush was buffered.
+  uint64_t oldestNanos;
+
+  // Async mode only.
+  std::unique_ptr<UringFile> ring;
+  // File offset of the current buffer's first byte.
+  uint64_t fileOffset;
+  // Per buffer, the write in flight, if any.
+  std::vector<uint64_t> writeOffsets;
+  std::vector<size_t> writeLengths;
+  bool direct;
+
+  // Writes out the current buffer, without waiting in async mode.
+  void submit();
+  // Reaps one async write, finishing it if it came up short.
+  void reap();
+
+  public:
+    // Truncates or creates the file.
+    OutputWriter(const std::string &filename, const FlushPolicy &policy);
+    // Flushes whatever is still buffered.
+    ~OutputWriter();
+
+    OutputWriter(const OutputWriter&) = delete;
+    OutputWriter& operator=(const OutputWriter&) = delete;
+
+    // Buffers a serialized output message.
+    void write(const char* msg, size_t len);
+    // Space in the buffer for a message, to be written in place.
+    char* reserve(size_t len) override;
+    void commit(size_t len) override;
+    // Applies the time based flush threshold.
+    void poll() override;
+    // Writes all buffered messages to the file, waiting for any async
+    // writes to complete.
+    void flush() override;
+};
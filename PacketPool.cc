@@ -0,0 +1,40 @@
+#include "PacketPool.h"
+
+#include <stdexcept>
+
+PacketPool::PacketPool(size_t slotSize, size_t slotsPerSlab)
+    : slotSize(slotSize), slotsPerSlab(slotsPerSlab) {
+  if(slotSize == 0 || slotsPerSlab == 0) {
+    throw std::invalid_argument("Packet pool slots and slabs must be non-empty.");
+  }
+}
+
+PacketPool::~PacketPool() {
+  for(char* slab : slabs) {
+    delete[] slab;
+  }
+}
+
+char* PacketPool::acquire(size_t len) {
+  if(len > slotSize) {
+    return new char[len];
+  }
+  if(freeSlots.empty()) {
+    char* slab = new char[slotSize * slotsPerSlab];
+    slabs.push_back(slab);
+    for(size_t i = slotsPerSlab; i > 0; i--) {
+      freeSlots.push_back(slab + (i - 1) * slotSize);
+    }
+  }
+  char* slot = freeSlots.back();
+  freeSlots.pop_back();
+  return slot;
+}
+
+void PacketPool::release(char* buf, size_t len) {
+  if(len > slotSize) {
+    delete[] buf;
+    return;
+  }
+  freeSlots.push_back(buf);
+}
@@ -0,0 +1,32 @@
+#pragma once
+
+#include <cstddef>
+#include <vector>
+
+// Recycles fixed-size buffers for packets that must outlive the call that
+// delivered them, i.e. those that arrived out of order. Slots are carved
+// out of slabs allocated on demand and handed back on release, so once the
+// pool has grown to the deepest reordering seen, stashing a packet no
+// longer allocates.
+//
+// Packets larger than a slot fall back to a heap allocation of their own.
+class PacketPool {
+  size_t slotSize;
+  size_t slotsPerSlab;
+
+  std::vector<char*> slabs;
+  // Slots ready for reuse.
+  std::vector<char*> freeSlots;
+
+  public:
+    PacketPool(size_t slotSize, size_t slotsPerSlab);
+    ~PacketPool();
+
+    PacketPool(const PacketPool&) = delete;
+    PacketPool& operator=(const PacketPool&) = delete;
+
+    // Returns a buffer of at least len bytes.
+    char* acquire(size_t len);
+    // Returns a buffer from #acquire, with the same len, to the pool.
+    void release(char* buf, size_t len);
+};
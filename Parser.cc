@@ -1,89 +1,47 @@
 #include "Parser.h"
+#include "MessageLayout.h"
 
-#include <fstream>
 #include <iostream>
 #include <cstring>
-#include <assert.h>     /* assert */
-
-struct OutputAddOrder { 
-  msgtype_t msgType;
-  uint16_t msgSize;
-  ticker_t ticker;
-  uint64_t timestamp;
-  uint64_t orderRef;
-  side_t side;
-  padding_t padding;
-  uint32_t size;
-  double price;
-}; 
-
-struct OutputOrderExecuted { 
-  msgtype_t msgType;
-  uint16_t msgSize;
-  ticker_t ticker;
-  uint64_t timestamp;
-  uint64_t orderRef;
-  uint32_t size;
-  double price;
-}; 
-
-struct OutputOrderReduced {
-  msgtype_t msgType;
-  uint16_t msgSize;
-  ticker_t ticker;
-  uint64_t timestamp;
-  uint64_t orderRef;
-  uint32_t sizeRemaining;
-};
-
-struct OutputOrderReplaced {
-  msgtype_t msgType;
-  uint16_t msgSize;
-  ticker_t ticker;
-  uint64_t timestamp;
-  uint64_t oldOrderRef;
-  uint64_t newOrderRef;
-  uint32_t newSize;
-  double newPrice;
-};
-
-const char SPACE_CHAR = ' ';
-const char NUL_CHAR = '\0';
-
-const padding_t PADDING = {0x00,0x00,0x00};
+#include <algorithm>
+#include <exception>
+#include <time.h>
+
 const msgsymbol_t MSG_TYPE_ADD = 'A';
 const msgsymbol_t MSG_TYPE_EXECUTE = 'E';
 const msgsymbol_t MSG_TYPE_CANCEL = 'X';
 const msgsymbol_t MSG_TYPE_REPLACE = 'R';
-const msgtype_t MSG_TYPE_1 = { 0x00, 0x01 };
-const msgtype_t MSG_TYPE_2[] = { 0x00, 0x02 };
-const msgtype_t MSG_TYPE_3[] = { 0x00, 0x03 };
-const msgtype_t MSG_TYPE_4[] = { 0x00, 0x04 };
 
-const char INPUT_ADD_PAYLOAD_SIZE = 34;
-const char INPUT_EXECUTE_PAYLOAD_SIZE = 21;
-const char INPUT_CANCEL_PAYLOAD_SIZE = 21; 
-const char INPUT_REPLACE_PAYLOAD_SIZE = 33; 
+const char INPUT_ADD_PAYLOAD_SIZE = InputAddLayout::SIZE;
+const char INPUT_EXECUTE_PAYLOAD_SIZE = InputExecutedLayout::SIZE;
+const char INPUT_CANCEL_PAYLOAD_SIZE = InputCanceledLayout::SIZE;
+const char INPUT_REPLACE_PAYLOAD_SIZE = InputReplacedLayout::SIZE;
 
-const char OUTPUT_ADD_PAYLOAD_SIZE = 44;
-const char OUTPUT_EXECUTE_PAYLOAD_SIZE = 40;
-const char OUTPUT_CANCEL_PAYLOAD_SIZE = 32;
-const char OUTPUT_REPLACE_PAYLOAD_SIZE = 48;
+const char OUTPUT_ADD_PAYLOAD_SIZE = OutputAddLayout::SIZE;
+const char OUTPUT_EXECUTE_PAYLOAD_SIZE = OutputExecutedLayout::SIZE;
+const char OUTPUT_CANCEL_PAYLOAD_SIZE = OutputReducedLayout::SIZE;
+const char OUTPUT_REPLACE_PAYLOAD_SIZE = OutputReplacedLayout::SIZE;
+const char OUTPUT_BBO_PAYLOAD_SIZE = OutputBboLayout::SIZE;
 
-const char MAX_INPUT_PAYLOAD_SIZE = 34;
-const char MIN_INPUT_PAYLOAD_SIZE = 21;
+const char MAX_INPUT_PAYLOAD_SIZE = std::max({INPUT_ADD_PAYLOAD_SIZE,
+    INPUT_EXECUTE_PAYLOAD_SIZE, INPUT_CANCEL_PAYLOAD_SIZE, INPUT_REPLACE_PAYLOAD_SIZE});
+const char MIN_INPUT_PAYLOAD_SIZE = std::min({INPUT_ADD_PAYLOAD_SIZE,
+    INPUT_EXECUTE_PAYLOAD_SIZE, INPUT_CANCEL_PAYLOAD_SIZE, INPUT_REPLACE_PAYLOAD_SIZE});
 
-const char MAX_OUTPUT_PAYLOAD_SIZE = 48;
+const char MAX_OUTPUT_PAYLOAD_SIZE = std::max({OUTPUT_ADD_PAYLOAD_SIZE,
+    OUTPUT_EXECUTE_PAYLOAD_SIZE, OUTPUT_CANCEL_PAYLOAD_SIZE, OUTPUT_REPLACE_PAYLOAD_SIZE});
+static_assert(MAX_OUTPUT_PAYLOAD_SIZE <= OutputSink::MAX_RECORD_SIZE,
+    "Output messages must fit a sink record.");
+static_assert(OUTPUT_BBO_PAYLOAD_SIZE <= OutputSink::MAX_RECORD_SIZE,
+    "BBO messages must fit a sink record.");
 
-const char MIN_PACKET_SIZE = 6;
+const char MIN_PACKET_SIZE = PacketHeaderLayout::SIZE;
 
-Parser::Parser(int date, const std::string &outputFilename) {
-  filename = outputFilename;
-  
-  // "The first packet processed by your parser should be
-  // the packet with sequence number 1."
-  sequencePosition = 1;
+// Complete messages indexed from one payload before any is decoded.
+const size_t MESSAGE_BATCH_SIZE = 64;
 
+// Nanoseconds from the epoch to local midnight of date, given as yyyymmdd.
+static uint64_t midnightNanos(int date) {
   int year = date / 10000;
   if(year < 1970) {
     throw std::invalid_argument("YYYY must be between 1970 and 2105.");
@@ -97,8 +55,10 @@ Parser::Parser(int date, const std::string &outputFilename) {
     throw std::invalid_argument("DD must be between 1 and 31 inclusive.");
   }
   // Copied from http://www.cplusplus.com/reference/ctime/mktime/.
-  time_t rawtime;
-  struct tm * timeinfo = localtime ( &rawtime );
+  // Start from a blank time, and let mktime work out daylight saving.
+  struct tm blank = {};
+  blank.tm_isdst = -1;
+  struct tm * timeinfo = &blank;
   timeinfo->tm_year = ( date / 1E4) - 1900; // Years since 1900.
   timeinfo->tm_mon = month - 1; // Months are 0-indexed.
   timeinfo->tm_mday = day;
@@ -106,90 +66,362 @@ Parser::Parser(int date, const std::string &outputFilename) {
   timeinfo->tm_min = 0;
   timeinfo->tm_sec = 0;
   uint32_t epochToMidnightLocalSeconds = mktime (timeinfo);
-  epochToMidnightLocalNanos = 1000000000 * (uint64_t) epochToMidnightLocalSeconds;
-  // Empty the file.
-  std::ofstream outfile;
-  outfile.open(outputFilename);
-  outfile.close();
-}
-
-void Parser::catchupSequencePayloads() {
-  // Lookup if there is a packet succeeding the sequence that
-  // arrived early.
-  auto entry = earlyPackets.find(sequencePosition);
-  while(entry != earlyPackets.end()) {
-    const char* bytes = entry->second;
+  return 1000000000 * (uint64_t) epochToMidnightLocalSeconds;
+}
+
+static uint64_t monotonicNanos() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return 1000000000 * (uint64_t) ts.tv_sec + ts.tv_nsec;
+}
+
+Parser::Parser(int date, const std::string &outputFilename, const ParserConfig &config)
+    : Parser(date, config) {
+  filename = outputFilename;
+  // Empty the file, and keep it open for writing.
+  ownedOutput.reset(new OutputWriter(outputFilename, config.flush));
+  output = ownedOutput.get();
+}
+
+Parser::Parser(int date, OutputSink &sink, const ParserConfig &config)
+    : Parser(date, config) {
+  output = &sink;
+}
+
+Parser::Parser(int date, const ParserConfig &config)
+    : output(nullptr),
+      epochToMidnightLocalNanos(midnightNanos(date)),
+      earlyPackets(config.reorderWindowSize),
+      packetPool(config.packetSlotSize, config.packetSlotsPerSlab),
+      state(config, epochToMidnightLocalNanos) {
+  reorderOverflowPolicy = config.reorderOverflowPolicy;
+  maxReorderWindow = config.maxReorderWindow;
+  maxReorderWindowPolicy = config.maxReorderWindowPolicy;
+  if(reorderOverflowPolicy == REORDER_GROW) {
+    if(maxReorderWindow < config.reorderWindowSize ||
+        (maxReorderWindow & (maxReorderWindow - 1)) != 0) {
+      throw std::invalid_argument("Max reorder window must be a power of two, "
+          "at least the reorder window size.");
+    }
+    if(maxReorderWindowPolicy == REORDER_GROW) {
+      throw std::invalid_argument("Packets beyond the max reorder window must be dropped or thrown.");
+    }
+  }
+  droppedPackets = 0;
+  onGap = config.onGap;
+  gapTimeoutNanos = config.gapTimeoutNanos;
+  maxPendingPackets = config.maxPendingPackets;
+  highestSequence = 0;
+  gapOpenedNanos = 0;
+  skippedPackets = 0;
+  lastTimestamp = 0;
+  resync = false;
+  decoders = config.simdDecode ? &bestDecoders() : &scalarDecoders();
+  bboOutput = config.bboOutput;
+  orderOutput = config.orderOutput;
+  for(MessageType &type : messageTypes) {
+    type = {0, KIND_UNKNOWN};
+  }
+  messageTypes[static_cast<uint8_t>(MSG_TYPE_ADD)] = {INPUT_ADD_PAYLOAD_SIZE, KIND_ADD};
+  messageTypes[static_cast<uint8_t>(MSG_TYPE_EXECUTE)] = {INPUT_EXECUTE_PAYLOAD_SIZE, KIND_EXECUTE};
+  messageTypes[static_cast<uint8_t>(MSG_TYPE_CANCEL)] = {INPUT_CANCEL_PAYLOAD_SIZE, KIND_CANCEL};
+  messageTypes[static_cast<uint8_t>(MSG_TYPE_REPLACE)] = {INPUT_REPLACE_PAYLOAD_SIZE, KIND_REPLACE};
+  handlers.resize(256);
+  // "The first packet processed by your parser should be
+  // the packet with sequence number 1."
+  sequencePosition = 1;
+  straddleLen = 0;
+}
+
+Parser::~Parser() {
+  while(char* packet = earlyPackets.takeAny()) {
+    packetPool.release(packet, readBigEndianUint16(packet, 0));
+  }
+}
+
+void Parser::processPacket(const char* payload, size_t len, OutputSink &out,
+    std::exception_ptr &error) {
+  try {
+    processPayload(payload, len, out);
+  } catch(...) {
+    // The rest of the packet is lost, so the next one may start mid-message.
+    straddleLen = 0;
+    resync = true;
+    if(!error) {
+      error = std::current_exception();
+    }
+  }
+  sequencePosition++;
+  if(!state.getMovedSymbols().empty()) {
+    writeBbo(out);
+  }
+}
+
+void Parser::catchupSequencePayloads(OutputSink &out, std::exception_ptr &error) {
+  // Drain the run of packets succeeding the sequence that arrived early.
+  for(size_t n = earlyPackets.run(sequencePosition); n > 0; n--) {
+    char* bytes = earlyPackets.take(sequencePosition);
     uint16_t packetSize = readBigEndianUint16(bytes, 0);
-    // Enqueue the payload.
-    for( int i = MIN_PACKET_SIZE; i < packetSize; i++) {
-      q.push(bytes[i]);
+    processPacket(bytes + MIN_PACKET_SIZE, packetSize - MIN_PACKET_SIZE, out, error);
+    packetPool.release(bytes, packetSize);
+  }
+  // Whatever is still stashed waits on a new gap.
+  if(!earlyPackets.empty()) {
+    gapOpenedNanos = gapTimeoutNanos != 0 ? monotonicNanos() : 0;
+  }
+}
+
+void Parser::checkGap(std::exception_ptr &error) {
+  while(!earlyPackets.empty()) {
+    bool tooManyPending = maxPendingPackets != 0 && earlyPackets.size() >= maxPendingPackets;
+    bool timedOut = gapTimeoutNanos != 0 && monotonicNanos() - gapOpenedNanos >= gapTimeoutNanos;
+    if(!tooManyPending && !timedOut) {
+      return;
     }
 
-    sequencePosition++;
-    entry = earlyPackets.find(sequencePosition);
+    // Give up on the missing packets, and continue from the first stashed
+    // packet. Any message straddling into the gap is lost with it.
+    uint32_t next = earlyPackets.next(sequencePosition);
+    skippedPackets += next - sequencePosition;
+    sequencePosition = next;
+    straddleLen = 0;
+    resync = true;
+    catchupSequencePayloads(*output, error);
   }
 }
 
-void Parser::processQueue() {
-  std::ofstream outfile;
-  outfile.open(filename, std::ios_base::app); // append instead of overwrite
-  
-  // Reuse buffer to store current serialized input / output messages.
-  char* in = new char[MAX_INPUT_PAYLOAD_SIZE];
-  char* out = new char[MAX_OUTPUT_PAYLOAD_SIZE];
-
-  // There's atleast 1 complete message in the queue.
-  while((q.size() >= INPUT_ADD_PAYLOAD_SIZE && q.front() == MSG_TYPE_ADD) ||
-      (q.size() >= INPUT_REPLACE_PAYLOAD_SIZE && q.front() == MSG_TYPE_REPLACE) ||
-      (q.size() >= INPUT_EXECUTE_PAYLOAD_SIZE && q.front() == MSG_TYPE_CANCEL) ||
-      (q.size() >= INPUT_EXECUTE_PAYLOAD_SIZE && q.front() == MSG_TYPE_EXECUTE)) {
-    switch(q.front()) {
-      case MSG_TYPE_ADD:
-        popNBytes(INPUT_ADD_PAYLOAD_SIZE, &in);
-        InputAddOrder inputAddOrder;
-        deserializeAddOrder(in, &inputAddOrder);
-        serializeAddOrder(&out, inputAddOrder);
-        outfile.write(out, OUTPUT_ADD_PAYLOAD_SIZE);
+void Parser::registerMessageType(msgsymbol_t type, size_t length,
+    const MessageHandler &handler) {
+  MessageType &entry = messageTypes[static_cast<uint8_t>(type)];
+  if(entry.kind != KIND_UNKNOWN && entry.kind != KIND_HANDLED && entry.kind != KIND_SKIPPED) {
+    throw std::invalid_argument(std::string("Message type ") + type + " is built in.");
+  }
+  if(length == 0 || length > 255) {
+    throw std::invalid_argument("Message length must be between 1 and 255.");
+  }
+  static_assert(STRADDLE_CAPACITY >= 255, "Registered messages must fit in the stitching area.");
+  entry.length = length;
+  entry.kind = handler ? KIND_HANDLED : KIND_SKIPPED;
+  handlers[static_cast<uint8_t>(type)] = handler;
+}
+
+void Parser::routeMessages(const MessageRouter &router) {
+  this->router = router;
+}
+
+size_t Parser::findMessageBoundary(const char* payload, size_t len) {
+  for(size_t offset = 0; offset < len; offset++) {
+    // Accept the first offset from which every message type byte is known,
+    // through to the end of the payload.
+    size_t position = offset;
+    while(position < len) {
+      size_t size = messageSize(payload[position]);
+      if(size == 0) {
+        break;
+      }
+      position += size;
+    }
+    if(position >= len) {
+      return offset;
+    }
+  }
+  return len;
+}
+
+void Parser::processPayload(const char* payload, size_t len, OutputSink &out) {
+  const char* end = payload + len;
+
+  // After skipping a gap, the payload may begin mid-message.
+  if(resync) {
+    size_t offset = findMessageBoundary(payload, len);
+    if(offset == len) {
+      return;
+    }
+    payload += offset;
+    resync = false;
+  }
+
+  // Finish stitching a message that straddled from the previous packet.
+  if(straddleLen > 0) {
+    size_t missing = messageSize(straddle[0]) - straddleLen;
+    size_t n = std::min(missing, len);
+    memcpy(straddle + straddleLen, payload, n);
+    straddleLen += n;
+    payload += n;
+    if(n < missing) {
+      return;
+    }
+    const char* stitched = straddle;
+    processMessages(&stitched, 1, out);
+    straddleLen = 0;
+  }
+
+  // Decode complete messages straight out of the payload, indexing a
+  // batch of them before decoding any.
+  const char* batch[MESSAGE_BATCH_SIZE];
+  while(payload < end) {
+    size_t count = 0;
+    bool straddled = false;
+    while(count < MESSAGE_BATCH_SIZE && payload < end) {
+      const MessageType &type = messageTypes[static_cast<uint8_t>(*payload)];
+      size_t size = type.length;
+      if(size == 0) {
+        // Messages before it are still good.
+        processMessages(batch, count, out);
+        throw std::runtime_error("Unexpected message type");
+      }
+      if(size > static_cast<size_t>(end - payload)) {
+        straddled = true;
+        break;
+      }
+      // Skipped types are stepped over without a branch of their own.
+      batch[count] = payload;
+      count += type.kind != KIND_SKIPPED;
+      payload += size;
+    }
+    processMessages(batch, count, out);
+    if(straddled) {
+      break;
+    }
+  }
+
+  // Stash the head of a message continued in the next packet.
+  straddleLen = end - payload;
+  memcpy(straddle, payload, straddleLen);
+}
+
+void Parser::processMessages(const char* const* messages, size_t count, OutputSink &out) {
+  size_t i = 0;
+  while(i < count) {
+    msgsymbol_t type = *messages[i];
+    size_t run = 1;
+    while(i + run < count && *messages[i + run] == type) {
+      run++;
+    }
+    MessageKind kind = messageTypes[static_cast<uint8_t>(type)].kind;
+    if(router && kind >= KIND_ADD && kind <= KIND_REPLACE) {
+      router(messages + i, run);
+      i += run;
+      continue;
+    }
+    switch(kind) {
+      case KIND_ADD:
+        if(state.filtering()) {
+          const char* kept[MESSAGE_BATCH_SIZE];
+          processRun(kept, filterAdds(messages + i, run, kept), decoders->addOrder,
+              &OrderState::addOrder, out);
+          // Skipped Adds still move the clock.
+          lastTimestamp = readField<InputAddLayout::timestamp>(messages[i + run - 1]);
+          break;
+        }
+        processRun(messages + i, run, decoders->addOrder,
+            &OrderState::addOrder, out);
+        break;
+      case KIND_EXECUTE:
+        processRun(messages + i, run, decoders->orderExecuted,
+            &OrderState::orderExecuted, out);
         break;
-      case MSG_TYPE_EXECUTE:
-        popNBytes(INPUT_EXECUTE_PAYLOAD_SIZE, &in);
-        InputOrderExecuted inputOrderExecuted;
-        deserializeOrderExecuted(in, &inputOrderExecuted);
-        serializeOrderExecuted(&out, inputOrderExecuted);
-        outfile.write(out, OUTPUT_EXECUTE_PAYLOAD_SIZE);
+      case KIND_CANCEL:
+        processRun(messages + i, run, decoders->orderCanceled,
+            &OrderState::orderReduced, out);
         break;
-      case MSG_TYPE_CANCEL:
-        popNBytes(INPUT_CANCEL_PAYLOAD_SIZE, &in);
-        InputOrderCanceled inputOrderCanceled;
-        deserializeOrderCanceled(in, &inputOrderCanceled);
-        serializeOrderReduced(&out, inputOrderCanceled);
-        outfile.write(out, OUTPUT_CANCEL_PAYLOAD_SIZE);
+      case KIND_REPLACE:
+        processRun(messages + i, run, decoders->orderReplaced,
+            &OrderState::orderReplaced, out);
         break;
-      case MSG_TYPE_REPLACE:
-        popNBytes(INPUT_REPLACE_PAYLOAD_SIZE, &in);
-        InputOrderReplaced inputOrderReplaced;
-        deserializeOrderReplaced(in, &inputOrderReplaced);
-        serializeOrderReplaced(&out, inputOrderReplaced);
-        outfile.write(out, OUTPUT_REPLACE_PAYLOAD_SIZE);
+      case KIND_HANDLED: {
+        const MessageHandler &handler = handlers[static_cast<uint8_t>(type)];
+        size_t length = messageSize(type);
+        for(size_t j = i; j < i + run; j++) {
+          handler(messages[j], length);
+        }
+        break;
+      }
+      case KIND_SKIPPED:
+        // Only reaches here stitched from a straddle.
         break;
       default:
         throw std::runtime_error("Unexpected message type");
     }
+    i += run;
+  }
+}
+
+size_t Parser::filterAdds(const char* const* messages, size_t count, const char** kept) {
+  size_t n = 0;
+  for(size_t i = 0; i < count; i++) {
+    if(state.subscribed(messages[i])) {
+      kept[n++] = messages[i];
+    }
   }
+  return n;
+}
 
-  delete[] in, delete[] out, outfile.close();
+// The order a message looks up or adds, whose slot is worth prefetching.
+static uint64_t prefetchRef(const InputAddOrder &msg) { return msg.orderRef; }
+static uint64_t prefetchRef(const InputOrderExecuted &msg) { return msg.orderRef; }
+static uint64_t prefetchRef(const InputOrderCanceled &msg) { return msg.orderRef; }
+static uint64_t prefetchRef(const InputOrderReplaced &msg) { return msg.originalOrderRef; }
+
+template <typename Msg>
+void Parser::processRun(const char* const* messages, size_t count,
+    void (*decode)(const char*, Msg*), size_t (OrderState::*apply)(char*, const Msg&),
+    OutputSink &out) {
+  // Decode the whole run first, so the order lookups below find their
+  // slots already on the way into cache.
+  Msg decoded[MESSAGE_BATCH_SIZE];
+  for(size_t i = 0; i < count; i++) {
+    decode(messages[i], &decoded[i]);
+    state.prefetch(prefetchRef(decoded[i]));
+  }
+  for(size_t i = 0; i < count; i++) {
+    lastTimestamp = decoded[i].timestamp;
+    // Serialize straight into the sink.
+    size_t len = (state.*apply)(out.reserve(MAX_OUTPUT_PAYLOAD_SIZE), decoded[i]);
+    if(len > 0 && orderOutput) {
+      out.commit(len);
+    }
+  }
 }
 
 void Parser::onUDPPacket(const char *buffer, size_t len) {
-  printf("Received packet of size %zu\n", len);
-  if(static_cast<int>(len) < MIN_PACKET_SIZE) {
-      throw std::invalid_argument("Packet size must be atleast " + std::to_string(MIN_PACKET_SIZE));
+  acceptPacket(buffer, len);
+  output->poll();
+}
+
+void Parser::onUDPPackets(const UDPPacket *packets, size_t count) {
+  // Sort the batch by sequence number. Packets too short for one go
+  // first, to throw.
+  batchOrder.clear();
+  for(size_t i = 0; i < count; i++) {
+    uint32_t sequenceNumber = static_cast<int>(packets[i].len) < MIN_PACKET_SIZE ?
+        0 : readBigEndianUint32(packets[i].buf, 2);
+    batchOrder.push_back({sequenceNumber, i});
+  }
+  if(!std::is_sorted(batchOrder.begin(), batchOrder.end())) {
+    std::sort(batchOrder.begin(), batchOrder.end());
   }
 
-  // Copy the buffer since may be mutated.
-  char *buf = new char[len];
-  for(int i = 0; i < static_cast<int>(len); i++) {
-    buf[i] = buffer[i];
+  std::exception_ptr error;
+  for(const std::pair<uint32_t, size_t> &entry : batchOrder) {
+    const UDPPacket &packet = packets[entry.second];
+    try {
+      acceptPacket(packet.buf, packet.len);
+    } catch(...) {
+      if(!error) {
+        error = std::current_exception();
+      }
+    }
+  }
+  output->poll();
+  if(error) {
+    std::rethrow_exception(error);
+  }
+}
+
+void Parser::acceptPacket(const char *buf, size_t len) {
+  if(static_cast<int>(len) < MIN_PACKET_SIZE) {
+      throw std::invalid_argument("Packet size must be atleast " + std::to_string(MIN_PACKET_SIZE));
   }
 
   uint16_t packetSize = readBigEndianUint16(buf, 0);
@@ -199,252 +431,145 @@ void Parser::onUDPPacket(const char *buffer, size_t len) {
   
   uint32_t sequenceNumber = readBigEndianUint32(buf, 2);
 
-  // Packet arrived "early", stash for later.
+  // Packet arrived "early", stash a copy for later since the caller's
+  // buffer may be reused.
   if (sequenceNumber > sequencePosition) {
-    earlyPackets[sequenceNumber] = buf; 
+    if (!earlyPackets.fits(sequencePosition, sequenceNumber)) {
+      ReorderOverflowPolicy policy = reorderOverflowPolicy;
+      if(policy == REORDER_GROW && sequenceNumber - sequencePosition >= maxReorderWindow) {
+        policy = maxReorderWindowPolicy;
+      }
+      switch(policy) {
+        case REORDER_DROP:
+          droppedPackets++;
+          return;
+        case REORDER_GROW:
+          earlyPackets.grow(sequencePosition, sequenceNumber);
+          break;
+        case REORDER_THROW:
+          throw std::runtime_error("Packet " + std::to_string(sequenceNumber) +
+              " is beyond the reorder window.");
+      }
+    }
+    if (!earlyPackets.contains(sequenceNumber)) {
+      if (earlyPackets.empty() && gapTimeoutNanos != 0) {
+        gapOpenedNanos = monotonicNanos();
+      }
+      char *copy = packetPool.acquire(len);
+      memcpy(copy, buf, len);
+      earlyPackets.put(sequenceNumber, copy);
+    }
+    // Report sequence numbers newly found missing.
+    if (sequenceNumber > highestSequence) {
+      uint32_t firstMissing = std::max(highestSequence + 1, sequencePosition);
+      if (sequenceNumber > firstMissing && onGap) {
+        onGap(firstMissing, sequenceNumber - 1);
+      }
+      highestSequence = sequenceNumber;
+    }
+    std::exception_ptr error;
+    checkGap(error);
+    if(error) {
+      std::rethrow_exception(error);
+    }
     return;
   } else if (sequenceNumber < sequencePosition) {
     // Packet already arrived and processed.
     return;
   }
 
-  // Enqueue payload of current packet.
-  for( int i = MIN_PACKET_SIZE; i < static_cast<int>(len); i++) {
-    q.push(buf[i]);
-  }
-  sequencePosition++;
+  // Map messages of current packet, straight from the caller's buffer.
+  std::exception_ptr error;
+  processPacket(buf + MIN_PACKET_SIZE, len - MIN_PACKET_SIZE, *output, error);
+  highestSequence = std::max(highestSequence, sequenceNumber);
 
   // Catchup with packets continue sequence, but arrived early.
-  catchupSequencePayloads();
-
-  // Map bytes / messages that are queued.
-  processQueue();
+  if(!earlyPackets.empty()) {
+    catchupSequencePayloads(*output, error);
+  }
+  if(!earlyPackets.empty()) {
+    checkGap(error);
+  }
+  if(error) {
+    std::rethrow_exception(error);
+  }
 }
 
-uint64_t Parser::readBigEndianUint64(const char *in, int offset) {
- return (
-    ((uint64_t)(uint8_t)in[offset] << 54) +
-    ((uint64_t)(uint8_t)in[offset+1] << 48) +
-    ((uint64_t)(uint8_t)in[offset+2] << 40) +
-    ((uint64_t)(uint8_t)in[offset+3] << 32) + 
-    ((uint64_t)(uint8_t)in[offset+4] << 24) +
-    ((uint64_t)(uint8_t)in[offset+5] << 16) +
-    ((uint64_t)(uint8_t)in[offset+6] << 8) +
-    ((uint64_t)(uint8_t)in[offset+7]));
-}
-uint32_t Parser::readBigEndianUint32(const char *in, int offset) {
-  return (
-    (uint32_t)((uint8_t)in[offset]) << 24 |
-    (uint32_t)((uint8_t)in[offset+1]) << 16 |
-    (uint32_t)((uint8_t)in[offset+2]) << 8 |
-    (uint32_t)((uint8_t)in[offset+3]));
+uint64_t Parser::getDroppedPackets() const {
+  return droppedPackets;
 }
 
-uint16_t Parser::readBigEndianUint16(const char *buf, int offset) {
-  return (
-    (uint16_t)((uint8_t)buf[offset]) << 8 |
-    (uint16_t)((uint8_t)buf[offset+1]));
-}
-
-void Parser::deserializeAddOrder(char* in, InputAddOrder* msg) {
-  msg->msgType = MSG_TYPE_ADD;
-  msg->timestamp = readBigEndianUint64(in, 1);
-  msg->orderRef = readBigEndianUint64(in, 9);        
-  msg->side = in[17];
-  msg->size = readBigEndianUint32(in, 18);
-  memcpy(msg->ticker, &in[22], 8);
-  msg->price = readBigEndianUint32(in, 30);
-}
-
-void Parser::deserializeOrderExecuted(char* in, InputOrderExecuted* msg) {
-  msg->msgType = MSG_TYPE_EXECUTE; 
-  msg->timestamp = readBigEndianUint64(in, 1);
-  msg->orderRef = readBigEndianUint64(in, 9);
-  msg->size = readBigEndianUint32(in, 17);
-}
-void Parser::deserializeOrderCanceled(char* in, InputOrderCanceled* msg) {
-  msg->msgType = MSG_TYPE_CANCEL;
-  msg->timestamp = readBigEndianUint64(in, 1);
-  msg->orderRef = readBigEndianUint64(in, 9);
-  msg->size = readBigEndianUint32(in, 17);
-}
-void Parser::deserializeOrderReplaced(char* in, InputOrderReplaced* msg) {
-  msg->msgType = MSG_TYPE_REPLACE;
-  msg->timestamp = readBigEndianUint64(in, 1);
-  msg->originalOrderRef = readBigEndianUint64(in, 9);
-  msg->newOrderRef = readBigEndianUint64(in, 17);
-  msg->size = readBigEndianUint32(in, 25);
-  msg->price = readBigEndianUint32(in, 29);
-}
-
-void Parser::serializeAddOrder(char ** outPtr, InputAddOrder inputMsg) {
-  OutputAddOrder order;
-  char * out = *outPtr;
-
-  memcpy(order.msgType, MSG_TYPE_1, 2);
-
-  order.msgSize = OUTPUT_ADD_PAYLOAD_SIZE;
-
-  memcpy(order.ticker, inputMsg.ticker, sizeof(inputMsg.ticker));
-  // Replace space with null.
-  for(int i = 0 ; i < 8; i++) {
-    if(order.ticker[i] == SPACE_CHAR) {
-      order.ticker[i] = NUL_CHAR;
-    }
-  }
-
-  order.timestamp = epochToMidnightLocalNanos + inputMsg.timestamp;
-
-  order.orderRef = inputMsg.orderRef;
-
-  order.side = inputMsg.side;
-
-  memcpy(order.padding, PADDING, 3);
-
-  order.size = inputMsg.size;
-  order.price = double(inputMsg.price);
-
-  // Must individually copy fields since compiler may add
-  // padding between struct fields.
-  memcpy(out, order.msgType, sizeof(order.msgType));
-  memcpy(&out[2], &order.msgSize, sizeof(order.msgSize));
-  memcpy(&out[4], &order.ticker, sizeof(order.ticker));
-  memcpy(&out[12], &order.timestamp, sizeof(order.timestamp));
-  memcpy(&out[20], &order.orderRef, sizeof(order.orderRef));
-  memcpy(&out[28], &order.side, sizeof(order.side));
-  memcpy(&out[31], &order.padding, sizeof(order.padding));
-  memcpy(&out[32], &order.size, sizeof(order.size));
-  memcpy(&out[36], &order.price, sizeof(order.price));
-
-  char * ticker = new char[8];
-  memcpy(ticker, order.ticker, 8);
-  orders[order.orderRef] = {
-    ticker,
-    order.price, 
-    order.size
-  };
+uint64_t Parser::getSkippedPackets() const {
+  return skippedPackets;
 }
 
-void Parser::serializeOrderExecuted(char** outPtr, InputOrderExecuted inputMsg) {
-  OutputOrderExecuted order;
-  char* out = *outPtr;
-  
-  memcpy(order.msgType, MSG_TYPE_2, 2);
+uint64_t Parser::getFilteredMessages() const {
+  return state.getFilteredMessages();
+}
 
-  order.msgSize = OUTPUT_EXECUTE_PAYLOAD_SIZE;
+uint64_t Parser::getLastTimestamp() const {
+  return lastTimestamp;
+}
 
-  // Inherit ticker symbol from original order.  
-  PendingOrder_t* pendingOrder = lookupOrder(inputMsg.orderRef);
-  memcpy(order.ticker, pendingOrder->ticker, 8);
+uint64_t Parser::getMidnightNanos() const {
+  return epochToMidnightLocalNanos;
+}
 
-  order.orderRef = inputMsg.orderRef;
+const OrderBook* Parser::getBook() const {
+  return state.getBook();
+}
 
-  order.timestamp = epochToMidnightLocalNanos + inputMsg.timestamp;
+int Parser::getSymbol(const std::string &ticker) const {
+  return state.getSymbol(ticker);
+}
 
-  uint32_t executionSize = inputMsg.size;
-  // Can execute at most the remaining size.
-  if(executionSize > pendingOrder->sizeRemaining) {
-    executionSize = pendingOrder->sizeRemaining;
+void Parser::poll() {
+  std::exception_ptr error;
+  if(!earlyPackets.empty()) {
+    checkGap(error);
+  }
+  output->poll();
+  if(error) {
+    std::rethrow_exception(error);
   }
-  pendingOrder->sizeRemaining -= executionSize;
-  order.size = executionSize;
-
-  order.price = pendingOrder->price;
-
-  memcpy(out, order.msgType, sizeof(order.msgType));
-  memcpy(&out[2], &order.msgSize, sizeof(order.msgSize));
-  memcpy(&out[4], &order.ticker, sizeof(order.ticker));
-  memcpy(&out[12], &order.timestamp, sizeof(order.timestamp));
-  memcpy(&out[20], &order.orderRef, sizeof(order.orderRef));
-  memcpy(&out[28], &order.size, sizeof(order.size));
-  memcpy(&out[32], &order.price, sizeof(order.price));
 }
 
-void Parser::serializeOrderReduced(char** outPtr, InputOrderCanceled inputMsg) {
-  OutputOrderReduced order;
-  char* out = *outPtr;
-
-  memcpy(order.msgType, MSG_TYPE_3, 2);
-
-  order.msgSize = OUTPUT_CANCEL_PAYLOAD_SIZE;
-
-  // Inherit ticker symbol from original order.
-  PendingOrder_t* pendingOrder = lookupOrder(inputMsg.orderRef);
-  memcpy(order.ticker, pendingOrder->ticker, sizeof(pendingOrder->ticker));
-
-  order.timestamp = epochToMidnightLocalNanos + inputMsg.timestamp;
-
-  order.orderRef = inputMsg.orderRef;
-
-  // Reduce remaining size by the cancel amount.
-  uint32_t sizeRemaining = (inputMsg.size > pendingOrder->sizeRemaining ? 
-      0 : pendingOrder->sizeRemaining - inputMsg.size);
-  pendingOrder->sizeRemaining = sizeRemaining;
-  order.sizeRemaining = sizeRemaining;
-
-  memcpy(out, order.msgType, sizeof(order.msgType));
-  memcpy(&out[2], &order.msgSize, sizeof(order.msgSize));
-  memcpy(&out[4], &order.ticker, sizeof(order.ticker));
-  memcpy(&out[12], &order.timestamp, sizeof(order.timestamp));
-  memcpy(&out[20], &order.orderRef, sizeof(order.orderRef));
-  memcpy(&out[28], &order.sizeRemaining, sizeof(order.sizeRemaining));
+void Parser::flush() {
+  output->flush();
 }
 
-void Parser::serializeOrderReplaced(char ** outPtr, InputOrderReplaced inputMsg) {
-  OutputOrderReplaced order;
-  char* out = *outPtr;
-
-  assert(sizeof(order.msgType) == sizeof(MSG_TYPE_4));
-  memcpy(order.msgType, MSG_TYPE_4, sizeof(MSG_TYPE_4));
-
-  order.msgSize = OUTPUT_REPLACE_PAYLOAD_SIZE;
-
-  // Inherit ticker symbol.
-  PendingOrder_t* pendingOrder = lookupOrder(inputMsg.originalOrderRef);
-  assert(sizeof(order.ticker) == sizeof(pendingOrder->ticker));
-  memcpy(order.ticker, pendingOrder->ticker, sizeof(order.ticker));
-
-  order.timestamp = epochToMidnightLocalNanos + inputMsg.timestamp;
-
-  order.oldOrderRef = inputMsg.originalOrderRef;
-  order.newOrderRef = inputMsg.newOrderRef;
-
-  double price = double(inputMsg.price);
-  order.newPrice = price;
-  order.newSize = inputMsg.size;
-
-  // Update old order.
-  pendingOrder->sizeRemaining = 0;
-
-  char * ticker = new char[sizeof(pendingOrder->ticker)];
-  memcpy(ticker, pendingOrder->ticker, 8);  
-  orders[order.newOrderRef] = {
-    ticker,
-    order.newPrice,
-    order.newSize
-  };
+uint64_t Parser::readBigEndianUint64(const char *in, int offset) {
+  uint64_t value;
+  memcpy(&value, in + offset, sizeof(value));
+  return byteSwap(value);
+}
 
-  memcpy(out, order.msgType, sizeof(order.msgType));
-  memcpy(&out[2], &order.msgSize, sizeof(order.msgSize));
-  memcpy(&out[4], &order.ticker, sizeof(order.ticker));
-  memcpy(&out[12], &order.timestamp, sizeof(order.timestamp));
-  memcpy(&out[20], &order.oldOrderRef, sizeof(order.oldOrderRef));
-  memcpy(&out[28], &order.newOrderRef, sizeof(order.newOrderRef));
-  memcpy(&out[36], &order.newSize, sizeof(order.newSize));
-  memcpy(&out[40], &order.newPrice, sizeof(order.newPrice));
+uint32_t Parser::readBigEndianUint32(const char *in, int offset) {
+  uint32_t value;
+  memcpy(&value, in + offset, sizeof(value));
+  return byteSwap(value);
 }
 
-PendingOrder_t* Parser::lookupOrder(uint64_t orderRef) {
-  auto order  = orders.find(orderRef);
-  if(order == orders.end()) {
-    throw std::runtime_error("Order ref was not found: " +  std::to_string(orderRef));
-  }
-  return &(order->second);
+uint16_t Parser::readBigEndianUint16(const char *buf, int offset) {
+  uint16_t value;
+  memcpy(&value, buf + offset, sizeof(value));
+  return byteSwap(value);
 }
 
-char* Parser::popNBytes(int n, char** buf) {
-  for(int i = 0 ; i < n; i++) {
-    (*buf)[i] = q.front();
-    q.pop();
+void Parser::writeBbo(OutputSink &out) {
+  const OrderBook &book = *state.getBook();
+  for(symbol_id_t symbol : state.getMovedSymbols()) {
+    if(symbol >= bboWritten.size()) {
+      bboWritten.resize(symbol + 1, TopOfBook());
+    }
+    TopOfBook top;
+    book.topOfBook(symbol, &top);
+    if(memcmp(&top, &bboWritten[symbol], sizeof(top)) == 0) {
+      continue;
+    }
+    bboWritten[symbol] = top;
+    out.commit(state.bbo(out.reserve(OUTPUT_BBO_PAYLOAD_SIZE), symbol, top,
+        state.getMovedAt(symbol)));
   }
-}
\ No newline at end of file
+  state.clearMoved();
+}
@@ -1,22 +1,23 @@
 #pragma once
 
+#include <exception>
 #include <string>
-#include <queue>          // std::queue
-#include <unordered_map>  // std::unordered_map
+#include <utility>
+#include <functional>
+#include <memory>
+#include <vector>
+
+#include "Decoders.h"
+#include "OrderState.h"
+#include "OutputWriter.h"
+#include "PacketPool.h"
+#include "ReorderWindow.h"
 
 typedef char msgsymbol_t;
 typedef char msgtype_t[2];
-typedef char ticker_t[8];
 typedef char side_t;
 typedef char padding_t[3];
 
-struct PendingOrder_t {
-  // Ticker characters, with spaces replaced by nul.
-  char * ticker;
-  double price;
-  uint32_t sizeRemaining;
-};
-
 struct InputAddOrder {
   msgsymbol_t msgType;
   uint64_t timestamp;
@@ -50,49 +51,235 @@ struct InputOrderReplaced {
   double price;
 };
 
+// What happens to a packet arriving so early that its sequence number is
+// beyond the reorder window.
+enum ReorderOverflowPolicy {
+  // Drop the packet, counting it in Parser::getDroppedPackets.
+  REORDER_DROP,
+  // Double the window until the packet fits, up to
+  // ParserConfig::maxReorderWindow.
+  REORDER_GROW,
+  // Throw std::runtime_error.
+  REORDER_THROW,
+};
+
+// Called with the range of sequence numbers, inclusive, found missing when
+// a packet arrives early. Each missing sequence number is reported once,
+// e.g. to request a retransmission.
+typedef std::function<void(uint32_t firstMissing, uint32_t lastMissing)> GapCallback;
+
+// Called with each message of a type registered through
+// Parser::registerMessageType, starting at its type byte.
+typedef std::function<void(const char* msg, size_t len)> MessageHandler;
+
+// Called with a run of Add, Executed, Canceled and Replaced messages, in
+// feed order and each starting at its type byte, set through
+// Parser::routeMessages. They are only valid for the duration of the call.
+typedef std::function<void(const char* const* messages, size_t count)> MessageRouter;
+
+// A single UDP packet handed to Parser::onUDPPackets.
+struct UDPPacket {
+  const char *buf;
+  size_t len;
+};
+
+// Tunables of a Parser. The defaults suit a full trading day.
+struct ParserConfig {
+  // Buffering of the output file.
+  FlushPolicy flush;
+  // Number of live orders to size the order table for upfront.
+  size_t expectedOrders = 0;
+  // Reclaiming orders with no size remaining.
+  RetirePolicy retirePolicy = RETIRE_NEVER;
+  size_t graveyardSize = 1 << 16;
+  UnknownRefPolicy unknownRefPolicy = UNKNOWN_REF_THROW;
+  // Buffers for out of order packets. Packets larger than a slot are
+  // still stashed, in an allocation of their own.
+  size_t packetSlotSize = 2048;
+  size_t packetSlotsPerSlab = 64;
+  // Number of sequence numbers, from the next expected one, that early
+  // packets can be stashed for. Must be a power of two.
+  size_t reorderWindowSize = 1024;
+  ReorderOverflowPolicy reorderOverflowPolicy = REORDER_GROW;
+  // Largest window REORDER_GROW grows to, a power of two, so a corrupt or
+  // far-future sequence number can't take memory with it. Packets still
+  // beyond it are handled per maxReorderWindowPolicy, REORDER_DROP or
+  // REORDER_THROW.
+  size_t maxReorderWindow = 1 << 16;
+  ReorderOverflowPolicy maxReorderWindowPolicy = REORDER_DROP;
+
+  // Gap recovery. By default the parser waits forever for a missing
+  // packet. Past either threshold it skips the gap instead, and resumes
+  // with the first stashed packet at its first message boundary. Orders
+  // added in skipped packets are unknown, so pair this with
+  // UNKNOWN_REF_DROP.
+  GapCallback onGap;
+  // Skip a gap once it is this old, checked on each packet and #poll.
+  // 0 disables the timeout.
+  uint64_t gapTimeoutNanos = 0;
+  // Skip a gap once this many packets are stashed behind it. 0 disables.
+  size_t maxPendingPackets = 0;
+  // Decode with the SIMD decoders where the CPU supports them. Off forces
+  // the portable ones.
+  bool simdDecode = true;
+  // Keep a price level book per ticker from the order events, readable
+  // through #getBook.
+  bool maintainBook = false;
+  // Also write a BBO message (type 5) for each ticker whose best bid or
+  // offer price or size changed, at most one per ticker per packet,
+  // after the packet's order messages. Keeps the book, as maintainBook.
+  bool bboOutput = false;
+  // Write the order messages (types 1 to 4). Off with bboOutput leaves a
+  // BBO only stream.
+  bool orderOutput = true;
+  // Tickers to parse, up to 8 characters each. Adds of any other ticker
+  // are skipped without being decoded or kept, and the Executed, Canceled
+  // and Replaced messages of their orders are dropped without output,
+  // whatever the unknownRefPolicy. The ref an ignored order is replaced
+  // away from is retired per retirePolicy. Empty parses every ticker.
+  std::vector<std::string> subscriptions;
+};
+
 class Parser {
   // Sequence number of the next Packet that is ready for processing.
   uint32_t sequencePosition;
-  // The file to write to.
+  // The file to write to, if writing to one.
   std::string filename;
+  // Buffered writer for filename, open for the lifetime of the Parser.
+  std::unique_ptr<OutputWriter> ownedOutput;
+  // Where output messages go: ownedOutput, or a sink the caller owns.
+  OutputSink* output;
   uint64_t epochToMidnightLocalNanos;
 
-  // Payload bytes that have arrived in order but not yet processed.
-  std::queue<char> q;
-
-  // Utility to grab a chunk of bytes off the queue and into buf.
-  char* popNBytes(int n, char** buf);
+  // Messages are decoded in place from each packet payload. Only a message
+  // straddling a packet boundary has its head stitched together here until
+  // the rest of it arrives.
+  static const size_t STRADDLE_CAPACITY = 256;
+  char straddle[STRADDLE_CAPACITY];
+  size_t straddleLen;
 
   // Stash packets that arrive "early" / out of sequence, keyed by seq number.
-  std::unordered_map<uint16_t, const char*> earlyPackets;
+  ReorderWindow earlyPackets;
+  ReorderOverflowPolicy reorderOverflowPolicy;
+  size_t maxReorderWindow;
+  ReorderOverflowPolicy maxReorderWindowPolicy;
+  // Packets dropped for arriving beyond the reorder window.
+  uint64_t droppedPackets;
+
+  // Gap tracking and recovery, see ParserConfig.
+  GapCallback onGap;
+  uint64_t gapTimeoutNanos;
+  size_t maxPendingPackets;
+  // Highest sequence number seen so far.
+  uint32_t highestSequence;
+  // Monotonic time the gap at sequencePosition opened, if timing out.
+  uint64_t gapOpenedNanos;
+  // Sequence numbers given up on.
+  uint64_t skippedPackets;
+  // Whether the next payload may begin mid-message, after a skipped gap
+  // or a packet that threw.
+  bool resync;
+  // Skips the gap at sequencePosition if it hit a recovery threshold.
+  // Errors of the packets caught up are kept in error, see #processPacket.
+  void checkGap(std::exception_ptr &error);
+  // Offset of the first message boundary in a payload starting at an
+  // unknown position, or len if there is none. A heuristic: the first
+  // offset from which all message type bytes through the end are valid.
+  size_t findMessageBoundary(const char* payload, size_t len);
+  // Buffers holding the early packets.
+  PacketPool packetPool;
 
-  // Track Add Orders and their remaining order size.
-  std::unordered_map<uint64_t, PendingOrder_t> orders;
-  // Utility to abstract away unordered_map boilerplate, lacking ::contains.
-  PendingOrder_t* lookupOrder(uint64_t orderRef);
+  // Orders, and the output messages of their events.
+  OrderState state;
+  // Copies the Adds of subscribed tickers to kept, returning how many,
+  // and marks the refs of the rest ignored.
+  size_t filterAdds(const char* const* messages, size_t count, const char** kept);
 
-  // Deserializes input buffer into the input message struct.
-  void deserializeAddOrder(char* in, InputAddOrder* msg);
-  void deserializeOrderExecuted(char* in, InputOrderExecuted* msg);
-  void deserializeOrderCanceled(char* in, InputOrderCanceled* msg);
-  void deserializeOrderReplaced(char* in, InputOrderReplaced* msg);
+  // BBO output, see ParserConfig::bboOutput.
+  bool bboOutput;
+  bool orderOutput;
+  // Last BBO message written per ticker, indexed by symbol id.
+  std::vector<TopOfBook> bboWritten;
+  // Writes a BBO message for each symbol moved in the packet whose top
+  // changed.
+  void writeBbo(OutputSink &out);
 
-  // Serializes input struct to buffer for output struct.
-  void serializeAddOrder(char** outPtr, InputAddOrder inputMsg);
-  void serializeOrderExecuted(char** outPtr, InputOrderExecuted inputMsg);
-  void serializeOrderReduced( char** outPtr, InputOrderCanceled inputMsg);
-  void serializeOrderReplaced(char** outPtr, InputOrderReplaced inputMsg);
+  // Deserializes input buffers into input message structs.
+  const MessageDecoders* decoders;
 
   // Utilities to interpret bytes starting at given offset in buffer.
   uint64_t readBigEndianUint64(const char *buf, int offset);
   uint32_t readBigEndianUint32(const char *buf, int offset);
   uint16_t readBigEndianUint16(const char *buf, int offset);
 
+  // How a message type is handled once its length is known.
+  enum MessageKind : uint8_t {
+    KIND_UNKNOWN,
+    KIND_ADD,
+    KIND_EXECUTE,
+    KIND_CANCEL,
+    KIND_REPLACE,
+    // Registered, and passed to its handler.
+    KIND_HANDLED,
+    // Registered without a handler; never indexed for decoding.
+    KIND_SKIPPED,
+  };
+  struct MessageType {
+    // Including the type byte; 0 if the type is unknown.
+    uint8_t length;
+    MessageKind kind;
+  };
+  // Indexed by type byte.
+  MessageType messageTypes[256];
+  std::vector<MessageHandler> handlers;
+  // Takes the built-in messages instead of them being decoded, if set.
+  MessageRouter router;
+
+  // Payload size of the given message type, or 0 if unknown.
+  size_t messageSize(msgsymbol_t msgType) const {
+    return messageTypes[static_cast<uint8_t>(msgType)].length;
+  }
+
+  // Timestamp of the latest decoded input message.
+  uint64_t lastTimestamp;
+
+  // Everything but the output, shared by the public constructors.
+  Parser(int date, const ParserConfig &config);
+
   // Sub-routines of #onUDPPacket.
-  // Enqueue packets that arrived early if sequence has since connected. 
-  void catchupSequencePayloads();
-  // Seeks fully received input messages and writes output messages to file. 
-  void processQueue();
+  // Sequences one packet and decodes whatever became contiguous.
+  void acceptPacket(const char *buf, size_t len);
+  // Sequence number and index of each packet of a batch, sorted.
+  std::vector<std::pair<uint32_t, size_t>> batchOrder;
+  // Process packets that arrived early if sequence has since connected. 
+  void catchupSequencePayloads(OutputSink &out, std::exception_ptr &error);
+  // Processes the payload of the packet at sequencePosition and moves on
+  // to the next, even if it throws: the first exception is kept in error
+  // for the caller to rethrow, and the rest of the packet is skipped.
+  void processPacket(const char* payload, size_t len, OutputSink &out,
+      std::exception_ptr &error);
+  // Decodes fully received input messages and writes output messages to file. 
+  //
+  // Messages are indexed in batches of up to MESSAGE_BATCH_SIZE, and only
+  // from this payload. Runs are not gathered across the packets of a
+  // catch-up burst: BBO messages are written per packet, and a packet that
+  // throws must not take the messages of the packets after it along, so a
+  // burst of stashed packets is decoded one payload at a time.
+  void processPayload(const char* payload, size_t len, OutputSink &out);
+  // Decodes complete input messages and writes their output messages, in
+  // two phases per run of same-type messages: decode the whole run, then
+  // update orders, with each order's slot prefetched during decoding.
+  //
+  // A run decodes into an array of the input structs, not an array per
+  // field. The SSSE3 decoders byte swap a whole message into its struct
+  // with one or two shuffles, which per-field columns would undo, and the
+  // gain of the two phases comes from overlapping the order table misses
+  // rather than from the decode itself.
+  void processMessages(const char* const* messages, size_t count, OutputSink &out);
+  template <typename Msg>
+  void processRun(const char* const* messages, size_t count,
+      void (*decode)(const char*, Msg*), size_t (OrderState::*apply)(char*, const Msg&),
+      OutputSink &out);
 
   public:
     // date - the day on which the data being parsed was generated.
@@ -100,9 +287,73 @@ class Parser {
     // For instance, 18 Jun 2018 would be specified as 20180618.
     //
     // outputFilename - name of the file output events should be written to.
-    Parser(int date, const std::string &outputFilename);
+    // Output is buffered according to config.flush, and is only guaranteed
+    // to be in the file after #flush or once the Parser is destroyed.
+    Parser(int date, const std::string &outputFilename,
+        const ParserConfig &config = ParserConfig());
+    // Writes output messages to sink instead of a file, for consumers
+    // that take the records directly. The sink must outlive the Parser,
+    // and config.flush is unused.
+    Parser(int date, OutputSink &sink, const ParserConfig &config = ParserConfig());
+    ~Parser();
 
     // buf - points to a char buffer containing bytes from a single UDP packet.
     // len - length of the packet.
+    //
+    // A packet whose messages can't be parsed, like one of an unknown type
+    // or, under UNKNOWN_REF_THROW, an unknown ref, throws once the packets
+    // it unblocked are processed. Its messages up to the bad one are
+    // written, the rest are lost, and parsing resumes with the next
+    // packet at its first message boundary.
     void onUDPPacket(const char *buf, size_t len);
+
+    // Same as calling #onUDPPacket on each packet in sequence number
+    // order, so packets reordered within the batch are decoded straight
+    // from their buffers rather than stashed, and with the per-packet
+    // bookkeeping, like the time based output flush, done once for the
+    // whole batch. Suits bursts from recvmmsg or capture replay.
+    //
+    // A packet that throws doesn't stop the rest of the batch; the first
+    // exception is rethrown once the whole batch is handled.
+    void onUDPPackets(const UDPPacket *packets, size_t count);
+
+    // Registers a message type beyond Add, Executed, Canceled and
+    // Replaced, length bytes long including the type byte, so feeds
+    // carrying it can be parsed. Its messages are passed to handler in
+    // feed order, or skipped if there is none. Throws std::invalid_argument
+    // for a built-in type or a length outside 1 to 255.
+    void registerMessageType(msgsymbol_t type, size_t length,
+        const MessageHandler &handler = MessageHandler());
+
+    // Hands every Add, Executed, Canceled and Replaced message, once
+    // sequenced and framed, to router instead of decoding it, so a
+    // pipeline can decode them on other threads. No output messages are
+    // written for them, and the order state stays empty.
+    void routeMessages(const MessageRouter &router);
+
+    // Writes all buffered output events to the file.
+    void flush();
+
+    // Applies time based thresholds, of gap recovery and output flushing,
+    // when no packets are arriving.
+    void poll();
+
+    // Packets dropped for arriving beyond the reorder window.
+    uint64_t getDroppedPackets() const;
+    // Sequence numbers skipped over by gap recovery.
+    uint64_t getSkippedPackets() const;
+    // Messages skipped or dropped for a ticker not in config.subscriptions.
+    uint64_t getFilteredMessages() const;
+    // Timestamp, in nanoseconds since midnight, of the latest message
+    // decoded, or Add skipped for its ticker, or 0 before the first.
+    uint64_t getLastTimestamp() const;
+    // Nanoseconds from the epoch to local midnight of the parser's date,
+    // which output timestamps count from.
+    uint64_t getMidnightNanos() const;
+    // Book built from the orders parsed so far, or null unless
+    // config.maintainBook or config.bboOutput. Symbols are those of the ticker ids the parser
+    // assigns in order of first appearance.
+    const OrderBook* getBook() const;
+    // Id of ticker in the book, or -1 if no order has had it.
+    int getSymbol(const std::string &ticker) const;
 };
@@ -0,0 +1,187 @@
+#include "RecordRing.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <stdexcept>
+#include <thread>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static const uint64_t RING_MAGIC = 0x31474e4952434552; // "RECRING1"
+static const size_t RECORD_HEADER_SIZE = 8;
+// Marks the unused end of the ring, where the next record didn't fit.
+static const uint32_t WRAP = UINT32_MAX;
+
+static size_t recordSpace(size_t len) {
+  return RECORD_HEADER_SIZE + (len + 7) / 8 * 8;
+}
+
+static size_t ringCapacity(size_t capacity) {
+  // Room for a few of the longest records, rounded up to a power of two.
+  size_t minimum = std::max(capacity, 4 * recordSpace(OutputSink::MAX_RECORD_SIZE));
+  size_t rounded = 64;
+  while(rounded < minimum) {
+    rounded *= 2;
+  }
+  return rounded;
+}
+
+RecordRing::RecordRing(size_t capacity) : mappedSize(0) {
+  capacity = ringCapacity(capacity);
+  void* memory = aligned_alloc(64, sizeof(RecordRingHeader) + capacity);
+  if(memory == nullptr) {
+    throw std::bad_alloc();
+  }
+  init(memory, capacity);
+}
+
+RecordRing::RecordRing(const std::string &name, size_t capacity) : shmName(name) {
+  capacity = ringCapacity(capacity);
+  mappedSize = sizeof(RecordRingHeader) + capacity;
+  int fd = shm_open(shmName.c_str(), O_CREAT | O_RDWR, 0600);
+  if(fd == -1) {
+    throw std::runtime_error("Couldn't open shared memory " + shmName + ": " + strerror(errno));
+  }
+  // Truncating first zeroes a ring left behind by an earlier run.
+  if(ftruncate(fd, 0) == -1 || ftruncate(fd, mappedSize) == -1) {
+    close(fd);
+    shm_unlink(shmName.c_str());
+    throw std::runtime_error("Couldn't size shared memory " + shmName + ": " + strerror(errno));
+  }
+  void* memory = mmap(nullptr, mappedSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if(memory == MAP_FAILED) {
+    shm_unlink(shmName.c_str());
+    throw std::runtime_error("Couldn't map shared memory " + shmName + ": " + strerror(errno));
+  }
+  init(memory, capacity);
+}
+
+void RecordRing::init(void* memory, size_t capacity) {
+  this->capacity = capacity;
+  header = new (memory) RecordRingHeader();
+  header->capacity = capacity;
+  header->head.store(0, std::memory_order_relaxed);
+  header->tail.store(0, std::memory_order_relaxed);
+  data = static_cast<char*>(memory) + sizeof(RecordRingHeader);
+  head = 0;
+  cachedTail = 0;
+  // Readers in other processes check this last.
+  __atomic_store_n(&header->magic, RING_MAGIC, __ATOMIC_RELEASE);
+}
+
+RecordRing::~RecordRing() {
+  if(shmName.empty()) {
+    free(header);
+  } else {
+    munmap(header, mappedSize);
+    shm_unlink(shmName.c_str());
+  }
+}
+
+void RecordRing::waitForRoom(size_t len) {
+  while(head + len - cachedTail > capacity) {
+    cachedTail = header->tail.load(std::memory_order_acquire);
+    if(head + len - cachedTail > capacity) {
+      std::this_thread::yield();
+    }
+  }
+}
+
+char* RecordRing::reserve(size_t len) {
+  if(len > MAX_RECORD_SIZE) {
+    throw std::invalid_argument("Record too long.");
+  }
+  size_t space = recordSpace(len);
+  size_t offset = head & (capacity - 1);
+  if(capacity - offset < space) {
+    // Skip to the start of the ring.
+    size_t skipped = capacity - offset;
+    waitForRoom(skipped);
+    memcpy(data + offset, &WRAP, sizeof(WRAP));
+    head += skipped;
+    header->head.store(head, std::memory_order_release);
+    offset = 0;
+  }
+  waitForRoom(space);
+  return data + offset + RECORD_HEADER_SIZE;
+}
+
+void RecordRing::commit(size_t len) {
+  uint32_t length = len;
+  memcpy(data + (head & (capacity - 1)), &length, sizeof(length));
+  head += recordSpace(len);
+  header->head.store(head, std::memory_order_release);
+}
+
+RecordRingReader::RecordRingReader(RecordRing &ring)
+    : header(ring.header), data(ring.data), capacity(ring.capacity),
+      tail(0), pending(0), mapping(nullptr), mappedSize(0) {
+  tail = header->tail.load(std::memory_order_relaxed);
+}
+
+RecordRingReader::RecordRingReader(const std::string &shmName)
+    : tail(0), pending(0) {
+  int fd = shm_open(shmName.c_str(), O_RDWR, 0);
+  if(fd == -1) {
+    throw std::runtime_error("Couldn't open shared memory " + shmName + ": " + strerror(errno));
+  }
+  struct stat st;
+  if(fstat(fd, &st) == -1 || (size_t) st.st_size < sizeof(RecordRingHeader)) {
+    close(fd);
+    throw std::runtime_error("No record ring in " + shmName);
+  }
+  mappedSize = st.st_size;
+  // The reader writes the tail, so the mapping is writable.
+  mapping = mmap(nullptr, mappedSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if(mapping == MAP_FAILED) {
+    throw std::runtime_error("Couldn't map shared memory " + shmName + ": " + strerror(errno));
+  }
+  header = static_cast<RecordRingHeader*>(mapping);
+  capacity = header->capacity;
+  if(__atomic_load_n(&header->magic, __ATOMIC_ACQUIRE) != RING_MAGIC ||
+      sizeof(RecordRingHeader) + capacity != mappedSize) {
+    munmap(mapping, mappedSize);
+    throw std::runtime_error("No record ring in " + shmName);
+  }
+  data = static_cast<const char*>(mapping) + sizeof(RecordRingHeader);
+  tail = header->tail.load(std::memory_order_relaxed);
+}
+
+RecordRingReader::~RecordRingReader() {
+  if(mapping != nullptr) {
+    munmap(mapping, mappedSize);
+  }
+}
+
+bool RecordRingReader::peek(const char** record, size_t* len) {
+  uint64_t head = header->head.load(std::memory_order_acquire);
+  while(tail != head) {
+    size_t offset = tail & (capacity - 1);
+    uint32_t length;
+    memcpy(&length, data + offset, sizeof(length));
+    if(length == WRAP) {
+      tail += capacity - offset;
+      header->tail.store(tail, std::memory_order_release);
+      continue;
+    }
+    *record = data + offset + RECORD_HEADER_SIZE;
+    *len = length;
+    pending = recordSpace(length);
+    return true;
+  }
+  return false;
+}
+
+void RecordRingReader::release() {
+  tail += pending;
+  pending = 0;
+  header->tail.store(tail, std::memory_order_release);
+}
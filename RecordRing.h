@@ -0,0 +1,96 @@
+#pragma once
+
+#include "OutputSink.h"
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// Start of a record ring's memory. The layout is fixed so that a ring in
+// shared memory can be read from another process.
+struct RecordRingHeader {
+  uint64_t magic;
+  uint64_t capacity;
+  // Byte positions, only ever increasing. Each on its own cache line so
+  // the writer and reader don't contend.
+  alignas(64) std::atomic<uint64_t> head;
+  alignas(64) std::atomic<uint64_t> tail;
+};
+
+static_assert(std::atomic<uint64_t>::is_always_lock_free,
+    "Ring positions are shared between processes.");
+
+// Single producer, single consumer ring of variable length records, for
+// handing output to a consumer thread, or to another process when placed
+// in POSIX shared memory. The parser writes records straight into the
+// ring and the consumer reads them in place, so neither side copies.
+//
+// Each record is an 8 byte length followed by the record, padded to 8
+// bytes. A record never wraps; the writer skips the end of the ring
+// instead. When the ring is full the writer spins until the consumer
+// catches up, so a stalled consumer stalls the parser.
+class RecordRing : public OutputSink {
+  RecordRingHeader* header;
+  char* data;
+  // Always a power of two.
+  size_t capacity;
+  // The writer's position, and the last tail it read.
+  uint64_t head;
+  uint64_t cachedTail;
+
+  // Shared memory object owning the ring, if any.
+  std::string shmName;
+  size_t mappedSize;
+
+  void init(void* memory, size_t capacity);
+  // Spins until len more bytes are free.
+  void waitForRoom(size_t len);
+
+  public:
+    // A ring in this process, of at least capacity bytes.
+    explicit RecordRing(size_t capacity);
+    // A ring in the POSIX shared memory object shmName, created or
+    // replaced, and unlinked on destruction.
+    RecordRing(const std::string &shmName, size_t capacity);
+    ~RecordRing();
+
+    RecordRing(const RecordRing&) = delete;
+    RecordRing& operator=(const RecordRing&) = delete;
+
+    char* reserve(size_t len) override;
+    void commit(size_t len) override;
+
+    friend class RecordRingReader;
+};
+
+// The consuming end of a RecordRing.
+class RecordRingReader {
+  RecordRingHeader* header;
+  const char* data;
+  size_t capacity;
+  uint64_t tail;
+  // Bytes taken up by the record from #peek.
+  size_t pending;
+
+  // Mapping of a ring in another process, if any.
+  void* mapping;
+  size_t mappedSize;
+
+  public:
+    // Reads a ring in this process.
+    explicit RecordRingReader(RecordRing &ring);
+    // Maps the ring in the shared memory object shmName. Throws
+    // std::runtime_error if there's no ring there.
+    explicit RecordRingReader(const std::string &shmName);
+    ~RecordRingReader();
+
+    RecordRingReader(const RecordRingReader&) = delete;
+    RecordRingReader& operator=(const RecordRingReader&) = delete;
+
+    // Points record at the next committed record, in the ring, or returns
+    // false if there is none yet. The record stays valid until #release.
+    bool peek(const char** record, size_t* len);
+    // Frees the record from the last #peek for the writer to reuse.
+    void release();
+};
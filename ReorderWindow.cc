@@ -0,0 +1,129 @@
+#include "ReorderWindow.h"
+
+#include <cstring>
+#include <memory>
+#include <stdexcept>
+
+static uint32_t packetSequenceNumber(const char* packet) {
+  return (uint32_t)((uint8_t)packet[2]) << 24 |
+    (uint32_t)((uint8_t)packet[3]) << 16 |
+    (uint32_t)((uint8_t)packet[4]) << 8 |
+    (uint32_t)((uint8_t)packet[5]);
+}
+
+ReorderWindow::ReorderWindow(size_t windowSize) {
+  if(windowSize == 0 || (windowSize & (windowSize - 1)) != 0) {
+    throw std::invalid_argument("Reorder window size must be a power of two.");
+  }
+  capacity = windowSize;
+  count = 0;
+  slots = new char*[capacity];
+  // At least one word, even for windows smaller than 64 slots.
+  size_t words = (capacity + 63) / 64;
+  occupied = new uint64_t[words];
+  memset(occupied, 0, words * sizeof(uint64_t));
+}
+
+ReorderWindow::~ReorderWindow() {
+  delete[] slots;
+  delete[] occupied;
+}
+
+bool ReorderWindow::contains(uint32_t seq) const {
+  size_t i = seq & (capacity - 1);
+  return (occupied[i / 64] >> (i % 64)) & 1;
+}
+
+void ReorderWindow::put(uint32_t seq, char* packet) {
+  size_t i = seq & (capacity - 1);
+  slots[i] = packet;
+  occupied[i / 64] |= (uint64_t) 1 << (i % 64);
+  count++;
+}
+
+char* ReorderWindow::take(uint32_t seq) {
+  size_t i = seq & (capacity - 1);
+  occupied[i / 64] &= ~((uint64_t) 1 << (i % 64));
+  count--;
+  return slots[i];
+}
+
+size_t ReorderWindow::run(uint32_t seq) const {
+  size_t n = 0;
+  size_t i = seq & (capacity - 1);
+  while(n < count) {
+    // Count the ones from bit i onwards, within its word and the window.
+    size_t bit = i % 64;
+    size_t span = capacity < 64 ? capacity - bit : 64 - bit;
+    uint64_t ones = ~(occupied[i / 64] >> bit);
+    size_t length = ones == 0 ? 64 - bit : __builtin_ctzll(ones);
+    if(length > span) {
+      length = span;
+    }
+    n += length;
+    if(length < span) {
+      break;
+    }
+    i = (i + length) & (capacity - 1);
+  }
+  return n < count ? n : count;
+}
+
+uint32_t ReorderWindow::next(uint32_t seq) const {
+  // Count the empty slots from seq onwards, a word at a time.
+  uint32_t gap = 0;
+  size_t i = seq & (capacity - 1);
+  while(true) {
+    size_t bit = i % 64;
+    size_t span = capacity < 64 ? capacity - bit : 64 - bit;
+    uint64_t ones = occupied[i / 64] >> bit;
+    if(ones != 0 && (size_t) __builtin_ctzll(ones) < span) {
+      return seq + gap + __builtin_ctzll(ones);
+    }
+    gap += span;
+    i = (i + span) & (capacity - 1);
+  }
+}
+
+void ReorderWindow::grow(uint32_t head, uint32_t seq) {
+  size_t newCapacity = capacity;
+  while(seq - head >= newCapacity) {
+    newCapacity *= 2;
+  }
+
+  // Allocate before touching the window, so it stays intact if that throws.
+  size_t words = (newCapacity + 63) / 64;
+  std::unique_ptr<char*[]> newSlots(new char*[newCapacity]);
+  std::unique_ptr<uint64_t[]> newOccupied(new uint64_t[words]);
+  memset(newOccupied.get(), 0, words * sizeof(uint64_t));
+
+  char** oldSlots = slots;
+  uint64_t* oldOccupied = occupied;
+  size_t oldCapacity = capacity;
+  slots = newSlots.release();
+  occupied = newOccupied.release();
+  capacity = newCapacity;
+  count = 0;
+
+  // Slots are re-indexed by the sequence number in each packet header.
+  for(size_t i = 0; i < oldCapacity; i++) {
+    if((oldOccupied[i / 64] >> (i % 64)) & 1) {
+      put(packetSequenceNumber(oldSlots[i]), oldSlots[i]);
+    }
+  }
+  delete[] oldSlots;
+  delete[] oldOccupied;
+}
+
+char* ReorderWindow::takeAny() {
+  size_t words = (capacity + 63) / 64;
+  for(size_t w = 0; w < words; w++) {
+    if(occupied[w] != 0) {
+      size_t i = w * 64 + __builtin_ctzll(occupied[w]);
+      occupied[w] &= occupied[w] - 1;
+      count--;
+      return slots[i];
+    }
+  }
+  return nullptr;
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// Stash of packets that arrived ahead of the next expected sequence
+// number, in a circular window of slots indexed by seq % capacity. An
+// occupancy bitmap mirrors the slots, so the run of stashed packets that
+// continues the sequence is found with a bit scan rather than a lookup
+// per packet.
+//
+// The window only holds sequence numbers in [head, head + capacity) for
+// the caller's current head; anything further out needs #grow first.
+class ReorderWindow {
+  // Stashed packets, each starting with its packet header.
+  char** slots;
+  uint64_t* occupied;
+  // Always a power of two.
+  size_t capacity;
+  size_t count;
+
+  public:
+    explicit ReorderWindow(size_t capacity);
+    ~ReorderWindow();
+
+    ReorderWindow(const ReorderWindow&) = delete;
+    ReorderWindow& operator=(const ReorderWindow&) = delete;
+
+    // Whether seq fits in the window starting at head.
+    bool fits(uint32_t head, uint32_t seq) const { return seq - head < capacity; }
+    bool contains(uint32_t seq) const;
+    // Stashes the packet with sequence number seq, which must fit.
+    void put(uint32_t seq, char* packet);
+    // Removes and returns the packet stashed for seq, which must be there.
+    char* take(uint32_t seq);
+    // Number of consecutive sequence numbers stashed, starting at seq.
+    size_t run(uint32_t seq) const;
+    // First stashed sequence number from seq onwards. Must not be empty.
+    uint32_t next(uint32_t seq) const;
+
+    // Doubles the capacity until seq fits in the window starting at head.
+    // If allocating throws, the window is left as it was.
+    void grow(uint32_t head, uint32_t seq);
+
+    size_t size() const { return count; }
+    bool empty() const { return count == 0; }
+    // Removes and returns any stashed packet, or nullptr if empty.
+    char* takeAny();
+};
@@ -0,0 +1,102 @@
+#include "Replay.h"
+
+#include <chrono>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+Replay::Replay(const std::string &filename) : data(nullptr), size(0) {
+  int fd = open(filename.c_str(), O_RDONLY);
+  if(fd == -1) {
+    throw std::runtime_error("Couldn't open " + filename);
+  }
+  struct stat st;
+  if(fstat(fd, &st) == -1) {
+    close(fd);
+    throw std::runtime_error("Couldn't stat " + filename);
+  }
+  size = st.st_size;
+  // An empty capture has nothing to map.
+  if(size > 0) {
+    void* mapped = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if(mapped == MAP_FAILED) {
+      close(fd);
+      throw std::runtime_error("Couldn't map " + filename);
+    }
+    data = static_cast<const char*>(mapped);
+    // Hints only; huge pages need file THP support, so failure is fine.
+    madvise(mapped, size, MADV_SEQUENTIAL);
+#ifdef MADV_HUGEPAGE
+    madvise(mapped, size, MADV_HUGEPAGE);
+#endif
+  }
+  close(fd);
+}
+
+Replay::~Replay() {
+  if(data != nullptr) {
+    munmap(const_cast<char*>(data), size);
+  }
+}
+
+size_t Replay::run(Parser &parser, const ReplayConfig &config) {
+  if(config.batchSize == 0) {
+    throw std::invalid_argument("Replay batch size must be non-zero.");
+  }
+  typedef std::chrono::steady_clock clock;
+  clock::time_point start = clock::now();
+  bool paced = config.speed > 0;
+  bool started = false;
+  uint64_t firstTimestamp = 0;
+
+  std::vector<UDPPacket> batch;
+  batch.reserve(config.batchSize);
+  size_t packets = 0;
+  size_t offset = 0;
+  while(offset < size) {
+    size_t len = size - offset < 2 ? 0 : ((uint8_t)data[offset] << 8) | (uint8_t)data[offset + 1];
+    if(len < 2 || len > size - offset) {
+      // The complete packets before it are still parsed.
+      if(!batch.empty()) {
+        parser.onUDPPackets(batch.data(), batch.size());
+      }
+      throw std::runtime_error("Truncated packet in capture.");
+    }
+    packets++;
+
+    if(!paced) {
+      batch.push_back({data + offset, len});
+      if(batch.size() == config.batchSize) {
+        parser.onUDPPackets(batch.data(), batch.size());
+        batch.clear();
+      }
+      offset += len;
+      continue;
+    }
+
+    // Hold each packet back until the timestamps decoded so far say the
+    // feed would have got there.
+    uint64_t timestamp = parser.getLastTimestamp();
+    if(!started && timestamp != 0) {
+      started = true;
+      firstTimestamp = timestamp;
+      start = clock::now();
+    }
+    if(started && timestamp > firstTimestamp) {
+      std::chrono::nanoseconds elapsed(
+          static_cast<int64_t>((timestamp - firstTimestamp) / config.speed));
+      std::this_thread::sleep_until(start + elapsed);
+    }
+    parser.onUDPPacket(data + offset, len);
+    offset += len;
+  }
+  if(!batch.empty()) {
+    parser.onUDPPackets(batch.data(), batch.size());
+  }
+  return packets;
+}
@@ -0,0 +1,36 @@
+#pragma once
+
+#include "Parser.h"
+
+#include <cstddef>
+#include <string>
+
+struct ReplayConfig {
+  // 0 replays as fast as the parser decodes. Otherwise each packet waits
+  // until the last message timestamp decoded before it, scaled by 1/speed,
+  // has elapsed since the first, so 1 is real time.
+  double speed = 0;
+  // Packets handed to Parser::onUDPPackets at a time when not paced.
+  size_t batchSize = 64;
+};
+
+// Replays a capture of length prefixed packets, as written by feed_gen,
+// into a Parser. The file is mapped rather than read, and packets are
+// passed by pointer into the mapping, so replay costs no syscall or copy
+// per packet.
+class Replay {
+  const char* data;
+  size_t size;
+
+  public:
+    // Throws std::runtime_error if the file can't be mapped.
+    explicit Replay(const std::string &filename);
+    ~Replay();
+
+    Replay(const Replay&) = delete;
+    Replay& operator=(const Replay&) = delete;
+
+    // Feeds every packet in the capture to parser, returning the number
+    // of packets. Throws std::runtime_error on a truncated packet.
+    size_t run(Parser &parser, const ReplayConfig &config = ReplayConfig());
+};
@@ -0,0 +1,433 @@
+#include "ShardedParser.h"
+#include "MessageLayout.h"
+#include "RecordRing.h"
+
+#include <cstring>
+#include <stdexcept>
+
+// Messages a worker or the writer takes between publishing its progress.
+const size_t STAGE_BATCH_SIZE = 64;
+
+// How a worker handles a message.
+enum ShardRole : uint8_t {
+  // All of it.
+  ROLE_WHOLE,
+  // The old ref's half of a Replaced split across workers: the output
+  // message, and retiring the old order.
+  ROLE_REPLACE_OLD,
+  // The new ref's half: adding the new order.
+  ROLE_REPLACE_NEW,
+};
+
+// States of a hand-over slot.
+enum HandoffState : uint32_t {
+  HANDOFF_FREE,
+  // Claimed by the sequencer, awaiting the old ref's worker.
+  HANDOFF_PENDING,
+  // Filled in, awaiting the new ref's worker.
+  HANDOFF_READY,
+};
+
+// A message copied out of its packet for a worker.
+struct ShardedParser::ShardMessage {
+  char bytes[InputAddLayout::SIZE];
+  ShardRole role;
+  // Hand-over slot, unless ROLE_WHOLE.
+  uint32_t handoff;
+};
+
+static_assert(InputAddLayout::SIZE >= InputReplacedLayout::SIZE &&
+    InputAddLayout::SIZE >= InputExecutedLayout::SIZE, "Add Order is the longest message.");
+
+// What the new ref's worker inherits from the old order.
+struct alignas(64) ShardedParser::Handoff {
+  std::atomic<uint32_t> state;
+  OrderState::Inheritance inherited;
+};
+
+// A worker and the orders it owns.
+class ShardedParser::Shard {
+  ShardedParser &parser;
+  // This shard's orders, kept as a Parser keeps all of them.
+  OrderState state;
+
+  // Serializes the output message for msg, returning its length, or 0 if
+  // the message was dropped.
+  size_t apply(const char* msg, char* out, Handoff* handoff);
+  // Adds the new order of a split Replaced.
+  void replacement(const char* msg, Handoff &handoff);
+
+  public:
+    SpscQueue<ShardMessage> input;
+    // Where records go: the shard's own sink, or ring for the writer.
+    OutputSink* out;
+    std::unique_ptr<RecordRing> ring;
+    std::unique_ptr<RecordRingReader> reader;
+    // Messages pushed by the sequencer, and processed by the worker.
+    uint64_t pushed;
+    std::atomic<uint64_t> processed;
+    std::thread thread;
+
+    Shard(ShardedParser &parser, const ParserConfig &config, size_t queueSize)
+        : parser(parser), state(config, parser.midnightNanos), input(queueSize),
+          out(nullptr), pushed(0), processed(0) {}
+
+    void handle(const ShardMessage &message);
+};
+
+ShardedParser::ShardedParser(int date, const std::string &outputFilename,
+    const ParserConfig &config, const PipelineConfig &pipeline)
+    : ShardedParser(date, config, pipeline, std::vector<OutputSink*>()) {
+  ownedOutput.reset(new OutputWriter(outputFilename, config.flush));
+  output = ownedOutput.get();
+  start();
+}
+
+ShardedParser::ShardedParser(int date, OutputSink &sink,
+    const ParserConfig &config, const PipelineConfig &pipeline)
+    : ShardedParser(date, config, pipeline, std::vector<OutputSink*>()) {
+  output = &sink;
+  start();
+}
+
+ShardedParser::ShardedParser(int date, const std::vector<OutputSink*> &shardSinks,
+    const ParserConfig &config, const PipelineConfig &pipeline)
+    : ShardedParser(date, config, pipeline, shardSinks) {
+  if(shardSinks.empty()) {
+    throw std::invalid_argument("Sharded output needs a sink per worker.");
+  }
+  start();
+}
+
+ShardedParser::ShardedParser(int date, const ParserConfig &config,
+    const PipelineConfig &pipeline, const std::vector<OutputSink*> &shardSinks)
+    : config(config), output(nullptr), nextHandoff(0), logged(0), written(0),
+      stopping(false), failed(false) {
+  if(config.maintainBook || config.bboOutput) {
+    throw std::invalid_argument("The book and BBO output aren't sharded.");
+  }
+  size_t workers = shardSinks.empty() ? pipeline.workers : shardSinks.size();
+  if(workers == 0 || workers > 256) {
+    throw std::invalid_argument("Workers must be between 1 and 256.");
+  }
+
+  // The sequencer keeps no orders of its own, and leaves filtering to
+  // the workers.
+  ParserConfig sequencing = config;
+  sequencing.expectedOrders = 0;
+  sequencing.subscriptions.clear();
+  sequencer.reset(new Parser(date, discard, sequencing));
+  sequencer->routeMessages([this](const char* const* messages, size_t count) {
+    route(messages, count);
+  });
+  decoders = config.simdDecode ? &bestDecoders() : &scalarDecoders();
+  midnightNanos = sequencer->getMidnightNanos();
+
+  // A slot per message a worker can have queued is plenty.
+  size_t handoffCount = 2;
+  while(handoffCount < pipeline.queueSize) {
+    handoffCount *= 2;
+  }
+  handoffs.reset(new Handoff[handoffCount]());
+  handoffMask = handoffCount - 1;
+
+  ParserConfig sharding = config;
+  sharding.expectedOrders = config.expectedOrders / workers;
+  for(size_t i = 0; i < workers; i++) {
+    shards.emplace_back(new Shard(*this, sharding, pipeline.queueSize));
+    Shard &shard = *shards.back();
+    if(shardSinks.empty()) {
+      shard.ring.reset(new RecordRing(pipeline.outputRingSize));
+      shard.reader.reset(new RecordRingReader(*shard.ring));
+      shard.out = shard.ring.get();
+    } else {
+      shard.out = shardSinks[i];
+    }
+  }
+  if(shardSinks.empty()) {
+    log.reset(new SpscQueue<uint8_t>(pipeline.queueSize * workers));
+  }
+}
+
+void ShardedParser::start() {
+  for(std::unique_ptr<Shard> &shard : shards) {
+    Shard* worker = shard.get();
+    shard->thread = std::thread([this, worker]() { runShard(*worker); });
+  }
+  if(log) {
+    writer = std::thread([this]() { runWriter(); });
+  }
+}
+
+ShardedParser::~ShardedParser() {
+  drain();
+  stopping.store(true, std::memory_order_release);
+  for(std::unique_ptr<Shard> &shard : shards) {
+    if(shard->thread.joinable()) {
+      shard->thread.join();
+    }
+  }
+  if(writer.joinable()) {
+    writer.join();
+  }
+}
+
+void ShardedParser::onUDPPacket(const char *buf, size_t len) {
+  sequencer->onUDPPacket(buf, len);
+  rethrow();
+}
+
+void ShardedParser::onUDPPackets(const UDPPacket *packets, size_t count) {
+  sequencer->onUDPPackets(packets, count);
+  rethrow();
+}
+
+void ShardedParser::registerMessageType(msgsymbol_t type, size_t length,
+    const MessageHandler &handler) {
+  sequencer->registerMessageType(type, length, handler);
+}
+
+void ShardedParser::poll() {
+  sequencer->poll();
+}
+
+uint64_t ShardedParser::getDroppedPackets() const {
+  return sequencer->getDroppedPackets();
+}
+
+uint64_t ShardedParser::getSkippedPackets() const {
+  return sequencer->getSkippedPackets();
+}
+
+void ShardedParser::flush() {
+  drain();
+  // The threads are idle until more is routed, so the sinks are ours.
+  if(output) {
+    output->flush();
+  } else {
+    for(std::unique_ptr<Shard> &shard : shards) {
+      shard->out->flush();
+    }
+  }
+  rethrow();
+}
+
+void ShardedParser::drain() {
+  for(std::unique_ptr<Shard> &shard : shards) {
+    while(shard->processed.load(std::memory_order_acquire) != shard->pushed) {
+      std::this_thread::yield();
+    }
+  }
+  while(log && written.load(std::memory_order_acquire) != logged) {
+    std::this_thread::yield();
+  }
+}
+
+void ShardedParser::fail(const std::string &message) {
+  std::lock_guard<std::mutex> guard(errorLock);
+  if(!error) {
+    error = std::make_exception_ptr(std::runtime_error(message));
+  }
+  failed.store(true, std::memory_order_release);
+}
+
+void ShardedParser::rethrow() {
+  if(!failed.load(std::memory_order_acquire)) {
+    return;
+  }
+  std::exception_ptr first;
+  {
+    std::lock_guard<std::mutex> guard(errorLock);
+    first = error;
+    error = nullptr;
+    failed.store(false, std::memory_order_relaxed);
+  }
+  std::rethrow_exception(first);
+}
+
+void ShardedParser::route(const char* const* messages, size_t count) {
+  size_t workers = shards.size();
+  for(size_t i = 0; i < count; i++) {
+    const char* msg = messages[i];
+    switch(*msg) {
+      case 'A':
+        dispatch(shardOf(readField<InputAddLayout::orderRef>(msg), workers),
+            msg, InputAddLayout::SIZE, ROLE_WHOLE, 0);
+        break;
+      case 'E':
+      case 'X':
+        dispatch(shardOf(readField<InputExecutedLayout::orderRef>(msg), workers),
+            msg, InputExecutedLayout::SIZE, ROLE_WHOLE, 0);
+        break;
+      case 'R': {
+        size_t from = shardOf(readField<InputReplacedLayout::originalOrderRef>(msg), workers);
+        size_t to = shardOf(readField<InputReplacedLayout::newOrderRef>(msg), workers);
+        if(from == to) {
+          dispatch(from, msg, InputReplacedLayout::SIZE, ROLE_WHOLE, 0);
+          break;
+        }
+        uint32_t slot = nextHandoff++ & handoffMask;
+        Handoff &handoff = handoffs[slot];
+        while(handoff.state.load(std::memory_order_acquire) != HANDOFF_FREE) {
+          std::this_thread::yield();
+        }
+        handoff.state.store(HANDOFF_PENDING, std::memory_order_relaxed);
+        dispatch(from, msg, InputReplacedLayout::SIZE, ROLE_REPLACE_OLD, slot);
+        dispatch(to, msg, InputReplacedLayout::SIZE, ROLE_REPLACE_NEW, slot);
+        break;
+      }
+    }
+  }
+}
+
+void ShardedParser::dispatch(size_t shard, const char* msg, size_t len, uint8_t role,
+    uint32_t handoff) {
+  ShardMessage message;
+  memcpy(message.bytes, msg, len);
+  message.role = static_cast<ShardRole>(role);
+  message.handoff = handoff;
+  Shard &worker = *shards[shard];
+  worker.input.push(message);
+  worker.pushed++;
+  // The new ref's half of a Replaced writes no output.
+  if(log && role != ROLE_REPLACE_NEW) {
+    log->push(shard);
+    logged++;
+  }
+}
+
+void ShardedParser::runShard(Shard &shard) {
+  ShardMessage message;
+  uint64_t processed = 0;
+  while(true) {
+    size_t n = 0;
+    while(n < STAGE_BATCH_SIZE && shard.input.tryPop(&message)) {
+      shard.handle(message);
+      n++;
+    }
+    if(n > 0) {
+      // Published after polling, so a caller that sees everything
+      // processed has the sink to itself.
+      shard.out->poll();
+      processed += n;
+      shard.processed.store(processed, std::memory_order_release);
+    } else if(stopping.load(std::memory_order_acquire)) {
+      return;
+    } else {
+      std::this_thread::yield();
+    }
+  }
+}
+
+void ShardedParser::runWriter() {
+  uint64_t count = 0;
+  uint8_t shard;
+  while(true) {
+    size_t n = 0;
+    while(n < STAGE_BATCH_SIZE && log->tryPop(&shard)) {
+      RecordRingReader &reader = *shards[shard]->reader;
+      const char* record;
+      size_t len;
+      while(!reader.peek(&record, &len)) {
+        std::this_thread::yield();
+      }
+      // Dropped messages leave an empty record.
+      if(len > 0) {
+        try {
+          memcpy(output->reserve(len), record, len);
+          output->commit(len);
+        } catch(const std::exception &e) {
+          fail(e.what());
+        }
+      }
+      reader.release();
+      n++;
+    }
+    if(n > 0) {
+      output->poll();
+      count += n;
+      written.store(count, std::memory_order_release);
+    } else if(stopping.load(std::memory_order_acquire)) {
+      return;
+    } else {
+      std::this_thread::yield();
+    }
+  }
+}
+
+void ShardedParser::Shard::handle(const ShardMessage &message) {
+  const char* msg = message.bytes;
+  Handoff* handoff = message.role == ROLE_WHOLE ? nullptr : &parser.handoffs[message.handoff];
+  try {
+    if(message.role == ROLE_REPLACE_NEW) {
+      replacement(msg, *handoff);
+      return;
+    }
+    size_t len = apply(msg, out->reserve(OutputSink::MAX_RECORD_SIZE), handoff);
+    // The writer expects a record, if only an empty one, per message.
+    if(len > 0 || ring) {
+      out->commit(len);
+    }
+  } catch(const std::exception &e) {
+    parser.fail(e.what());
+    if(message.role == ROLE_REPLACE_NEW) {
+      handoff->state.store(HANDOFF_FREE, std::memory_order_release);
+      return;
+    }
+    if(ring) {
+      ring->reserve(0);
+      ring->commit(0);
+    }
+    if(handoff && handoff->state.load(std::memory_order_relaxed) == HANDOFF_PENDING) {
+      handoff->inherited.found = false;
+      handoff->state.store(HANDOFF_READY, std::memory_order_release);
+    }
+  }
+}
+
+size_t ShardedParser::Shard::apply(const char* msg, char* out, Handoff* handoff) {
+  const MessageDecoders &decoders = *parser.decoders;
+  switch(*msg) {
+    case 'A': {
+      if(!state.subscribed(msg)) {
+        return 0;
+      }
+      InputAddOrder inputMsg;
+      decoders.addOrder(msg, &inputMsg);
+      return state.addOrder(out, inputMsg);
+    }
+    case 'E': {
+      InputOrderExecuted inputMsg;
+      decoders.orderExecuted(msg, &inputMsg);
+      return state.orderExecuted(out, inputMsg);
+    }
+    case 'X': {
+      InputOrderCanceled inputMsg;
+      decoders.orderCanceled(msg, &inputMsg);
+      return state.orderReduced(out, inputMsg);
+    }
+    case 'R': {
+      InputOrderReplaced inputMsg;
+      decoders.orderReplaced(msg, &inputMsg);
+      if(!handoff) {
+        return state.orderReplaced(out, inputMsg);
+      }
+      // Another worker owns the new ref.
+      size_t len = state.replaceOld(out, inputMsg, &handoff->inherited);
+      handoff->state.store(HANDOFF_READY, std::memory_order_release);
+      return len;
+    }
+  }
+  return 0;
+}
+
+void ShardedParser::Shard::replacement(const char* msg, Handoff &handoff) {
+  // The old ref's worker is at most a queue behind.
+  while(handoff.state.load(std::memory_order_acquire) != HANDOFF_READY) {
+    std::this_thread::yield();
+  }
+  InputOrderReplaced inputMsg;
+  parser.decoders->orderReplaced(msg, &inputMsg);
+  state.replaceNew(inputMsg, handoff.inherited);
+  handoff.state.store(HANDOFF_FREE, std::memory_order_release);
+}
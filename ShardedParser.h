@@ -0,0 +1,144 @@
+#pragma once
+
+#include <atomic>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "Parser.h"
+#include "SpscQueue.h"
+
+// Tunables of a ShardedParser's threads.
+struct PipelineConfig {
+  // Worker threads, each owning the orders whose ref hashes to it.
+  // Between 1 and 256.
+  size_t workers = 4;
+  // Messages queued to each worker before the sequencer waits on it.
+  size_t queueSize = 1 << 14;
+  // Bytes of output records each worker can get ahead of the writer by,
+  // when merging.
+  size_t outputRingSize = 1 << 20;
+};
+
+// Parses a feed on several threads, in three stages:
+//
+// - The sequencer, the thread calling #onUDPPacket, reorders packets and
+//   frames messages, as a Parser would, then copies each message to the
+//   worker owning its order ref over a single producer, single consumer
+//   queue.
+// - Workers decode messages and keep the state of their shard of the
+//   orders, serializing output messages as they go. All messages of an
+//   order reach the same worker, in feed order, so per-order events stay
+//   ordered. A Replaced whose new ref belongs to another worker goes to
+//   both: the old ref's worker writes the output message and hands the
+//   ticker and side over to the new ref's worker, which adds the order.
+// - A writer thread merges the workers' output back into feed order, by
+//   following the sequencer's log of which worker took each message, so
+//   the output is the same as a Parser's. Alternatively each worker writes
+//   its shard's output to a sink of its own, in feed order within the
+//   shard, with no writer thread.
+//
+// Workers keep their orders in an OrderState each, as a Parser keeps all
+// of them, so output messages are serialized the same way. Subscriptions
+// are filtered on the workers, and RETIRE_GRAVEYARD keeps a graveyard of
+// config.graveyardSize per worker. The book and BBO output aren't
+// supported, and throw std::invalid_argument. Unknown refs under
+// UNKNOWN_REF_THROW are found on a worker; the message is dropped and the
+// error rethrown on the next call to #onUDPPacket, #onUDPPackets or
+// #flush.
+class ShardedParser {
+  class Shard;
+  struct Handoff;
+  struct ShardMessage;
+
+  ParserConfig config;
+  DiscardSink discard;
+  // Sequences and frames messages, routing them through #route.
+  std::unique_ptr<Parser> sequencer;
+  const MessageDecoders* decoders;
+  uint64_t midnightNanos;
+
+  std::vector<std::unique_ptr<Shard>> shards;
+  // Ring of hand-over slots of Replaced messages split across workers.
+  std::unique_ptr<Handoff[]> handoffs;
+  size_t handoffMask;
+  uint64_t nextHandoff;
+
+  // Merged output: the file, if writing to one, and where records go.
+  std::unique_ptr<OutputWriter> ownedOutput;
+  OutputSink* output;
+  // Worker of each message with an output record, in feed order.
+  std::unique_ptr<SpscQueue<uint8_t>> log;
+  // Messages logged by the sequencer, and merged by the writer.
+  uint64_t logged;
+  std::atomic<uint64_t> written;
+  std::thread writer;
+
+  std::atomic<bool> stopping;
+  // First error found on a worker since the last rethrow.
+  std::mutex errorLock;
+  std::exception_ptr error;
+  std::atomic<bool> failed;
+
+  // Shared by the public constructors.
+  ShardedParser(int date, const ParserConfig &config, const PipelineConfig &pipeline,
+      const std::vector<OutputSink*> &shardSinks);
+  // Starts the threads, once the output is set.
+  void start();
+
+  // Sequencer: copies messages to their workers.
+  void route(const char* const* messages, size_t count);
+  void dispatch(size_t shard, const char* message, size_t len, uint8_t role,
+      uint32_t handoff);
+  // Workers and writer.
+  void runShard(Shard &shard);
+  void runWriter();
+  // Records an error for the caller's thread, keeping the first.
+  void fail(const std::string &message);
+  void rethrow();
+  // Waits until everything routed so far is processed and written.
+  void drain();
+
+  public:
+    // Merges all output into outputFilename, buffered per config.flush.
+    ShardedParser(int date, const std::string &outputFilename,
+        const ParserConfig &config = ParserConfig(),
+        const PipelineConfig &pipeline = PipelineConfig());
+    // Merges all output into sink, which must outlive the parser.
+    ShardedParser(int date, OutputSink &sink,
+        const ParserConfig &config = ParserConfig(),
+        const PipelineConfig &pipeline = PipelineConfig());
+    // One worker per sink, writing the output of its shard of orders
+    // there, from the worker's thread. pipeline.workers is unused.
+    ShardedParser(int date, const std::vector<OutputSink*> &shardSinks,
+        const ParserConfig &config = ParserConfig(),
+        const PipelineConfig &pipeline = PipelineConfig());
+    // Finishes everything routed, and stops the threads.
+    ~ShardedParser();
+
+    ShardedParser(const ShardedParser&) = delete;
+    ShardedParser& operator=(const ShardedParser&) = delete;
+
+    // As Parser's.
+    void onUDPPacket(const char *buf, size_t len);
+    void onUDPPackets(const UDPPacket *packets, size_t count);
+    // Handlers are called on the sequencer's thread.
+    void registerMessageType(msgsymbol_t type, size_t length,
+        const MessageHandler &handler = MessageHandler());
+    void poll();
+    uint64_t getDroppedPackets() const;
+    uint64_t getSkippedPackets() const;
+
+    // Waits for the workers and writer to finish everything routed so
+    // far, and flushes the output.
+    void flush();
+
+    // The worker owning orderRef, of workers.
+    static size_t shardOf(uint64_t orderRef, size_t workers) {
+      // Fibonacci hashing, taking the top bits into [0, workers).
+      return ((orderRef * 0x9E3779B97F4A7C15ULL) >> 32) * workers >> 32;
+    }
+};
@@ -0,0 +1,73 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <thread>
+
+// Bounded single producer, single consumer queue of fixed-size items, for
+// handing work between the threads of a pipeline. Positions only ever
+// increase, and each side caches the other's position, so it only reads
+// the other side's cache line when the queue looks full or empty.
+template <typename T>
+class SpscQueue {
+  std::unique_ptr<T[]> items;
+  // Capacity - 1; the capacity is a power of two.
+  size_t mask;
+
+  // Written by the producer.
+  alignas(64) std::atomic<uint64_t> head;
+  uint64_t cachedTail;
+  // Written by the consumer.
+  alignas(64) std::atomic<uint64_t> tail;
+  uint64_t cachedHead;
+
+  public:
+    // Holds at least capacity items.
+    explicit SpscQueue(size_t capacity) : head(0), cachedTail(0), tail(0), cachedHead(0) {
+      size_t rounded = 2;
+      while(rounded < capacity) {
+        rounded *= 2;
+      }
+      items.reset(new T[rounded]);
+      mask = rounded - 1;
+    }
+
+    SpscQueue(const SpscQueue&) = delete;
+    SpscQueue& operator=(const SpscQueue&) = delete;
+
+    // Producer only. Returns false if the queue is full.
+    bool tryPush(const T &item) {
+      uint64_t position = head.load(std::memory_order_relaxed);
+      if(position - cachedTail > mask) {
+        cachedTail = tail.load(std::memory_order_acquire);
+        if(position - cachedTail > mask) {
+          return false;
+        }
+      }
+      items[position & mask] = item;
+      head.store(position + 1, std::memory_order_release);
+      return true;
+    }
+    // Producer only. Spins until there is room.
+    void push(const T &item) {
+      while(!tryPush(item)) {
+        std::this_thread::yield();
+      }
+    }
+
+    // Consumer only. Returns false if the queue is empty.
+    bool tryPop(T* item) {
+      uint64_t position = tail.load(std::memory_order_relaxed);
+      if(position == cachedHead) {
+        cachedHead = head.load(std::memory_order_acquire);
+        if(position == cachedHead) {
+          return false;
+        }
+      }
+      *item = items[position & mask];
+      tail.store(position + 1, std::memory_order_release);
+      return true;
+    }
+};
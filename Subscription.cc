@@ -0,0 +1,157 @@
+#include "Subscription.h"
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+// Slots per ticker, and tickers per bucket, to start the search at.
+const size_t SLOTS_PER_TICKER = 2;
+const size_t TICKERS_PER_BUCKET = 4;
+const size_t MIN_SLOTS = 8;
+// Seeds tried for a bucket before doubling the table.
+const int TRIES_PER_BUCKET = 1 << 16;
+
+// splitmix64, for a reproducible sequence of candidate seeds.
+static uint64_t nextSeed(uint64_t &state) {
+  uint64_t z = (state += 0x9E3779B97F4A7C15ULL);
+  z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+  z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+  return z ^ (z >> 31);
+}
+
+static size_t powerOfTwoAtLeast(size_t n, size_t min) {
+  size_t size = min;
+  while(size < n) {
+    size *= 2;
+  }
+  return size;
+}
+
+SubscriptionSet::SubscriptionSet(const std::vector<std::string> &tickers) {
+  std::vector<uint64_t> keys;
+  for(const std::string &ticker : tickers) {
+    if(ticker.size() > 8) {
+      throw std::invalid_argument("Ticker " + ticker + " is longer than 8 characters.");
+    }
+    // Tickers are space padded in the feed.
+    char padded[8];
+    memset(padded, ' ', sizeof(padded));
+    memcpy(padded, ticker.data(), ticker.size());
+    uint64_t key;
+    memcpy(&key, padded, sizeof(key));
+    keys.push_back(key);
+  }
+  std::sort(keys.begin(), keys.end());
+  keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+
+  size_t bucketCount = powerOfTwoAtLeast(keys.size() / TICKERS_PER_BUCKET, 2);
+  bucketShift = 64 - __builtin_ctzll(bucketCount);
+  std::vector<std::vector<uint64_t>> buckets(bucketCount);
+  for(uint64_t key : keys) {
+    buckets[bucket(key)].push_back(key);
+  }
+  // Place the fullest buckets first, while the table is emptiest.
+  std::vector<size_t> order(bucketCount);
+  for(size_t i = 0; i < bucketCount; i++) {
+    order[i] = i;
+  }
+  std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+    return buckets[a].size() > buckets[b].size();
+  });
+
+  uint64_t state = 0;
+  std::vector<size_t> placed;
+  for(size_t size = powerOfTwoAtLeast(keys.size() * SLOTS_PER_TICKER, MIN_SLOTS);; size *= 2) {
+    slotShift = 64 - __builtin_ctzll(size);
+    slots.assign(size, 0);
+    occupied.assign((size + 63) / 64, 0);
+    seeds.assign(bucketCount, 0);
+    bool perfect = true;
+    for(size_t b : order) {
+      bool fits = false;
+      for(int attempt = 0; attempt < TRIES_PER_BUCKET && !fits; attempt++) {
+        uint64_t seed = nextSeed(state);
+        placed.clear();
+        fits = true;
+        for(uint64_t key : buckets[b]) {
+          size_t i = slot(key, seed);
+          if(occupied[i / 64] >> (i % 64) & 1) {
+            fits = false;
+            break;
+          }
+          slots[i] = key;
+          occupied[i / 64] |= 1ull << (i % 64);
+          placed.push_back(i);
+        }
+        if(fits) {
+          seeds[b] = seed;
+        } else {
+          for(size_t i : placed) {
+            slots[i] = 0;
+            occupied[i / 64] &= ~(1ull << (i % 64));
+          }
+        }
+      }
+      if(!fits) {
+        perfect = false;
+        break;
+      }
+    }
+    if(perfect) {
+      return;
+    }
+  }
+}
+
+RefBitmap::Page* RefBitmap::page(uint64_t pageNo, bool create) {
+  if(lastPage && pageNo == lastPageNo) {
+    return lastPage;
+  }
+  auto entry = pages.find(pageNo);
+  if(entry == pages.end()) {
+    if(!create) {
+      return nullptr;
+    }
+    entry = pages.emplace(pageNo, std::unique_ptr<Page>(new Page())).first;
+  }
+  lastPageNo = pageNo;
+  lastPage = entry->second.get();
+  return lastPage;
+}
+
+void RefBitmap::insert(uint64_t orderRef) {
+  Page* refs = page(orderRef >> PAGE_BITS, true);
+  size_t offset = orderRef & ((size_t(1) << PAGE_BITS) - 1);
+  uint64_t bit = 1ull << (offset % 64);
+  if(!(refs->bits[offset / 64] & bit)) {
+    refs->bits[offset / 64] |= bit;
+    refs->count++;
+  }
+}
+
+void RefBitmap::erase(uint64_t orderRef) {
+  uint64_t pageNo = orderRef >> PAGE_BITS;
+  Page* refs = page(pageNo, false);
+  if(!refs) {
+    return;
+  }
+  size_t offset = orderRef & ((size_t(1) << PAGE_BITS) - 1);
+  uint64_t bit = 1ull << (offset % 64);
+  if(!(refs->bits[offset / 64] & bit)) {
+    return;
+  }
+  refs->bits[offset / 64] &= ~bit;
+  if(--refs->count == 0) {
+    lastPage = nullptr;
+    pages.erase(pageNo);
+  }
+}
+
+bool RefBitmap::contains(uint64_t orderRef) {
+  Page* refs = page(orderRef >> PAGE_BITS, false);
+  if(!refs) {
+    return false;
+  }
+  size_t offset = orderRef & ((size_t(1) << PAGE_BITS) - 1);
+  return refs->bits[offset / 64] >> (offset % 64) & 1;
+}
@@ -0,0 +1,77 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Fixed set of subscribed tickers, looked up by the 8 ticker bytes of an
+// Add Order read as one integer. The set is built once into a perfect
+// hash, by hash and displace: tickers are grouped into buckets, and each
+// bucket is given a seed under which its tickers land in free slots of
+// their own. A lookup is then two multiplies, three loads and two
+// compares, with the table about twice the number of tickers.
+class SubscriptionSet {
+  std::vector<uint64_t> slots;
+  // Bit per slot holding a ticker, as any 8 bytes, even all nul, can be
+  // read from the feed.
+  std::vector<uint64_t> occupied;
+  // Indexed by bucket.
+  std::vector<uint64_t> seeds;
+  // Right shifts taking a product down to a bucket or slot index.
+  int bucketShift;
+  int slotShift;
+
+  size_t bucket(uint64_t ticker) const {
+    return (ticker * 0x9E3779B97F4A7C15ULL) >> bucketShift;
+  }
+  size_t slot(uint64_t ticker, uint64_t seed) const {
+    return ((ticker ^ seed) * 0xC2B2AE3D27D4EB4FULL) >> slotShift;
+  }
+
+  public:
+    // tickers - up to 8 characters each, as they appear in the feed
+    // without the space padding. Throws std::invalid_argument for a longer
+    // one.
+    explicit SubscriptionSet(const std::vector<std::string> &tickers);
+
+    // Whether the space padded ticker, read from the feed as one integer,
+    // is subscribed.
+    bool contains(uint64_t ticker) const {
+      size_t i = slot(ticker, seeds[bucket(ticker)]);
+      return slots[i] == ticker && (occupied[i / 64] >> (i % 64) & 1);
+    }
+    size_t capacity() const { return slots.size(); }
+};
+
+// Set of order refs, one bit each, for the refs of orders that were never
+// kept. Refs are bucketed into pages of consecutive refs, so the dense,
+// mostly increasing refs of a feed cost about a bit per order, and a page
+// is freed once its last ref is erased.
+class RefBitmap {
+  static const int PAGE_BITS = 16;
+  static const size_t PAGE_WORDS = (size_t(1) << PAGE_BITS) / 64;
+
+  struct Page {
+    uint64_t bits[PAGE_WORDS];
+    // Refs set.
+    size_t count;
+  };
+  std::unordered_map<uint64_t, std::unique_ptr<Page>> pages;
+  // The page last touched, as refs tend to cluster.
+  uint64_t lastPageNo;
+  Page* lastPage;
+
+  Page* page(uint64_t pageNo, bool create);
+
+  public:
+    RefBitmap() : lastPageNo(0), lastPage(nullptr) {}
+
+    void insert(uint64_t orderRef);
+    void erase(uint64_t orderRef);
+    bool contains(uint64_t orderRef);
+    // Pages allocated, each about 8KB.
+    size_t pageCount() const { return pages.size(); }
+};
@@ -0,0 +1,31 @@
+#include "SymbolTable.h"
+
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+
+symbol_id_t SymbolTable::intern(const ticker_t ticker) {
+  uint64_t key;
+  memcpy(&key, ticker, sizeof(key));
+
+  auto entry = ids.find(key);
+  if(entry != ids.end()) {
+    return entry->second;
+  }
+
+  if(tickers.size() > std::numeric_limits<symbol_id_t>::max()) {
+    throw std::runtime_error("Too many distinct tickers.");
+  }
+  symbol_id_t symbol = tickers.size();
+  tickers.emplace_back();
+  memcpy(tickers.back().chars, ticker, sizeof(ticker_t));
+  ids[key] = symbol;
+  return symbol;
+}
+
+int SymbolTable::find(const ticker_t ticker) const {
+  uint64_t key;
+  memcpy(&key, ticker, sizeof(key));
+  auto entry = ids.find(key);
+  return entry == ids.end() ? -1 : entry->second;
+}
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <unordered_map>
+#include <vector>
+
+typedef char ticker_t[8];
+
+// Compact id of an interned ticker.
+typedef uint16_t symbol_id_t;
+
+// Interns tickers into dense ids as they are first seen, so pending
+// orders can refer to their ticker by id instead of holding a copy.
+class SymbolTable {
+  struct Ticker {
+    ticker_t chars;
+  };
+
+  // Tickers by id.
+  std::vector<Ticker> tickers;
+  // Ids by the 8 ticker characters read as one integer.
+  std::unordered_map<uint64_t, symbol_id_t> ids;
+
+  public:
+    // Returns the id of the ticker, assigning the next free id if unseen.
+    symbol_id_t intern(const ticker_t ticker);
+    // Id of the ticker, or -1 if it was never interned.
+    int find(const ticker_t ticker) const;
+    // Ticker characters of an id returned by #intern.
+    const char* ticker(symbol_id_t symbol) const { return tickers[symbol].chars; }
+    size_t size() const { return tickers.size(); }
+};
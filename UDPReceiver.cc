@@ -0,0 +1,205 @@
+#include "UDPReceiver.h"
+#include "MessageLayout.h"
+
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <system_error>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/time.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifndef SO_RXQ_OVFL
+#define SO_RXQ_OVFL 40
+#endif
+
+// Room for a timestamp and a drop counter per datagram.
+static const size_t CONTROL_SIZE =
+    CMSG_SPACE(sizeof(struct timespec)) + CMSG_SPACE(sizeof(uint32_t));
+
+static in_addr parseAddress(const std::string &address) {
+  in_addr addr;
+  if(inet_pton(AF_INET, address.c_str(), &addr) != 1) {
+    throw std::invalid_argument("Invalid IPv4 address " + address);
+  }
+  return addr;
+}
+
+static void setOption(int fd, int level, int name, const void *value, socklen_t len,
+    const char *what) {
+  if(setsockopt(fd, level, name, value, len) == -1) {
+    throw std::runtime_error(std::string("Couldn't set ") + what + ": " + strerror(errno));
+  }
+}
+
+UDPReceiver::UDPReceiver(const ReceiverConfig &config)
+    : fd(-1),
+      busyPoll(config.busyPoll),
+      maxPacketSize(config.maxPacketSize),
+      receivedPackets(0),
+      truncatedPackets(0),
+      malformedPackets(0),
+      kernelDrops(0),
+      lastReceiveNanos(0) {
+  if(config.batchSize == 0 || config.maxPacketSize == 0) {
+    throw std::invalid_argument("Receiver batch and packet sizes must be non-zero.");
+  }
+  in_addr address = parseAddress(config.address);
+  in_addr interfaceAddress = parseAddress(config.interfaceAddress);
+
+  fd = socket(AF_INET, SOCK_DGRAM, 0);
+  if(fd == -1) {
+    throw std::runtime_error(std::string("Couldn't create socket: ") + strerror(errno));
+  }
+  try {
+    int on = 1;
+    setOption(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on), "SO_REUSEADDR");
+    setOption(fd, SOL_SOCKET, SO_TIMESTAMPNS, &on, sizeof(on), "SO_TIMESTAMPNS");
+    setOption(fd, SOL_SOCKET, SO_RXQ_OVFL, &on, sizeof(on), "SO_RXQ_OVFL");
+    setOption(fd, SOL_SOCKET, SO_RCVBUF, &config.receiveBufferBytes,
+        sizeof(config.receiveBufferBytes), "SO_RCVBUF");
+    if(config.busyPollMicros > 0) {
+      setOption(fd, SOL_SOCKET, SO_BUSY_POLL, &config.busyPollMicros,
+          sizeof(config.busyPollMicros), "SO_BUSY_POLL");
+    }
+    if(!busyPoll) {
+      struct timeval timeout;
+      timeout.tv_sec = config.timeoutMicros / 1000000;
+      timeout.tv_usec = config.timeoutMicros % 1000000;
+      setOption(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout), "SO_RCVTIMEO");
+    }
+
+    sockaddr_in local = {};
+    local.sin_family = AF_INET;
+    local.sin_port = htons(config.port);
+    local.sin_addr = address;
+    if(bind(fd, reinterpret_cast<sockaddr*>(&local), sizeof(local)) == -1) {
+      throw std::runtime_error(std::string("Couldn't bind: ") + strerror(errno));
+    }
+    socklen_t localLen = sizeof(local);
+    getsockname(fd, reinterpret_cast<sockaddr*>(&local), &localLen);
+    port = ntohs(local.sin_port);
+
+    if(IN_MULTICAST(ntohl(address.s_addr))) {
+      ip_mreq membership;
+      membership.imr_multiaddr = address;
+      membership.imr_interface = interfaceAddress;
+      setOption(fd, IPPROTO_IP, IP_ADD_MEMBERSHIP, &membership, sizeof(membership),
+          "IP_ADD_MEMBERSHIP");
+    }
+
+    // What the kernel granted, after capping and its own overhead.
+    socklen_t len = sizeof(receiveBufferBytes);
+    getsockopt(fd, SOL_SOCKET, SO_RCVBUF, &receiveBufferBytes, &len);
+  } catch(...) {
+    close(fd);
+    throw;
+  }
+
+  size_t batchSize = config.batchSize;
+  buffers.resize(batchSize * maxPacketSize);
+  controls.resize(batchSize * CONTROL_SIZE);
+  iovecs.resize(batchSize);
+  headers.resize(batchSize);
+  packets.resize(batchSize);
+  for(size_t i = 0; i < batchSize; i++) {
+    iovecs[i].iov_base = &buffers[i * maxPacketSize];
+    iovecs[i].iov_len = maxPacketSize;
+  }
+}
+
+UDPReceiver::~UDPReceiver() {
+  close(fd);
+}
+
+size_t UDPReceiver::receive(Parser &parser) {
+  // recvmmsg overwrites lengths, so the headers are reset each call.
+  for(size_t i = 0; i < headers.size(); i++) {
+    msghdr &header = headers[i].msg_hdr;
+    memset(&header, 0, sizeof(header));
+    header.msg_iov = &iovecs[i];
+    header.msg_iovlen = 1;
+    header.msg_control = &controls[i * CONTROL_SIZE];
+    header.msg_controllen = CONTROL_SIZE;
+  }
+
+  int flags = busyPoll ? MSG_DONTWAIT : MSG_WAITFORONE;
+  int count;
+  do {
+    count = recvmmsg(fd, headers.data(), headers.size(), flags, nullptr);
+  } while(count == -1 && errno == EINTR);
+  if(count == -1) {
+    if(errno == EAGAIN || errno == EWOULDBLOCK) {
+      parser.poll();
+      return 0;
+    }
+    throw std::system_error(errno, std::generic_category(), "recvmmsg failed");
+  }
+
+  size_t accepted = 0;
+  for(int i = 0; i < count; i++) {
+    msghdr &header = headers[i].msg_hdr;
+    for(cmsghdr *c = CMSG_FIRSTHDR(&header); c != nullptr; c = CMSG_NXTHDR(&header, c)) {
+      if(c->cmsg_level != SOL_SOCKET) {
+        continue;
+      }
+      if(c->cmsg_type == SO_TIMESTAMPNS) {
+        struct timespec ts;
+        memcpy(&ts, CMSG_DATA(c), sizeof(ts));
+        lastReceiveNanos = (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+      } else if(c->cmsg_type == SO_RXQ_OVFL) {
+        // A running total for the socket.
+        uint32_t drops;
+        memcpy(&drops, CMSG_DATA(c), sizeof(drops));
+        kernelDrops = drops;
+      }
+    }
+    if(header.msg_flags & MSG_TRUNC) {
+      truncatedPackets++;
+      continue;
+    }
+    const char* buf = static_cast<const char*>(iovecs[i].iov_base);
+    size_t len = headers[i].msg_len;
+    if(len < PacketHeaderLayout::SIZE || readField<PacketHeaderLayout::length>(buf) != len) {
+      malformedPackets++;
+      continue;
+    }
+    packets[accepted].buf = buf;
+    packets[accepted].len = len;
+    accepted++;
+  }
+  receivedPackets += count;
+  parser.onUDPPackets(packets.data(), accepted);
+  return count;
+}
+
+uint16_t UDPReceiver::getPort() const {
+  return port;
+}
+
+int UDPReceiver::getReceiveBufferBytes() const {
+  return receiveBufferBytes;
+}
+
+uint64_t UDPReceiver::getReceivedPackets() const {
+  return receivedPackets;
+}
+
+uint64_t UDPReceiver::getTruncatedPackets() const {
+  return truncatedPackets;
+}
+
+uint64_t UDPReceiver::getMalformedPackets() const {
+  return malformedPackets;
+}
+
+uint64_t UDPReceiver::getKernelDrops() const {
+  return kernelDrops;
+}
+
+uint64_t UDPReceiver::getLastReceiveNanos() const {
+  return lastReceiveNanos;
+}
@@ -0,0 +1,90 @@
+#pragma once
+
+#include "Parser.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include <sys/socket.h>
+
+struct ReceiverConfig {
+  // Multicast group to join, or a unicast address to bind to.
+  std::string address = "239.1.1.1";
+  // 0 binds an ephemeral port, see UDPReceiver#getPort.
+  uint16_t port = 0;
+  // Local interface address the group is joined on.
+  std::string interfaceAddress = "0.0.0.0";
+  // Requested kernel receive buffer; the kernel caps it at rmem_max.
+  int receiveBufferBytes = 8 << 20;
+  // Datagrams fetched per recvmmsg call.
+  size_t batchSize = 64;
+  // Datagrams longer than this are truncated by the kernel and dropped.
+  size_t maxPacketSize = 2048;
+  // Poll without blocking, for callers spinning on #receive.
+  bool busyPoll = false;
+  // If non-zero, SO_BUSY_POLL microseconds for the kernel to spin on the
+  // device queue in a blocking receive.
+  int busyPollMicros = 0;
+  // How long a blocking #receive waits for the first datagram.
+  int timeoutMicros = 100000;
+};
+
+// Receives the feed from a UDP socket and hands it to a Parser, a batch of
+// datagrams per recvmmsg call. The kernel stamps each datagram's arrival
+// (SO_TIMESTAMPNS) and reports datagrams it dropped for lack of receive
+// buffer (SO_RXQ_OVFL).
+//
+// Throws std::runtime_error if the socket can't be set up.
+class UDPReceiver {
+  int fd;
+  uint16_t port;
+  int receiveBufferBytes;
+  bool busyPoll;
+  size_t maxPacketSize;
+
+  // One slot per datagram in a batch.
+  std::vector<char> buffers;
+  std::vector<char> controls;
+  std::vector<struct iovec> iovecs;
+  std::vector<struct mmsghdr> headers;
+  std::vector<UDPPacket> packets;
+
+  uint64_t receivedPackets;
+  uint64_t truncatedPackets;
+  uint64_t malformedPackets;
+  uint64_t kernelDrops;
+  uint64_t lastReceiveNanos;
+
+  public:
+    explicit UDPReceiver(const ReceiverConfig &config);
+    ~UDPReceiver();
+
+    UDPReceiver(const UDPReceiver&) = delete;
+    UDPReceiver& operator=(const UDPReceiver&) = delete;
+
+    // Receives up to a batch of datagrams into parser, returning how many.
+    // Datagrams whose packet header doesn't match their length are
+    // skipped, one at a time, rather than handed to the parser. Throws
+    // std::system_error if receiving fails, and rethrows what the parser
+    // throws once it has the whole batch.
+    // Returns 0, after giving the parser a Parser#poll, if none arrived
+    // within the timeout, or immediately when busy polling.
+    size_t receive(Parser &parser);
+
+    uint16_t getPort() const;
+    // Receive buffer the kernel actually granted.
+    int getReceiveBufferBytes() const;
+    uint64_t getReceivedPackets() const;
+    // Datagrams longer than maxPacketSize, dropped.
+    uint64_t getTruncatedPackets() const;
+    // Datagrams too short for a packet header, or whose header's length
+    // isn't the datagram's, dropped.
+    uint64_t getMalformedPackets() const;
+    // Datagrams the kernel dropped because the receive buffer was full.
+    uint64_t getKernelDrops() const;
+    // Kernel receive time, in nanoseconds since the epoch, of the latest
+    // datagram.
+    uint64_t getLastReceiveNanos() const;
+};
@@ -0,0 +1,131 @@
+#include "UringFile.h"
+
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+static int uringSetup(unsigned entries, io_uring_params* params) {
+  return (int) syscall(__NR_io_uring_setup, entries, params);
+}
+
+static int uringEnter(int fd, unsigned toSubmit, unsigned minComplete, unsigned flags) {
+  return (int) syscall(__NR_io_uring_enter, fd, toSubmit, minComplete, flags, nullptr, 0);
+}
+
+static int uringRegister(int fd, unsigned opcode, const void* arg, unsigned count) {
+  return (int) syscall(__NR_io_uring_register, fd, opcode, arg, count);
+}
+
+static unsigned* field(void* ring, uint32_t offset) {
+  return reinterpret_cast<unsigned*>(static_cast<char*>(ring) + offset);
+}
+
+UringFile::UringFile(int fileFd, const std::vector<struct iovec> &buffers)
+    : fileFd(fileFd), registered(false),
+      sqRing(MAP_FAILED), cqRing(MAP_FAILED), sqes(nullptr), inFlight(0) {
+  // One write per buffer at most, so that many entries never overflow.
+  io_uring_params params;
+  memset(&params, 0, sizeof(params));
+  ringFd = uringSetup(buffers.size(), &params);
+  if(ringFd == -1) {
+    throw std::runtime_error(std::string("io_uring_setup failed: ") + strerror(errno));
+  }
+
+  sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+  cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+  sqesSize = params.sq_entries * sizeof(io_uring_sqe);
+  sqRing = mmap(nullptr, sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+      ringFd, IORING_OFF_SQ_RING);
+  cqRing = mmap(nullptr, cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+      ringFd, IORING_OFF_CQ_RING);
+  void* mappedSqes = mmap(nullptr, sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+      ringFd, IORING_OFF_SQES);
+  if(sqRing == MAP_FAILED || cqRing == MAP_FAILED || mappedSqes == MAP_FAILED) {
+    int error = errno;
+    if(mappedSqes != MAP_FAILED) {
+      munmap(mappedSqes, sqesSize);
+    }
+    unmap();
+    close(ringFd);
+    throw std::runtime_error(std::string("io_uring mmap failed: ") + strerror(error));
+  }
+  sqes = static_cast<io_uring_sqe*>(mappedSqes);
+
+  sqHead = field(sqRing, params.sq_off.head);
+  sqTail = field(sqRing, params.sq_off.tail);
+  sqMask = *field(sqRing, params.sq_off.ring_mask);
+  sqArray = field(sqRing, params.sq_off.array);
+  cqHead = field(cqRing, params.cq_off.head);
+  cqTail = field(cqRing, params.cq_off.tail);
+  cqMask = *field(cqRing, params.cq_off.ring_mask);
+  cqes = reinterpret_cast<io_uring_cqe*>(static_cast<char*>(cqRing) + params.cq_off.cqes);
+
+  // Registration pins the buffers, which RLIMIT_MEMLOCK may not allow;
+  // plain writes work without it.
+  registered = uringRegister(ringFd, IORING_REGISTER_BUFFERS,
+      buffers.data(), buffers.size()) == 0;
+}
+
+UringFile::~UringFile() {
+  unmap();
+  close(ringFd);
+}
+
+void UringFile::unmap() {
+  if(sqes != nullptr) {
+    munmap(sqes, sqesSize);
+  }
+  if(cqRing != MAP_FAILED) {
+    munmap(cqRing, cqRingSize);
+  }
+  if(sqRing != MAP_FAILED) {
+    munmap(sqRing, sqRingSize);
+  }
+}
+
+void UringFile::write(size_t index, const char* buf, size_t len, uint64_t offset) {
+  unsigned tail = *sqTail;
+  unsigned slot = tail & sqMask;
+  io_uring_sqe &sqe = sqes[slot];
+  memset(&sqe, 0, sizeof(sqe));
+  sqe.opcode = registered ? IORING_OP_WRITE_FIXED : IORING_OP_WRITE;
+  sqe.fd = fileFd;
+  sqe.addr = reinterpret_cast<uint64_t>(buf);
+  sqe.len = len;
+  sqe.off = offset;
+  sqe.buf_index = index;
+  sqe.user_data = index;
+  sqArray[slot] = slot;
+  // The kernel must see the entry before the new tail.
+  __atomic_store_n(sqTail, tail + 1, __ATOMIC_RELEASE);
+
+  int submitted;
+  do {
+    submitted = uringEnter(ringFd, 1, 0, 0);
+  } while(submitted == -1 && errno == EINTR);
+  if(submitted != 1) {
+    throw std::runtime_error(std::string("io_uring_enter failed: ") + strerror(errno));
+  }
+  inFlight++;
+}
+
+int UringFile::wait(size_t* index) {
+  unsigned head = *cqHead;
+  while(head == __atomic_load_n(cqTail, __ATOMIC_ACQUIRE)) {
+    if(uringEnter(ringFd, 0, 1, IORING_ENTER_GETEVENTS) == -1 && errno != EINTR) {
+      throw std::runtime_error(std::string("io_uring_enter failed: ") + strerror(errno));
+    }
+  }
+  io_uring_cqe &cqe = cqes[head & cqMask];
+  *index = cqe.user_data;
+  int res = cqe.res;
+  __atomic_store_n(cqHead, head + 1, __ATOMIC_RELEASE);
+  inFlight--;
+  return res;
+}
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include <sys/uio.h>
+
+struct io_uring_sqe;
+struct io_uring_cqe;
+
+// Queues writes to one file through io_uring, using the raw syscalls so
+// there is no liburing dependency. Writes are submitted as they are
+// queued and complete in the background; #wait reaps them.
+//
+// The buffers given at construction are registered with the kernel when
+// it allows, sparing it from mapping their pages on every write.
+class UringFile {
+  int ringFd;
+  int fileFd;
+  bool registered;
+
+  void* sqRing;
+  size_t sqRingSize;
+  void* cqRing;
+  size_t cqRingSize;
+  io_uring_sqe* sqes;
+  size_t sqesSize;
+
+  unsigned* sqHead;
+  unsigned* sqTail;
+  unsigned sqMask;
+  unsigned* sqArray;
+  unsigned* cqHead;
+  unsigned* cqTail;
+  unsigned cqMask;
+  io_uring_cqe* cqes;
+
+  unsigned inFlight;
+
+  void unmap();
+
+  public:
+    // Throws std::runtime_error if io_uring is unavailable.
+    UringFile(int fileFd, const std::vector<struct iovec> &buffers);
+    ~UringFile();
+
+    UringFile(const UringFile&) = delete;
+    UringFile& operator=(const UringFile&) = delete;
+
+    // Submits a write of len bytes, from within buffers[index], at the
+    // file offset. At most one write per buffer may be in flight.
+    void write(size_t index, const char* buf, size_t len, uint64_t offset);
+    // Blocks for a write to complete, setting the index of its buffer.
+    // Returns the bytes written, or -errno.
+    int wait(size_t* index);
+    // Writes submitted and not yet reaped.
+    unsigned pending() const { return inFlight; }
+};
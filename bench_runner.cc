@@ -0,0 +1,484 @@
+#include "Parser.h"
+#include "ShardedParser.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <ctime>
+#include <memory>
+#include <random>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+
+// Adapters giving std::unordered_map and OrderTable a common interface.
+struct StdOrderMap {
+  std::unordered_map<uint64_t, PendingOrder_t> orders;
+
+  explicit StdOrderMap(size_t expectedOrders) { orders.reserve(expectedOrders); }
+  void insert(uint64_t ref, const PendingOrder_t &order) { orders[ref] = order; }
+  PendingOrder_t* find(uint64_t ref) {
+    auto entry = orders.find(ref);
+    return entry == orders.end() ? nullptr : &entry->second;
+  }
+  void erase(uint64_t ref) { orders.erase(ref); }
+};
+
+struct FlatOrderTable {
+  OrderTable orders;
+
+  explicit FlatOrderTable(size_t expectedOrders) : orders(expectedOrders) {}
+  void insert(uint64_t ref, const PendingOrder_t &order) { orders.insert(ref, order); }
+  PendingOrder_t* find(uint64_t ref) { return orders.find(ref); }
+  void erase(uint64_t ref) { orders.erase(ref); }
+};
+
+// Exchanges hand out order refs sequentially; some feeds scramble them.
+enum RefDistribution { SEQUENTIAL, RANDOM };
+
+std::vector<uint64_t> makeRefs(size_t n, RefDistribution distribution) {
+  std::vector<uint64_t> refs(n);
+  std::mt19937_64 rng(1);
+  for (size_t i = 0; i < n; i++) {
+    refs[i] = distribution == SEQUENTIAL ? i + 1 : rng();
+  }
+  return refs;
+}
+
+template <class Table, RefDistribution distribution>
+void BM_OrderInsert(benchmark::State &state) {
+  std::vector<uint64_t> refs = makeRefs(state.range(0), distribution);
+  for (auto _ : state) {
+    Table table(0);
+    for (uint64_t ref : refs) {
+      table.insert(ref, {1.0, 100, 0, 'B'});
+    }
+    benchmark::DoNotOptimize(table.find(refs[0]));
+  }
+  state.SetItemsProcessed(state.iterations() * refs.size());
+}
+
+template <class Table, RefDistribution distribution>
+void BM_OrderLookup(benchmark::State &state) {
+  std::vector<uint64_t> refs = makeRefs(state.range(0), distribution);
+  Table table(refs.size());
+  for (uint64_t ref : refs) {
+    table.insert(ref, {1.0, 100, 0, 'B'});
+  }
+  // Executes and cancels hit live orders in no particular order.
+  std::vector<uint64_t> lookups = refs;
+  std::shuffle(lookups.begin(), lookups.end(), std::mt19937_64(2));
+  for (auto _ : state) {
+    for (uint64_t ref : lookups) {
+      benchmark::DoNotOptimize(table.find(ref)->sizeRemaining);
+    }
+  }
+  state.SetItemsProcessed(state.iterations() * lookups.size());
+}
+
+// Steady state of a trading day: a fixed number of live orders, where each
+// step adds a new order, touches a live one and retires an old one.
+template <class Table, RefDistribution distribution>
+void BM_OrderChurn(benchmark::State &state) {
+  size_t live = state.range(0);
+  std::vector<uint64_t> refs = makeRefs(live * 4, distribution);
+  std::mt19937_64 rng(3);
+  for (auto _ : state) {
+    state.PauseTiming();
+    Table table(live);
+    for (size_t i = 0; i < live; i++) {
+      table.insert(refs[i], {1.0, 100, 0, 'B'});
+    }
+    state.ResumeTiming();
+    for (size_t i = live; i < refs.size(); i++) {
+      table.insert(refs[i], {1.0, 100, 0, 'B'});
+      benchmark::DoNotOptimize(table.find(refs[i - 1 - rng() % live]));
+      table.erase(refs[i - live]);
+    }
+  }
+  state.SetItemsProcessed(state.iterations() * (refs.size() - live));
+}
+
+#define ORDER_TABLE_BENCHMARKS(bm) \
+  BENCHMARK_TEMPLATE(bm, StdOrderMap, SEQUENTIAL)->Range(1 << 10, 1 << 20); \
+  BENCHMARK_TEMPLATE(bm, FlatOrderTable, SEQUENTIAL)->Range(1 << 10, 1 << 20); \
+  BENCHMARK_TEMPLATE(bm, StdOrderMap, RANDOM)->Range(1 << 10, 1 << 20); \
+  BENCHMARK_TEMPLATE(bm, FlatOrderTable, RANDOM)->Range(1 << 10, 1 << 20)
+
+ORDER_TABLE_BENCHMARKS(BM_OrderInsert);
+ORDER_TABLE_BENCHMARKS(BM_OrderLookup);
+ORDER_TABLE_BENCHMARKS(BM_OrderChurn);
+
+// Per-call latencies, in log-linear buckets: 16 linear sub-buckets per
+// power of two, so percentiles are within ~6% of the recorded value.
+class LatencyHistogram {
+  static const int SUB_BUCKETS = 16;
+  std::vector<uint64_t> buckets = std::vector<uint64_t>(64 * SUB_BUCKETS);
+  uint64_t count = 0;
+
+  static size_t bucket(uint64_t nanos) {
+    if (nanos < SUB_BUCKETS) {
+      return nanos;
+    }
+    int exponent = 63 - __builtin_clzll(nanos);
+    uint64_t mantissa = (nanos >> (exponent - 4)) & (SUB_BUCKETS - 1);
+    return (exponent - 3) * SUB_BUCKETS + mantissa;
+  }
+  static uint64_t lowerBound(size_t i) {
+    if (i < SUB_BUCKETS) {
+      return i;
+    }
+    int exponent = i / SUB_BUCKETS + 3;
+    return ((uint64_t) SUB_BUCKETS + i % SUB_BUCKETS) << (exponent - 4);
+  }
+
+  public:
+    void record(uint64_t nanos) {
+      buckets[bucket(nanos)]++;
+      count++;
+    }
+    uint64_t percentile(double p) const {
+      uint64_t rank = count * p / 100;
+      uint64_t seen = 0;
+      for (size_t i = 0; i < buckets.size(); i++) {
+        seen += buckets[i];
+        if (seen > rank) {
+          return lowerBound(i);
+        }
+      }
+      return 0;
+    }
+    // Adds per-packet latency percentiles, and message throughput, to the
+    // benchmark output.
+    void report(benchmark::State &state, uint64_t messages) const {
+      state.counters["packet_p50_ns"] = percentile(50);
+      state.counters["packet_p99_ns"] = percentile(99);
+      state.counters["packet_p99.9_ns"] = percentile(99.9);
+      state.counters["msgs_per_second"] = benchmark::Counter(
+          messages, benchmark::Counter::kIsRate);
+      state.counters["time_per_msg"] = benchmark::Counter(
+          messages, benchmark::Counter::kIsRate | benchmark::Counter::kInvert);
+    }
+};
+
+uint64_t nowNanos() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return 1000000000 * (uint64_t) ts.tv_sec + ts.tv_nsec;
+}
+
+// Input message encoders, big endian as on the wire.
+std::string bigEndian(uint64_t value, int n) {
+  std::string bytes;
+  for (int i = n - 1; i >= 0; i--) {
+    bytes.push_back((char)(value >> (8 * i)));
+  }
+  return bytes;
+}
+
+const uint64_t OPEN_NANOS = 34200000000000ULL;
+
+std::string addMessage(uint64_t orderRef) {
+  return "A" + bigEndian(OPEN_NANOS + orderRef, 8) + bigEndian(orderRef, 8) + "B" +
+      bigEndian(100, 4) + "SPY     " + bigEndian(2000000, 4);
+}
+
+std::string executeMessage(uint64_t orderRef, uint32_t size) {
+  return "E" + bigEndian(OPEN_NANOS + orderRef, 8) + bigEndian(orderRef, 8) + bigEndian(size, 4);
+}
+
+std::string cancelMessage(uint64_t orderRef, uint32_t size) {
+  return "X" + bigEndian(OPEN_NANOS + orderRef, 8) + bigEndian(orderRef, 8) + bigEndian(size, 4);
+}
+
+std::string replaceMessage(uint64_t orderRef, uint64_t newOrderRef) {
+  return "R" + bigEndian(OPEN_NANOS + orderRef, 8) + bigEndian(orderRef, 8) +
+      bigEndian(newOrderRef, 8) + bigEndian(100, 4) + bigEndian(2000100, 4);
+}
+
+// Packs messages into packets of messagesPerPacket, numbered from firstSeq.
+std::vector<std::string> makePackets(const std::vector<std::string> &messages,
+    size_t messagesPerPacket, uint32_t firstSeq = 1) {
+  std::vector<std::string> packets;
+  for (size_t i = 0; i < messages.size(); i += messagesPerPacket) {
+    std::string payload;
+    for (size_t j = i; j < std::min(i + messagesPerPacket, messages.size()); j++) {
+      payload += messages[j];
+    }
+    uint32_t seq = firstSeq + packets.size();
+    packets.push_back(bigEndian(6 + payload.size(), 2) + bigEndian(seq, 4) + payload);
+  }
+  return packets;
+}
+
+std::vector<UDPPacket> describe(const std::vector<std::string> &packets) {
+  std::vector<UDPPacket> descriptors;
+  for (const std::string &packet : packets) {
+    descriptors.push_back({packet.data(), packet.size()});
+  }
+  return descriptors;
+}
+
+// Orders 1..n, each added then fully executed.
+std::vector<std::string> makeAddExecuteMessages(size_t n) {
+  std::vector<std::string> messages;
+  for (uint64_t ref = 1; ref <= n; ref++) {
+    messages.push_back(addMessage(ref));
+    messages.push_back(executeMessage(ref, 100));
+  }
+  return messages;
+}
+
+const size_t STREAM_ORDERS = 1 << 14;
+const size_t MESSAGES_PER_PACKET = 16;
+
+// Packets handed to the parser one at a time, in sequence.
+void BM_InSequence(benchmark::State &state) {
+  std::vector<std::string> messages = makeAddExecuteMessages(STREAM_ORDERS);
+  std::vector<std::string> packets = makePackets(messages, MESSAGES_PER_PACKET);
+
+  ParserConfig config;
+  config.retirePolicy = RETIRE_IMMEDIATELY;
+  LatencyHistogram latencies;
+  for (auto _ : state) {
+    state.PauseTiming();
+    std::unique_ptr<Parser> parser(new Parser(20180612, "/dev/null", config));
+    state.ResumeTiming();
+    for (const std::string &packet : packets) {
+      uint64_t start = nowNanos();
+      parser->onUDPPacket(packet.data(), packet.size());
+      latencies.record(nowNanos() - start);
+    }
+    parser->flush();
+    state.PauseTiming();
+    parser.reset();
+    state.ResumeTiming();
+  }
+  latencies.report(state, state.iterations() * messages.size());
+}
+BENCHMARK(BM_InSequence);
+
+// The same stream through a ShardedParser with state.range(0) workers,
+// merged back into one output. Per-packet latency is the sequencer's.
+void BM_Sharded(benchmark::State &state) {
+  std::vector<std::string> messages = makeAddExecuteMessages(STREAM_ORDERS);
+  std::vector<std::string> packets = makePackets(messages, MESSAGES_PER_PACKET);
+
+  ParserConfig config;
+  config.retirePolicy = RETIRE_IMMEDIATELY;
+  PipelineConfig pipeline;
+  pipeline.workers = state.range(0);
+  for (auto _ : state) {
+    state.PauseTiming();
+    std::unique_ptr<ShardedParser> parser(
+        new ShardedParser(20180612, "/dev/null", config, pipeline));
+    state.ResumeTiming();
+    for (const std::string &packet : packets) {
+      parser->onUDPPacket(packet.data(), packet.size());
+    }
+    parser->flush();
+    state.PauseTiming();
+    parser.reset();
+    state.ResumeTiming();
+  }
+  state.SetItemsProcessed(state.iterations() * messages.size());
+}
+BENCHMARK(BM_Sharded)->RangeMultiplier(2)->Range(1, 8)->UseRealTime();
+
+// Packets reversed in blocks of state.range(0), so all but the last of
+// each block are stashed and then drained in one catch-up.
+void BM_Reorder(benchmark::State &state) {
+  size_t depth = state.range(0);
+  std::vector<std::string> messages = makeAddExecuteMessages(STREAM_ORDERS);
+  std::vector<std::string> packets = makePackets(messages, MESSAGES_PER_PACKET);
+  for (size_t i = 0; i < packets.size(); i += depth) {
+    std::reverse(packets.begin() + i, packets.begin() + std::min(i + depth, packets.size()));
+  }
+
+  ParserConfig config;
+  config.retirePolicy = RETIRE_IMMEDIATELY;
+  LatencyHistogram latencies;
+  for (auto _ : state) {
+    state.PauseTiming();
+    std::unique_ptr<Parser> parser(new Parser(20180612, "/dev/null", config));
+    state.ResumeTiming();
+    for (const std::string &packet : packets) {
+      uint64_t start = nowNanos();
+      parser->onUDPPacket(packet.data(), packet.size());
+      latencies.record(nowNanos() - start);
+    }
+    parser->flush();
+    state.PauseTiming();
+    parser.reset();
+    state.ResumeTiming();
+  }
+  latencies.report(state, state.iterations() * messages.size());
+}
+BENCHMARK(BM_Reorder)->RangeMultiplier(4)->Range(1, 1024);
+
+// Decode, order update and encode of a single message type. Orders the
+// measured messages refer to are added beforehand, untimed.
+enum MessageType { ADD, EXECUTE, CANCEL, REPLACE };
+
+template <MessageType type>
+void BM_MessageType(benchmark::State &state) {
+  std::vector<std::string> setup;
+  std::vector<std::string> measured;
+  for (uint64_t ref = 1; ref <= STREAM_ORDERS; ref++) {
+    if (type == ADD) {
+      measured.push_back(addMessage(ref));
+      continue;
+    }
+    setup.push_back(addMessage(ref));
+    if (type == EXECUTE) {
+      measured.push_back(executeMessage(ref, 10));
+    } else if (type == CANCEL) {
+      measured.push_back(cancelMessage(ref, 10));
+    } else {
+      measured.push_back(replaceMessage(ref, STREAM_ORDERS + ref));
+    }
+  }
+  std::vector<std::string> setupPackets = makePackets(setup, MESSAGES_PER_PACKET);
+  std::vector<std::string> packets = makePackets(measured, MESSAGES_PER_PACKET,
+      1 + setupPackets.size());
+  std::vector<UDPPacket> setupBatch = describe(setupPackets);
+
+  ParserConfig config;
+  config.expectedOrders = 2 * STREAM_ORDERS;
+  LatencyHistogram latencies;
+  for (auto _ : state) {
+    state.PauseTiming();
+    std::unique_ptr<Parser> parser(new Parser(20180612, "/dev/null", config));
+    parser->onUDPPackets(setupBatch.data(), setupBatch.size());
+    state.ResumeTiming();
+    for (const std::string &packet : packets) {
+      uint64_t start = nowNanos();
+      parser->onUDPPacket(packet.data(), packet.size());
+      latencies.record(nowNanos() - start);
+    }
+    parser->flush();
+    state.PauseTiming();
+    parser.reset();
+    state.ResumeTiming();
+  }
+  latencies.report(state, state.iterations() * measured.size());
+}
+BENCHMARK_TEMPLATE(BM_MessageType, ADD);
+BENCHMARK_TEMPLATE(BM_MessageType, EXECUTE);
+BENCHMARK_TEMPLATE(BM_MessageType, CANCEL);
+BENCHMARK_TEMPLATE(BM_MessageType, REPLACE);
+
+// Field decoding alone, portable decoders (0) against SIMD ones (1), over
+// an even mix of message types.
+void BM_Decode(benchmark::State &state) {
+  const MessageDecoders* decoders = state.range(0) ? ssse3Decoders() : &scalarDecoders();
+  if (decoders == nullptr) {
+    state.SkipWithError("CPU has no SSSE3");
+    return;
+  }
+  std::vector<std::string> messages;
+  for (uint64_t ref = 1; ref <= 1024; ref++) {
+    messages.push_back(addMessage(ref));
+    messages.push_back(executeMessage(ref, 10));
+    messages.push_back(cancelMessage(ref, 10));
+    messages.push_back(replaceMessage(ref, ref + 1024));
+  }
+  InputAddOrder add;
+  InputOrderExecuted executed;
+  InputOrderCanceled canceled;
+  InputOrderReplaced replaced;
+  for (auto _ : state) {
+    for (size_t i = 0; i < messages.size(); i += 4) {
+      decoders->addOrder(messages[i].data(), &add);
+      decoders->orderExecuted(messages[i + 1].data(), &executed);
+      decoders->orderCanceled(messages[i + 2].data(), &canceled);
+      decoders->orderReplaced(messages[i + 3].data(), &replaced);
+      benchmark::DoNotOptimize(add);
+      benchmark::DoNotOptimize(executed);
+      benchmark::DoNotOptimize(canceled);
+      benchmark::DoNotOptimize(replaced);
+    }
+  }
+  state.counters["time_per_msg"] = benchmark::Counter(
+      state.iterations() * messages.size(),
+      benchmark::Counter::kIsRate | benchmark::Counter::kInvert);
+}
+BENCHMARK(BM_Decode)->Arg(0)->Arg(1);
+
+// Order lookups among state.range(0) live orders, the cost of Execute,
+// Cancel and Replace once the working set outgrows the caches.
+void BM_LiveOrderLookup(benchmark::State &state) {
+  size_t live = state.range(0);
+  OrderTable table(live);
+  for (uint64_t ref = 1; ref <= live; ref++) {
+    table.insert(ref, {1.0, 100, 0, 'B'});
+  }
+  std::mt19937_64 rng(4);
+  std::vector<uint64_t> lookups(1 << 16);
+  for (uint64_t &ref : lookups) {
+    ref = 1 + rng() % live;
+  }
+  for (auto _ : state) {
+    for (uint64_t ref : lookups) {
+      benchmark::DoNotOptimize(table.find(ref)->sizeRemaining);
+    }
+  }
+  state.counters["lookups_per_second"] = benchmark::Counter(
+      state.iterations() * lookups.size(), benchmark::Counter::kIsRate);
+  state.counters["time_per_lookup"] = benchmark::Counter(
+      state.iterations() * lookups.size(),
+      benchmark::Counter::kIsRate | benchmark::Counter::kInvert);
+}
+
+// Packets handed to the parser state.range(0) at a time.
+void BM_PacketBatch(benchmark::State &state) {
+  size_t batchSize = state.range(0);
+  std::vector<std::string> packets = makePackets(makeAddExecuteMessages(1 << 14), 2);
+  std::vector<UDPPacket> descriptors = describe(packets);
+
+  ParserConfig config;
+  config.retirePolicy = RETIRE_IMMEDIATELY;
+  for (auto _ : state) {
+    state.PauseTiming();
+    std::unique_ptr<Parser> parser(new Parser(20180612, "/dev/null", config));
+    state.ResumeTiming();
+    for (size_t i = 0; i < descriptors.size(); i += batchSize) {
+      parser->onUDPPackets(&descriptors[i], std::min(batchSize, descriptors.size() - i));
+    }
+    parser->flush();
+    state.PauseTiming();
+    parser.reset();
+    state.ResumeTiming();
+  }
+  state.counters["packets_per_second"] = benchmark::Counter(
+      state.iterations() * descriptors.size(), benchmark::Counter::kIsRate);
+}
+BENCHMARK(BM_PacketBatch)->RangeMultiplier(2)->Range(1, 1024);
+
+// Besides the Google Benchmark flags, --max_live_orders=N raises the
+// largest live order count looked up in, e.g. to 100000000 on a machine
+// with a few GB to spare.
+int main(int argc, char **argv) {
+  size_t maxLiveOrders = 10000000;
+  std::vector<char*> args;
+  for (int i = 0; i < argc; i++) {
+    const char *flag = "--max_live_orders=";
+    if (strncmp(argv[i], flag, strlen(flag)) == 0) {
+      maxLiveOrders = strtoull(argv[i] + strlen(flag), nullptr, 10);
+    } else {
+      args.push_back(argv[i]);
+    }
+  }
+  auto lookup = benchmark::RegisterBenchmark("BM_LiveOrderLookup", BM_LiveOrderLookup);
+  for (size_t live = 1000000; live <= maxLiveOrders; live *= 10) {
+    lookup->Arg(live);
+  }
+
+  int argCount = args.size();
+  benchmark::Initialize(&argCount, args.data());
+  benchmark::RunSpecifiedBenchmarks();
+  benchmark::Shutdown();
+  return 0;
+}
@@ -0,0 +1,324 @@
+// Generates a synthetic feed in the format main.cc reads: UDP packets back
+// to back, each starting with its 2 byte big endian size and 4 byte
+// sequence number. Orders are tracked as they are generated, so every
+// Executed, Canceled and Replaced message refers to a live order.
+//
+// Usage: feed_gen [--flag=value ...] > out.in
+//
+//   --messages=N          messages to generate (default 1000000)
+//   --seed=N              random seed; same flags and seed, same bytes
+//   --mix=A:E:X:R         relative weights of message types (40:20:30:10)
+//   --live_orders=N       live orders to build up to; Adds stop beyond it
+//   --tickers=N           distinct tickers (default 500)
+//   --payload_size=N      max payload bytes per packet (default 1400)
+//   --straddle=0|1        split messages across packets to fill them (1)
+//   --reorder=P           probability a packet is delivered out of order
+//   --reorder_depth=N     max packets a reordered one is displaced by (16)
+//   --duplicate=P         probability a packet is delivered twice
+//   --loss=P              probability a packet is never delivered
+//   --output=PATH         write to PATH instead of stdout
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <random>
+#include <string>
+#include <vector>
+
+struct Options {
+  uint64_t messages = 1000000;
+  uint64_t seed = 1;
+  double mix[4] = {40, 20, 30, 10};
+  size_t liveOrders = 100000;
+  size_t tickers = 500;
+  size_t payloadSize = 1400;
+  bool straddle = true;
+  double reorder = 0;
+  size_t reorderDepth = 16;
+  double duplicate = 0;
+  double loss = 0;
+  const char* output = nullptr;
+};
+
+struct LiveOrder {
+  uint64_t orderRef;
+  uint32_t size;
+  uint32_t ticker;
+};
+
+struct Stats {
+  uint64_t messages[4] = {};
+  uint64_t packets = 0;
+  uint64_t reordered = 0;
+  uint64_t duplicated = 0;
+  uint64_t lost = 0;
+};
+
+const char MSG_TYPES[4] = {'A', 'E', 'X', 'R'};
+
+// Trading day from 09:30 to 16:00, in nanoseconds since midnight.
+const uint64_t OPEN_NANOS = 34200ULL * 1000000000;
+const uint64_t SESSION_NANOS = 23400ULL * 1000000000;
+
+void putBigEndian(std::string &out, uint64_t value, int n) {
+  for (int i = n - 1; i >= 0; i--) {
+    out.push_back((char)(value >> (8 * i)));
+  }
+}
+
+bool parseFlag(const char* arg, const char* name, const char** value) {
+  size_t len = strlen(name);
+  if (strncmp(arg, name, len) == 0 && arg[len] == '=') {
+    *value = arg + len + 1;
+    return true;
+  }
+  return false;
+}
+
+Options parseOptions(int argc, char **argv) {
+  Options options;
+  for (int i = 1; i < argc; i++) {
+    const char* v;
+    if (parseFlag(argv[i], "--messages", &v)) {
+      options.messages = strtoull(v, nullptr, 10);
+    } else if (parseFlag(argv[i], "--seed", &v)) {
+      options.seed = strtoull(v, nullptr, 10);
+    } else if (parseFlag(argv[i], "--mix", &v)) {
+      if (sscanf(v, "%lf:%lf:%lf:%lf", &options.mix[0], &options.mix[1],
+            &options.mix[2], &options.mix[3]) != 4) {
+        fprintf(stderr, "--mix takes four weights, A:E:X:R\n");
+        exit(1);
+      }
+    } else if (parseFlag(argv[i], "--live_orders", &v)) {
+      options.liveOrders = strtoull(v, nullptr, 10);
+    } else if (parseFlag(argv[i], "--tickers", &v)) {
+      options.tickers = strtoull(v, nullptr, 10);
+    } else if (parseFlag(argv[i], "--payload_size", &v)) {
+      options.payloadSize = strtoull(v, nullptr, 10);
+    } else if (parseFlag(argv[i], "--straddle", &v)) {
+      options.straddle = atoi(v) != 0;
+    } else if (parseFlag(argv[i], "--reorder", &v)) {
+      options.reorder = atof(v);
+    } else if (parseFlag(argv[i], "--reorder_depth", &v)) {
+      options.reorderDepth = strtoull(v, nullptr, 10);
+    } else if (parseFlag(argv[i], "--duplicate", &v)) {
+      options.duplicate = atof(v);
+    } else if (parseFlag(argv[i], "--loss", &v)) {
+      options.loss = atof(v);
+    } else if (parseFlag(argv[i], "--output", &v)) {
+      options.output = v;
+    } else {
+      fprintf(stderr, "Unknown flag %s\n", argv[i]);
+      exit(1);
+    }
+  }
+  // Largest message is 34 bytes, and packet sizes fit 16 bits.
+  if (options.payloadSize < 34 || options.payloadSize > 65535 - 6) {
+    fprintf(stderr, "--payload_size must be between 34 and 65529\n");
+    exit(1);
+  }
+  if (options.tickers == 0 || options.liveOrders == 0 || options.reorderDepth == 0) {
+    fprintf(stderr, "--tickers, --live_orders and --reorder_depth must be positive\n");
+    exit(1);
+  }
+  return options;
+}
+
+class Generator {
+  Options options;
+  std::mt19937_64 rng;
+  FILE* out;
+  Stats stats;
+
+  std::vector<std::string> tickers;
+  // Base price per ticker, in the feed's integer price units.
+  std::vector<uint32_t> prices;
+  // Live orders, unordered so one can be picked and removed in O(1).
+  std::vector<LiveOrder> live;
+  uint64_t nextOrderRef = 1;
+
+  std::string payload;
+  uint32_t nextSeq = 1;
+  // Packets held back so some can be delivered out of order.
+  std::deque<std::string> held;
+
+  double uniform() { return std::uniform_real_distribution<double>(0, 1)(rng); }
+  uint64_t below(uint64_t n) { return rng() % n; }
+
+  uint32_t randomPrice(uint32_t ticker) {
+    // Within 50 ticks of the base price.
+    return prices[ticker] + below(101) - 50;
+  }
+
+  void deliver(const std::string &packet) {
+    fwrite(packet.data(), 1, packet.size(), out);
+  }
+
+  void release() {
+    // Mostly the oldest held packet; sometimes a later one, overtaking.
+    size_t i = 0;
+    if (held.size() > 1 && uniform() < options.reorder) {
+      i = 1 + below(held.size() - 1);
+      stats.reordered++;
+    }
+    deliver(held[i]);
+    held.erase(held.begin() + i);
+  }
+
+  void emitPacket(const std::string &body) {
+    std::string packet;
+    putBigEndian(packet, 6 + body.size(), 2);
+    putBigEndian(packet, nextSeq++, 4);
+    packet += body;
+    stats.packets++;
+
+    if (uniform() < options.loss) {
+      stats.lost++;
+      return;
+    }
+    int copies = uniform() < options.duplicate ? 2 : 1;
+    stats.duplicated += copies - 1;
+    for (int i = 0; i < copies; i++) {
+      held.push_back(packet);
+      if (held.size() > options.reorderDepth) {
+        release();
+      }
+    }
+  }
+
+  void append(const std::string &msg) {
+    if (!options.straddle && payload.size() + msg.size() > options.payloadSize) {
+      emitPacket(payload);
+      payload.clear();
+    }
+    payload += msg;
+    while (payload.size() >= options.payloadSize) {
+      emitPacket(payload.substr(0, options.payloadSize));
+      payload.erase(0, options.payloadSize);
+    }
+  }
+
+  int pickType() {
+    double weights[4];
+    memcpy(weights, options.mix, sizeof(weights));
+    if (live.empty()) {
+      return 0;
+    }
+    if (live.size() >= options.liveOrders) {
+      weights[0] = 0;
+    }
+    double total = weights[0] + weights[1] + weights[2] + weights[3];
+    double r = uniform() * total;
+    for (int type = 0; type < 3; type++) {
+      if (r < weights[type]) {
+        return type;
+      }
+      r -= weights[type];
+    }
+    return 3;
+  }
+
+  void generateMessage(uint64_t timestamp) {
+    int type = pickType();
+    stats.messages[type]++;
+    std::string msg(1, MSG_TYPES[type]);
+    putBigEndian(msg, timestamp, 8);
+
+    if (type == 0) {
+      LiveOrder order = {nextOrderRef++, (uint32_t)(1 + below(1000)), (uint32_t) below(tickers.size())};
+      putBigEndian(msg, order.orderRef, 8);
+      msg.push_back(below(2) ? 'B' : 'S');
+      putBigEndian(msg, order.size, 4);
+      msg += tickers[order.ticker];
+      putBigEndian(msg, randomPrice(order.ticker), 4);
+      live.push_back(order);
+      append(msg);
+      return;
+    }
+
+    size_t i = below(live.size());
+    LiveOrder &order = live[i];
+    putBigEndian(msg, order.orderRef, 8);
+    if (type == 3) {
+      // The replacement takes over the order's slot.
+      order.orderRef = nextOrderRef++;
+      order.size = 1 + below(1000);
+      putBigEndian(msg, order.orderRef, 8);
+      putBigEndian(msg, order.size, 4);
+      putBigEndian(msg, randomPrice(order.ticker), 4);
+    } else {
+      // Fully fill or cancel a third of the time.
+      uint32_t size = below(3) == 0 ? order.size : 1 + below(order.size);
+      putBigEndian(msg, size, 4);
+      order.size -= size;
+      if (order.size == 0) {
+        live[i] = live.back();
+        live.pop_back();
+      }
+    }
+    append(msg);
+  }
+
+  public:
+    Generator(const Options &options, FILE* out) : options(options), rng(options.seed), out(out) {
+      for (size_t i = 0; i < options.tickers; i++) {
+        // Base 26 names, left justified and space padded.
+        std::string name;
+        size_t n = i;
+        do {
+          name.insert(name.begin(), 'A' + n % 26);
+          n /= 26;
+        } while (n > 0);
+        name.resize(8, ' ');
+        tickers.push_back(name);
+        prices.push_back(10000 + below(5000000));
+      }
+    }
+
+    void run() {
+      for (uint64_t i = 0; i < options.messages; i++) {
+        generateMessage(OPEN_NANOS + SESSION_NANOS * i / options.messages);
+      }
+      if (!payload.empty()) {
+        emitPacket(payload);
+      }
+      while (!held.empty()) {
+        release();
+      }
+    }
+
+    void report() const {
+      fprintf(stderr, "messages A=%lu E=%lu X=%lu R=%lu, live orders %zu\n",
+          stats.messages[0], stats.messages[1], stats.messages[2], stats.messages[3], live.size());
+      fprintf(stderr, "packets %lu, reordered %lu, duplicated %lu, lost %lu\n",
+          stats.packets, stats.reordered, stats.duplicated, stats.lost);
+    }
+};
+
+int main(int argc, char **argv) {
+  Options options = parseOptions(argc, argv);
+
+  FILE* out = stdout;
+  if (options.output != nullptr) {
+    out = fopen(options.output, "wb");
+    if (out == nullptr) {
+      fprintf(stderr, "Couldn't open %s\n", options.output);
+      return 1;
+    }
+  }
+  // Large stdio buffer; tens of millions of messages is gigabytes.
+  static char buffer[1 << 20];
+  setvbuf(out, buffer, _IOFBF, sizeof(buffer));
+
+  Generator generator(options, out);
+  generator.run();
+  generator.report();
+
+  if (fclose(out) != 0) {
+    fprintf(stderr, "Couldn't write output\n");
+    return 1;
+  }
+  return 0;
+}
@@ -1,37 +1,34 @@
 #include "Parser.h"
+#include "Replay.h"
 
 #include <cstdio>
-
-#include <cstdint>
-
-#include <fcntl.h>
-#include <unistd.h>
-#include <arpa/inet.h>
-#include <sys/stat.h>
-#include <sys/types.h>
-#include <sys/uio.h>
+#include <cstdlib>
+#include <exception>
 
 const char *inputFile = "test.in";
 
+// Usage: feed [input file] [speed]
+// Speed 1 replays at the pace of message timestamps; omitted or 0 replays
+// as fast as possible.
 int main(int argc, char **argv) {
     constexpr int currentDate = 20180612;
     Parser myParser(currentDate, "myTestFile");
 
-    int fd = open(inputFile, O_RDONLY);
-    if (fd == -1) {
-        fprintf(stderr, "Couldn't open %s\n", inputFile);
-        return 1;
+    ReplayConfig config;
+    if (argc > 1) {
+        inputFile = argv[1];
     }
-
-    char bigbuf[5000];
-    while (read(fd, bigbuf, 2) != 0) {
-        uint16_t packetSize = htons(*(uint16_t *)bigbuf);
-        read(fd, bigbuf + 2, packetSize - 2);
-
-        myParser.onUDPPacket(bigbuf, packetSize);
+    if (argc > 2) {
+        config.speed = atof(argv[2]);
     }
 
-    close(fd);
+    try {
+        Replay replay(inputFile);
+        replay.run(myParser, config);
+    } catch (const std::exception &e) {
+        fprintf(stderr, "%s\n", e.what());
+        return 1;
+    }
 
     return 0;
 }
@@ -0,0 +1,70 @@
+#include "Parser.h"
+#include "UDPReceiver.h"
+
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <stdexcept>
+#include <system_error>
+
+static volatile sig_atomic_t stopping = 0;
+
+static void stop(int) {
+    stopping = 1;
+}
+
+// Usage: receive <group> <port> [interface address] [busy poll]
+// Parses the live feed into myTestFile until interrupted.
+int main(int argc, char **argv) {
+    if (argc < 3) {
+        fprintf(stderr, "Usage: %s <group> <port> [interface address] [busy poll]\n", argv[0]);
+        return 1;
+    }
+    ReceiverConfig config;
+    config.address = argv[1];
+    config.port = atoi(argv[2]);
+    if (argc > 3) {
+        config.interfaceAddress = argv[3];
+    }
+    if (argc > 4) {
+        config.busyPoll = atoi(argv[4]) != 0;
+    }
+
+    // The feed is for today.
+    time_t now = time(nullptr);
+    struct tm local;
+    localtime_r(&now, &local);
+    int currentDate = (local.tm_year + 1900) * 10000 + (local.tm_mon + 1) * 100 + local.tm_mday;
+    Parser myParser(currentDate, "myTestFile");
+
+    signal(SIGINT, stop);
+    signal(SIGTERM, stop);
+    try {
+        UDPReceiver receiver(config);
+        fprintf(stderr, "Listening on %s:%u, receive buffer %d bytes\n",
+                config.address.c_str(), receiver.getPort(), receiver.getReceiveBufferBytes());
+        uint64_t rejected = 0;
+        while (!stopping) {
+            try {
+                receiver.receive(myParser);
+            } catch (const std::system_error &) {
+                throw;
+            } catch (const std::exception &e) {
+                // The rest of the batch was still parsed.
+                fprintf(stderr, "%s\n", e.what());
+                rejected++;
+            }
+        }
+        fprintf(stderr, "Received %lu packets, %lu truncated, %lu malformed, "
+                "%lu rejected by the parser, %lu dropped by the kernel, "
+                "%lu dropped by the parser, %lu skipped\n",
+                receiver.getReceivedPackets(), receiver.getTruncatedPackets(),
+                receiver.getMalformedPackets(), rejected, receiver.getKernelDrops(),
+                myParser.getDroppedPackets(), myParser.getSkippedPackets());
+    } catch (const std::exception &e) {
+        fprintf(stderr, "%s\n", e.what());
+        return 1;
+    }
+    return 0;
+}
@@ -1,4 +1,11 @@
+#include "BroadcastRing.h"
+#include "FeedHandler.h"
+#include "MessageLayout.h"
 #include "Parser.h"
+#include "RecordRing.h"
+#include "ShardedParser.h"
+#include "Replay.h"
+#include "UDPReceiver.h"
 
 #include <cstdio>
 
@@ -12,8 +19,16 @@
 #include <sys/uio.h>
 #include <iostream>
 #include <fstream>
+#include <algorithm>
 #include <assert.h>     /* assert */
+#include <chrono>
 #include <cmath>        // std::abs
+#include <map>
+#include <random>
+#include <sstream>
+#include <thread>
+#include <unordered_map>
+#include <vector>
 
 using namespace std;
 
@@ -71,7 +86,7 @@ int openFile(const char* inputFile) {
   return fd;
 }
 
-void read(Parser myParser, int fd) {
+void read(Parser &myParser, int fd) {
   char bigbuf[5000];
   while (read(fd, bigbuf, 2) != 0) {
     uint16_t packetSize = htons(*(uint16_t *)bigbuf);
@@ -79,6 +94,15 @@ void read(Parser myParser, int fd) {
 
     myParser.onUDPPacket(bigbuf, packetSize);
   }
+  myParser.flush();
+}
+
+long fileSize(const char* file) {
+  struct stat st;
+  if (stat(file, &st) != 0) {
+    return -1;
+  }
+  return st.st_size;
 }
 
 void readAddOrder(std::fstream &fh, AddOrder &addOrder) {
@@ -916,6 +940,1707 @@ void test_add_replaced_replaced_executed_straddled_out_of_order() {
   fh.close();
 }
 
+void test_flush_policy() {
+  const char *inputFile = "test_input/AA.in";
+  const char *outputFile = "test_output/AA_flush.out";
+
+  // Output stays buffered until flushed.
+  {
+    int fd = openFile(inputFile);
+    Parser myParser(19700102, std::string(outputFile));
+    char bigbuf[5000];
+    while (read(fd, bigbuf, 2) != 0) {
+      uint16_t packetSize = htons(*(uint16_t *)bigbuf);
+      read(fd, bigbuf + 2, packetSize - 2);
+      myParser.onUDPPacket(bigbuf, packetSize);
+    }
+    close(fd);
+    ASSERT_EQUALS(fileSize(outputFile), 0);
+    myParser.flush();
+    ASSERT_EQUALS(fileSize(outputFile), 88);
+  }
+
+  // Flushed per message.
+  {
+    ParserConfig config;
+    config.flush.maxMessages = 1;
+    int fd = openFile(inputFile);
+    Parser myParser(19700102, std::string(outputFile), config);
+    char bigbuf[5000];
+    read(fd, bigbuf, 2);
+    uint16_t packetSize = htons(*(uint16_t *)bigbuf);
+    read(fd, bigbuf + 2, packetSize - 2);
+    myParser.onUDPPacket(bigbuf, packetSize);
+    close(fd);
+    ASSERT_EQUALS(fileSize(outputFile), 44);
+  }
+
+  // Flushed on destruction.
+  {
+    int fd = openFile(inputFile);
+    Parser myParser(19700102, std::string(outputFile));
+    char bigbuf[5000];
+    while (read(fd, bigbuf, 2) != 0) {
+      uint16_t packetSize = htons(*(uint16_t *)bigbuf);
+      read(fd, bigbuf + 2, packetSize - 2);
+      myParser.onUDPPacket(bigbuf, packetSize);
+    }
+    close(fd);
+  }
+  ASSERT_EQUALS(fileSize(outputFile), 88);
+}
+
+void test_order_table() {
+  OrderTable table;
+  std::unordered_map<uint64_t, uint32_t> expected;
+  std::mt19937_64 rng(42);
+
+  // Dense sequential refs, then random churn over a small key space so
+  // inserts, overwrites and erases collide in long probe runs.
+  for (uint64_t ref = 1; ref <= 10000; ref++) {
+    table.insert(ref, {1.0, (uint32_t) ref, 0, 'B'});
+    expected[ref] = ref;
+  }
+  for (int i = 0; i < 200000; i++) {
+    uint64_t ref = rng() % 20000;
+    uint32_t size = rng();
+    if (rng() % 3 == 0) {
+      ASSERT_EQUALS(table.erase(ref), expected.erase(ref) == 1);
+    } else {
+      table.insert(ref, {1.0, size, 0, 'B'});
+      expected[ref] = size;
+    }
+  }
+
+  ASSERT_EQUALS(table.size(), expected.size());
+  for (uint64_t ref = 0; ref < 20000; ref++) {
+    PendingOrder_t* order = table.find(ref);
+    auto entry = expected.find(ref);
+    if (entry == expected.end()) {
+      assert(order == nullptr);
+    } else {
+      assert(order != nullptr);
+      ASSERT_EQUALS(order->sizeRemaining, entry->second);
+    }
+  }
+}
+
+void test_symbol_table() {
+  SymbolTable symbols;
+  symbol_id_t spy = symbols.intern("SPY\0\0\0\0\0");
+  symbol_id_t qqq = symbols.intern("QQQ\0\0\0\0\0");
+  ASSERT_EQUALS(symbols.intern("SPY\0\0\0\0\0"), spy);
+  assert(spy != qqq);
+  ASSERT_EQUALS(symbols.size(), 2);
+
+  const char * expectedTicker = "QQQ\0\0\0\0\0";
+  assert(std::equal(expectedTicker, expectedTicker+8, symbols.ticker(qqq)));
+}
+
+void test_retire_policy() {
+  // ARC cancels the order that was replaced.
+  const char *inputFile = "test_input/ARC.in";
+  const char *outputFile = "test_output/ARC_retired.out";
+
+  // A graveyard keeps the replaced order for the late cancel.
+  {
+    ParserConfig config;
+    config.retirePolicy = RETIRE_GRAVEYARD;
+    config.graveyardSize = 1;
+    int fd = openFile(inputFile);
+    Parser myParser(19700102, std::string(outputFile), config);
+    read(myParser, fd);
+    close(fd);
+    ASSERT_EQUALS(fileSize(outputFile), 44 + 48 + 32);
+  }
+
+  // Evicted straight away, the cancel is dropped.
+  {
+    ParserConfig config;
+    config.retirePolicy = RETIRE_IMMEDIATELY;
+    config.unknownRefPolicy = UNKNOWN_REF_DROP;
+    int fd = openFile(inputFile);
+    Parser myParser(19700102, std::string(outputFile), config);
+    read(myParser, fd);
+    close(fd);
+    ASSERT_EQUALS(fileSize(outputFile), 44 + 48);
+  }
+
+  // Or rejected.
+  {
+    ParserConfig config;
+    config.retirePolicy = RETIRE_IMMEDIATELY;
+    int fd = openFile(inputFile);
+    Parser myParser(19700102, std::string(outputFile), config);
+    bool threw = false;
+    try {
+      read(myParser, fd);
+    } catch (const std::runtime_error &e) {
+      threw = true;
+    }
+    close(fd);
+    assert(threw);
+  }
+}
+
+std::string fileContents(const char* file) {
+  std::ifstream fh(file, std::ifstream::binary);
+  std::stringstream contents;
+  contents << fh.rdbuf();
+  return contents.str();
+}
+
+void test_batch() {
+  const char *inputFile = "test_input/ARRE_straddled_out_of_order.in";
+  const char *outputFile = "test_output/ARRE_straddled_out_of_order_batch.out";
+
+  std::vector<std::string> packets;
+  int fd = openFile(inputFile);
+  char bigbuf[5000];
+  while (read(fd, bigbuf, 2) != 0) {
+    uint16_t packetSize = htons(*(uint16_t *)bigbuf);
+    read(fd, bigbuf + 2, packetSize - 2);
+    packets.push_back(std::string(bigbuf, packetSize));
+  }
+  close(fd);
+
+  std::vector<UDPPacket> batch;
+  for (const std::string &packet : packets) {
+    batch.push_back({packet.data(), packet.size()});
+  }
+  Parser myParser(19700102, std::string(outputFile));
+  myParser.onUDPPackets(batch.data(), batch.size());
+  myParser.flush();
+
+  // Same output as one packet at a time.
+  assert(fileContents(outputFile) ==
+      fileContents("test_output/ARRE_straddled_out_of_order.out"));
+  ASSERT_EQUALS(fileSize(outputFile), 44 + 48 + 48 + 40);
+
+  // Packets reordered within a batch are taken in sequence, so nothing is
+  // found missing.
+  std::reverse(batch.begin(), batch.end());
+  int gaps = 0;
+  ParserConfig config;
+  config.onGap = [&](uint32_t, uint32_t) { gaps++; };
+  std::string records;
+  {
+    CallbackSink sink([&](const char* record, size_t len) { records.append(record, len); });
+    Parser myParser(19700102, sink, config);
+    myParser.onUDPPackets(batch.data(), batch.size());
+  }
+  ASSERT_EQUALS(gaps, 0);
+  assert(records == fileContents(outputFile));
+
+  // A bad packet doesn't lose the rest of the batch.
+  std::string truncated = packets[0].substr(0, 4);
+  batch.insert(batch.begin() + 2, {truncated.data(), truncated.size()});
+  records.clear();
+  bool threw = false;
+  {
+    CallbackSink sink([&](const char* record, size_t len) { records.append(record, len); });
+    Parser myParser(19700102, sink);
+    try {
+      myParser.onUDPPackets(batch.data(), batch.size());
+    } catch (const std::invalid_argument &) {
+      threw = true;
+    }
+  }
+  assert(threw);
+  assert(records == fileContents(outputFile));
+}
+
+void test_replay() {
+  const char *inputFile = "test_input/ARRE_straddled_out_of_order.in";
+  const char *outputFile = "test_output/ARRE_straddled_out_of_order_replay.out";
+  const char *pacedFile = "test_output/ARRE_straddled_out_of_order_paced.out";
+
+  Replay replay(inputFile);
+  {
+    Parser myParser(19700102, std::string(outputFile));
+    ASSERT_EQUALS(replay.run(myParser), 5);
+  }
+  {
+    // Paced by message timestamps, sped up to keep the test quick.
+    Parser myParser(19700102, std::string(pacedFile));
+    ReplayConfig config;
+    config.speed = 1e9;
+    ASSERT_EQUALS(replay.run(myParser, config), 5);
+    ASSERT_EQUALS(myParser.getLastTimestamp(), 2123456789);
+  }
+
+  // Same output as reading one packet at a time.
+  assert(fileContents(outputFile) ==
+      fileContents("test_output/ARRE_straddled_out_of_order.out"));
+  assert(fileContents(pacedFile) == fileContents(outputFile));
+
+  // A packet running past the end of the capture, after complete ones
+  // still in the batch, which are parsed before it throws.
+  const char *truncatedFile = "test_output/truncated.in";
+  std::string capture = fileContents(inputFile);
+  std::ofstream(truncatedFile, std::ios::binary) << capture + capture.substr(0, 20);
+  Replay truncated(truncatedFile);
+  Parser myParser(19700102, "test_output/truncated.out");
+  bool threw = false;
+  try {
+    truncated.run(myParser);
+  } catch (const std::runtime_error &) {
+    threw = true;
+  }
+  assert(threw);
+  myParser.flush();
+  assert(fileContents("test_output/truncated.out") == fileContents(outputFile));
+}
+
+void test_receiver() {
+  const char *inputFile = "test_input/ARRE_straddled_out_of_order.in";
+  const char *outputFile = "test_output/ARRE_straddled_out_of_order_udp.out";
+
+  // Loopback has no multicast here, so receive on a unicast address.
+  ReceiverConfig config;
+  config.address = "127.0.0.1";
+  config.batchSize = 2;
+  UDPReceiver receiver(config);
+  assert(receiver.getPort() != 0);
+
+  int sender = socket(AF_INET, SOCK_DGRAM, 0);
+  sockaddr_in to = {};
+  to.sin_family = AF_INET;
+  to.sin_port = htons(receiver.getPort());
+  inet_pton(AF_INET, "127.0.0.1", &to.sin_addr);
+  std::string capture = fileContents(inputFile);
+  for (size_t offset = 0; offset < capture.size(); ) {
+    size_t len = ((uint8_t) capture[offset] << 8) | (uint8_t) capture[offset + 1];
+    sendto(sender, capture.data() + offset, len, 0, (sockaddr*) &to, sizeof(to));
+    if (offset == 0) {
+      // Too short for a header, and one whose header claims a byte more.
+      sendto(sender, capture.data(), 4, 0, (sockaddr*) &to, sizeof(to));
+      std::string longer = capture.substr(0, len);
+      longer[1]++;
+      sendto(sender, longer.data(), len, 0, (sockaddr*) &to, sizeof(to));
+    }
+    offset += len;
+  }
+  close(sender);
+
+  Parser myParser(19700102, std::string(outputFile));
+  for (int attempts = 0; attempts < 10 && receiver.getReceivedPackets() < 7; attempts++) {
+    receiver.receive(myParser);
+  }
+  myParser.flush();
+  ASSERT_EQUALS(receiver.getReceivedPackets(), 7);
+  ASSERT_EQUALS(receiver.getMalformedPackets(), 2);
+  ASSERT_EQUALS(receiver.getKernelDrops(), 0);
+  assert(receiver.getLastReceiveNanos() != 0);
+  assert(fileContents(outputFile) ==
+      fileContents("test_output/ARRE_straddled_out_of_order.out"));
+
+  // Nothing more to receive.
+  ASSERT_EQUALS(receiver.receive(myParser), 0);
+}
+
+void test_packet_pool() {
+  PacketPool pool(64, 2);
+  char* first = pool.acquire(40);
+  char* second = pool.acquire(64);
+  char* third = pool.acquire(10);
+  assert(first != second && second != third && first != third);
+
+  // Released slots are recycled.
+  pool.release(second, 64);
+  ASSERT_EQUALS((void*) pool.acquire(20), (void*) second);
+
+  // Oversized packets get a buffer of their own.
+  char* oversized = pool.acquire(65);
+  oversized[64] = 'x';
+  pool.release(oversized, 65);
+}
+
+// Big endian encoding of the n low bytes of value.
+std::string bigEndian(uint64_t value, int n) {
+  std::string bytes;
+  for (int i = n - 1; i >= 0; i--) {
+    bytes.push_back((char)(value >> (8 * i)));
+  }
+  return bytes;
+}
+
+std::string addMessage(uint64_t orderRef) {
+  return "A" + bigEndian(1, 8) + bigEndian(orderRef, 8) + "B" + bigEndian(100, 4) +
+      "SPY     " + bigEndian(2000000, 4);
+}
+
+std::string executeMessage(uint64_t orderRef) {
+  return "E" + bigEndian(2, 8) + bigEndian(orderRef, 8) + bigEndian(10, 4);
+}
+
+std::string makePacket(uint32_t seq, const std::string &payload) {
+  return bigEndian(6 + payload.size(), 2) + bigEndian(seq, 4) + payload;
+}
+
+// Output records of messages, parsed one per packet.
+std::string parseEach(const std::vector<std::string> &messages) {
+  std::string records;
+  CallbackSink sink([&](const char* record, size_t len) { records.append(record, len); });
+  Parser myParser(19700102, sink);
+  for (size_t i = 0; i < messages.size(); i++) {
+    std::string packet = makePacket(i + 1, messages[i]);
+    myParser.onUDPPacket(packet.data(), packet.size());
+  }
+  return records;
+}
+
+void test_message_batches() {
+  // A run of Adds longer than a batch of 64, then runs of one to three
+  // mixed types, all in one payload.
+  std::vector<std::string> messages;
+  for (uint64_t ref = 1; ref <= 100; ref++) {
+    messages.push_back(addMessage(ref));
+  }
+  for (uint64_t ref = 1; ref <= 60; ref++) {
+    messages.push_back(executeMessage(ref));
+    if (ref % 2 == 0) {
+      messages.push_back("X" + bigEndian(3, 8) + bigEndian(ref, 8) + bigEndian(5, 4));
+    }
+    if (ref % 3 == 0) {
+      messages.push_back("R" + bigEndian(4, 8) + bigEndian(ref, 8) + bigEndian(1000 + ref, 8) +
+          bigEndian(50, 4) + bigEndian(2000100, 4));
+    }
+  }
+  std::string payload;
+  for (const std::string &msg : messages) {
+    payload += msg;
+  }
+  std::string records;
+  {
+    CallbackSink sink([&](const char* record, size_t len) { records.append(record, len); });
+    Parser myParser(19700102, sink);
+    std::string packet = makePacket(1, payload);
+    myParser.onUDPPacket(packet.data(), packet.size());
+  }
+  ASSERT_EQUALS(records.size(), 100 * 44 + 60 * 40 + 30 * 32 + 20 * 48);
+  assert(records == parseEach(messages));
+
+  // An unknown type mid-batch throws, once the messages before it, in
+  // this batch and the one before, are written.
+  std::vector<std::string> before(messages.begin(), messages.begin() + 70);
+  payload.clear();
+  for (const std::string &msg : before) {
+    payload += msg;
+  }
+  payload += "Z" + addMessage(200).substr(1);
+  records.clear();
+  bool threw = false;
+  {
+    CallbackSink sink([&](const char* record, size_t len) { records.append(record, len); });
+    Parser myParser(19700102, sink);
+    std::string packet = makePacket(1, payload);
+    try {
+      myParser.onUDPPacket(packet.data(), packet.size());
+    } catch (const std::runtime_error &) {
+      threw = true;
+    }
+  }
+  assert(threw);
+  ASSERT_EQUALS(records.size(), 70 * 44);
+  assert(records == parseEach(before));
+}
+
+void test_reorder_window() {
+  // Packet headers only, each carrying its sequence number.
+  std::vector<std::string> packets;
+  for (uint32_t seq = 0; seq < 300; seq++) {
+    uint32_t base = 100000 + seq;
+    char header[6] = {0x00, 0x06, (char)(base >> 24), (char)(base >> 16), (char)(base >> 8), (char)base};
+    packets.push_back(std::string(header, 6));
+  }
+  auto packet = [&](uint32_t seq) { return &packets[seq - 100000][0]; };
+
+  // Sequence numbers past 65535 must not alias.
+  ReorderWindow window(128);
+  uint32_t head = 100000;
+  for (uint32_t seq = head + 1; seq < head + 100; seq++) {
+    window.put(seq, packet(seq));
+  }
+  ASSERT_EQUALS(window.run(head), 0);
+  ASSERT_EQUALS(window.run(head + 1), 99);
+  assert(!window.fits(head, head + 128));
+
+  // Runs wrap around the end of the window.
+  for (uint32_t seq = head + 1; seq < head + 90; seq++) {
+    assert(window.take(seq) == packet(seq));
+  }
+  head += 90;
+  for (uint32_t seq = head + 10; seq < head + 60; seq++) {
+    window.put(seq, packet(seq));
+  }
+  ASSERT_EQUALS(window.run(head), 60);
+
+  // Growing keeps stashed packets under their sequence numbers.
+  window.grow(head, head + 200);
+  assert(window.fits(head, head + 200));
+  ASSERT_EQUALS(window.run(head), 60);
+  assert(window.take(head + 59) == packet(head + 59));
+  ASSERT_EQUALS(window.size(), 59);
+  ASSERT_EQUALS(window.next(head - 5), head);
+  ASSERT_EQUALS(window.next(head + 30), head + 30);
+}
+
+void test_reorder_overflow() {
+  // Packets arrive in order 1, 4, 2, 5, 3, so a window of 2 overflows.
+  const char *inputFile = "test_input/ARRE_straddled_out_of_order.in";
+  const char *outputFile = "test_output/ARRE_straddled_out_of_order_window.out";
+
+  ParserConfig config;
+  config.reorderWindowSize = 2;
+
+  {
+    config.reorderOverflowPolicy = REORDER_GROW;
+    int fd = openFile(inputFile);
+    Parser myParser(19700102, std::string(outputFile), config);
+    read(myParser, fd);
+    close(fd);
+    assert(fileContents(outputFile) ==
+        fileContents("test_output/ARRE_straddled_out_of_order.out"));
+  }
+
+  {
+    config.reorderOverflowPolicy = REORDER_DROP;
+    int fd = openFile(inputFile);
+    Parser myParser(19700102, std::string(outputFile), config);
+    read(myParser, fd);
+    close(fd);
+    ASSERT_EQUALS(myParser.getDroppedPackets(), 2);
+  }
+
+  {
+    config.reorderOverflowPolicy = REORDER_THROW;
+    int fd = openFile(inputFile);
+    Parser myParser(19700102, std::string(outputFile), config);
+    bool threw = false;
+    try {
+      read(myParser, fd);
+    } catch (const std::runtime_error &e) {
+      threw = true;
+    }
+    close(fd);
+    assert(threw);
+  }
+
+  // A far-future sequence number doesn't grow the window past its cap.
+  {
+    ParserConfig capped;
+    capped.maxReorderWindow = 1 << 10;
+    std::string first = makePacket(1, "");
+    std::string far = makePacket(0x7FFFFFF0, "");
+    std::string near = makePacket(3, "");
+    Parser myParser(19700102, std::string(outputFile), capped);
+    myParser.onUDPPacket(first.data(), first.size());
+    myParser.onUDPPacket(far.data(), far.size());
+    ASSERT_EQUALS(myParser.getDroppedPackets(), 1);
+    myParser.onUDPPacket(near.data(), near.size());
+    ASSERT_EQUALS(myParser.getDroppedPackets(), 1);
+
+    capped.maxReorderWindowPolicy = REORDER_THROW;
+    Parser throwing(19700102, std::string(outputFile), capped);
+    throwing.onUDPPacket(first.data(), first.size());
+    bool threw = false;
+    try {
+      throwing.onUDPPacket(far.data(), far.size());
+    } catch (const std::runtime_error &e) {
+      threw = true;
+    }
+    assert(threw);
+  }
+}
+
+void test_gap_recovery() {
+  const char *outputFile = "test_output/gap.out";
+
+  // Packet 2 is lost, taking the head of order 2 with it.
+  std::string add2 = addMessage(2);
+  std::vector<std::string> packets = {
+    makePacket(1, addMessage(1)),
+    makePacket(3, add2.substr(20) + addMessage(3)),
+    makePacket(4, executeMessage(3)),
+  };
+
+  // Skipping once two packets are stuck behind the gap.
+  {
+    ParserConfig config;
+    config.maxPendingPackets = 2;
+    std::vector<std::pair<uint32_t, uint32_t>> gaps;
+    config.onGap = [&](uint32_t first, uint32_t last) { gaps.push_back({first, last}); };
+
+    Parser myParser(19700102, std::string(outputFile), config);
+    myParser.onUDPPacket(packets[0].data(), packets[0].size());
+    myParser.onUDPPacket(packets[1].data(), packets[1].size());
+    ASSERT_EQUALS(gaps.size(), 1);
+    ASSERT_EQUALS(gaps[0].first, 2);
+    ASSERT_EQUALS(gaps[0].second, 2);
+    ASSERT_EQUALS(myParser.getSkippedPackets(), 0);
+
+    myParser.onUDPPacket(packets[2].data(), packets[2].size());
+    myParser.flush();
+    ASSERT_EQUALS(gaps.size(), 1);
+    ASSERT_EQUALS(myParser.getSkippedPackets(), 1);
+    // Resumed at order 3, past the tail of order 2.
+    ASSERT_EQUALS(fileSize(outputFile), 44 + 44 + 40);
+  }
+
+  // Skipping once the gap times out, polling until it does so nothing
+  // depends on how long each step takes.
+  {
+    ParserConfig config;
+    config.gapTimeoutNanos = 20000000;
+    Parser myParser(19700102, std::string(outputFile), config);
+    myParser.onUDPPacket(packets[0].data(), packets[0].size());
+    auto opened = std::chrono::steady_clock::now();
+    myParser.onUDPPacket(packets[1].data(), packets[1].size());
+    myParser.onUDPPacket(packets[2].data(), packets[2].size());
+    auto deadline = opened + std::chrono::seconds(10);
+    while (myParser.getSkippedPackets() == 0 && std::chrono::steady_clock::now() < deadline) {
+      usleep(1000);
+      myParser.poll();
+    }
+    // Whichever call skipped the gap returned after the timeout.
+    auto skipped = std::chrono::steady_clock::now();
+    myParser.flush();
+    ASSERT_EQUALS(myParser.getSkippedPackets(), 1);
+    assert(skipped - opened >= std::chrono::nanoseconds(config.gapTimeoutNanos));
+    ASSERT_EQUALS(fileSize(outputFile), 44 + 44 + 40);
+  }
+}
+
+// Output records of packets, and how many of them threw.
+std::string parsePackets(const std::vector<std::string> &packets, int *threw) {
+  std::string records;
+  CallbackSink sink([&](const char* record, size_t len) { records.append(record, len); });
+  Parser myParser(19700102, sink);
+  *threw = 0;
+  for (const std::string &packet : packets) {
+    try {
+      myParser.onUDPPacket(packet.data(), packet.size());
+    } catch (const std::runtime_error &) {
+      (*threw)++;
+    }
+  }
+  return records;
+}
+
+void test_bad_packets() {
+  std::string expected = parseEach({addMessage(1), addMessage(2), addMessage(3)});
+  int threw;
+
+  // An unknown ref, then good packets in sequence.
+  std::string records = parsePackets({
+    makePacket(1, executeMessage(99)),
+    makePacket(2, addMessage(1)),
+    makePacket(3, addMessage(2) + addMessage(3)),
+  }, &threw);
+  ASSERT_EQUALS(threw, 1);
+  assert(records == expected);
+
+  // Caught up from the stash, with the packets behind it still drained.
+  records = parsePackets({
+    makePacket(4, addMessage(3)),
+    makePacket(3, addMessage(2)),
+    makePacket(2, executeMessage(99)),
+    makePacket(1, addMessage(1)),
+  }, &threw);
+  ASSERT_EQUALS(threw, 1);
+  assert(records == expected);
+
+  // An unknown type, whose packet's tail straddles into the next, which
+  // resumes at its first whole message.
+  std::string add2 = addMessage(2);
+  records = parsePackets({
+    makePacket(1, addMessage(1) + "Z" + add2.substr(0, 10)),
+    makePacket(2, add2.substr(10) + addMessage(2)),
+    makePacket(3, addMessage(3)),
+  }, &threw);
+  ASSERT_EQUALS(threw, 1);
+  assert(records == expected);
+
+  // Mid-batch, the packets after it in the batch, and later batches, are
+  // still parsed.
+  std::vector<std::string> packets = {
+    makePacket(1, addMessage(1)),
+    makePacket(2, addMessage(2)),
+    makePacket(3, executeMessage(99)),
+    makePacket(4, addMessage(3)),
+    makePacket(5, addMessage(4)),
+    makePacket(6, addMessage(5)),
+  };
+  std::vector<UDPPacket> batch;
+  for (size_t i : {0, 3, 2, 1, 4}) {
+    batch.push_back({packets[i].data(), packets[i].size()});
+  }
+  records.clear();
+  threw = 0;
+  {
+    CallbackSink sink([&](const char* record, size_t len) { records.append(record, len); });
+    Parser myParser(19700102, sink);
+    try {
+      myParser.onUDPPackets(batch.data(), batch.size());
+    } catch (const std::runtime_error &) {
+      threw++;
+    }
+    UDPPacket last = {packets[5].data(), packets[5].size()};
+    myParser.onUDPPackets(&last, 1);
+  }
+  ASSERT_EQUALS(threw, 1);
+  assert(records == parseEach({addMessage(1), addMessage(2), addMessage(3), addMessage(4),
+      addMessage(5)}));
+}
+
+void test_async_output() {
+  std::vector<std::string> packets;
+  for (uint32_t seq = 1; seq <= 2000; seq++) {
+    packets.push_back(makePacket(seq, addMessage(seq) + executeMessage(seq)));
+  }
+  const size_t expectedSize = 2000 * (44 + 40);
+
+  const char *syncFile = "test_output/async_sync.out";
+  {
+    ParserConfig config;
+    config.flush.maxBytes = 1000;
+    Parser myParser(19700102, std::string(syncFile), config);
+    for (const std::string &packet : packets) {
+      myParser.onUDPPacket(packet.data(), packet.size());
+    }
+  }
+  ASSERT_EQUALS(fileSize(syncFile), expectedSize);
+
+  // Same bytes through io_uring, a ring of one buffer and O_DIRECT, which
+  // fall back to synchronous writes where unsupported.
+  const char *asyncFile = "test_output/async.out";
+  for (size_t buffers : {1, 4}) {
+    for (bool direct : {false, true}) {
+      ParserConfig config;
+      config.flush.maxBytes = 1000;
+      config.flush.asyncBuffers = buffers;
+      config.flush.directIO = direct;
+      {
+        Parser myParser(19700102, std::string(asyncFile), config);
+        for (size_t i = 0; i < packets.size(); i++) {
+          myParser.onUDPPacket(packets[i].data(), packets[i].size());
+          if (i == 999) {
+            // A flush mid block leaves the file at exactly what was written.
+            myParser.flush();
+            ASSERT_EQUALS(fileSize(asyncFile), expectedSize / 2);
+          }
+        }
+      }
+      assert(fileContents(asyncFile) == fileContents(syncFile));
+    }
+  }
+
+  // Buffers too large to allocate throw, rather than reaching io_uring.
+  for (size_t buffers : {0, 2}) {
+    FlushPolicy policy;
+    policy.maxBytes = size_t(1) << 62;
+    policy.asyncBuffers = buffers;
+    bool threw = false;
+    try {
+      OutputWriter writer(asyncFile, policy);
+    } catch (const std::bad_alloc &) {
+      threw = true;
+    }
+    assert(threw);
+  }
+}
+
+// Drains records from reader on another thread until expected bytes.
+std::string drainRing(RecordRingReader &reader, size_t expected) {
+  std::string records;
+  while (records.size() < expected) {
+    const char* record;
+    size_t len;
+    if (reader.peek(&record, &len)) {
+      records.append(record, len);
+      reader.release();
+    } else {
+      std::this_thread::yield();
+    }
+  }
+  return records;
+}
+
+void test_output_sinks() {
+  std::vector<std::string> packets;
+  for (uint32_t seq = 1; seq <= 1000; seq++) {
+    packets.push_back(makePacket(seq, addMessage(seq) + executeMessage(seq)));
+  }
+  const char *outputFile = "test_output/sinks.out";
+  {
+    Parser myParser(19700102, std::string(outputFile));
+    for (const std::string &packet : packets) {
+      myParser.onUDPPacket(packet.data(), packet.size());
+    }
+  }
+  std::string expected = fileContents(outputFile);
+  ASSERT_EQUALS(expected.size(), 1000 * (44 + 40));
+
+  // Callback, one record at a time.
+  {
+    std::string records;
+    size_t count = 0;
+    CallbackSink sink([&](const char* record, size_t len) {
+      records.append(record, len);
+      count++;
+    });
+    Parser myParser(19700102, sink);
+    for (const std::string &packet : packets) {
+      myParser.onUDPPacket(packet.data(), packet.size());
+    }
+    ASSERT_EQUALS(count, 2000);
+    assert(records == expected);
+  }
+
+  // In-process ring, small enough to wrap and fill many times.
+  {
+    RecordRing ring(1024);
+    RecordRingReader reader(ring);
+    std::string records;
+    std::thread consumer([&]() { records = drainRing(reader, expected.size()); });
+    Parser myParser(19700102, ring);
+    for (const std::string &packet : packets) {
+      myParser.onUDPPacket(packet.data(), packet.size());
+    }
+    consumer.join();
+    assert(records == expected);
+
+    const char* record;
+    size_t len;
+    assert(!reader.peek(&record, &len));
+  }
+
+  // Shared memory ring, read through its own mapping.
+  {
+    RecordRing ring("/parser_test_records", 4096);
+    RecordRingReader reader("/parser_test_records");
+    std::string records;
+    std::thread consumer([&]() { records = drainRing(reader, expected.size()); });
+    Parser myParser(19700102, ring);
+    for (const std::string &packet : packets) {
+      myParser.onUDPPacket(packet.data(), packet.size());
+    }
+    consumer.join();
+    assert(records == expected);
+  }
+  bool threw = false;
+  try {
+    RecordRingReader reader("/parser_test_records");
+  } catch (const std::runtime_error &) {
+    threw = true;
+  }
+  assert(threw);
+}
+
+void test_broadcast_ring() {
+  std::vector<std::string> packets;
+  for (uint32_t seq = 1; seq <= 1000; seq++) {
+    packets.push_back(makePacket(seq, addMessage(seq) + executeMessage(seq)));
+  }
+  const char *outputFile = "test_output/broadcast.out";
+  {
+    Parser myParser(19700102, std::string(outputFile));
+    for (const std::string &packet : packets) {
+      myParser.onUDPPacket(packet.data(), packet.size());
+    }
+  }
+  std::string expected = fileContents(outputFile);
+
+  BroadcastRing ring("/parser_test_broadcast", 100);
+  // Keeps up, reading after every packet.
+  BroadcastReader follower("/parser_test_broadcast");
+  // Never reads until the end, by which point it has been lapped.
+  BroadcastReader laggard("/parser_test_broadcast");
+
+  Parser myParser(19700102, ring);
+  std::string records;
+  char record[OutputSink::MAX_RECORD_SIZE];
+  size_t len;
+  for (const std::string &packet : packets) {
+    myParser.onUDPPacket(packet.data(), packet.size());
+    while (follower.read(record, &len) == BROADCAST_RECORD) {
+      records.append(record, len);
+    }
+  }
+  assert(records == expected);
+  ASSERT_EQUALS(follower.getLostRecords(), 0);
+
+  ASSERT_EQUALS(laggard.read(record, &len), BROADCAST_OVERRUN);
+  ASSERT_EQUALS(laggard.getLostRecords(), 2000);
+  ASSERT_EQUALS(laggard.read(record, &len), BROADCAST_NONE);
+
+  // A late joiner can start from what is left of the last lap, 128 slots.
+  BroadcastReader replayer("/parser_test_broadcast", true);
+  records.clear();
+  while (replayer.read(record, &len) == BROADCAST_RECORD) {
+    records.append(record, len);
+  }
+  ASSERT_EQUALS(records.size(), 127 / 2 * (44 + 40) + 40);
+  assert(records == expected.substr(expected.size() - records.size()));
+}
+
+void test_message_layout() {
+  // Offsets derived from field widths match the specifications.
+  ASSERT_EQUALS(InputAddLayout::ticker::offset, 22);
+  ASSERT_EQUALS(InputAddLayout::price::offset, 30);
+  ASSERT_EQUALS(InputReplacedLayout::price::offset, 29);
+  ASSERT_EQUALS(OutputAddLayout::padding::offset, 29);
+  ASSERT_EQUALS(OutputAddLayout::price::offset, 36);
+  ASSERT_EQUALS(OutputReplacedLayout::newPrice::offset, 40);
+
+  // Big endian input fields, including the top byte of 64 bit ones.
+  std::string msg = "E" + bigEndian(0x0102030405060708, 8) + bigEndian(0xF1F2F3F4F5F6F7F8, 8) +
+      bigEndian(0x89ABCDEF, 4);
+  ASSERT_EQUALS(readField<InputExecutedLayout::timestamp>(msg.data()), 0x0102030405060708);
+  ASSERT_EQUALS(readField<InputExecutedLayout::orderRef>(msg.data()), 0xF1F2F3F4F5F6F7F8);
+  ASSERT_EQUALS(readField<InputExecutedLayout::size>(msg.data()), 0x89ABCDEF);
+}
+
+// Big endian integer of width bytes at offset, a byte at a time.
+uint64_t referenceField(const std::string &msg, size_t offset, size_t width) {
+  uint64_t value = 0;
+  for (size_t i = 0; i < width; i++) {
+    value = value << 8 | (uint8_t) msg[offset + i];
+  }
+  return value;
+}
+
+// Checks decoders against a byte at a time reading of msg.
+void checkDecoders(const MessageDecoders &decoders, const std::string &msg) {
+  const char* in = msg.data();
+  switch (msg[0]) {
+    case 'A': {
+      InputAddOrder add;
+      decoders.addOrder(in, &add);
+      ASSERT_EQUALS(add.timestamp, referenceField(msg, 1, 8));
+      ASSERT_EQUALS(add.orderRef, referenceField(msg, 9, 8));
+      ASSERT_EQUALS(add.side, msg[17]);
+      ASSERT_EQUALS(add.size, referenceField(msg, 18, 4));
+      assert(memcmp(add.ticker, &msg[22], 8) == 0);
+      ASSERT_EQUALS((uint32_t) add.price, referenceField(msg, 30, 4));
+      break;
+    }
+    case 'E': {
+      InputOrderExecuted executed;
+      decoders.orderExecuted(in, &executed);
+      ASSERT_EQUALS(executed.timestamp, referenceField(msg, 1, 8));
+      ASSERT_EQUALS(executed.orderRef, referenceField(msg, 9, 8));
+      ASSERT_EQUALS(executed.size, referenceField(msg, 17, 4));
+      break;
+    }
+    case 'X': {
+      InputOrderCanceled canceled;
+      decoders.orderCanceled(in, &canceled);
+      ASSERT_EQUALS(canceled.timestamp, referenceField(msg, 1, 8));
+      ASSERT_EQUALS(canceled.orderRef, referenceField(msg, 9, 8));
+      ASSERT_EQUALS(canceled.size, referenceField(msg, 17, 4));
+      break;
+    }
+    case 'R': {
+      InputOrderReplaced replaced;
+      decoders.orderReplaced(in, &replaced);
+      ASSERT_EQUALS(replaced.timestamp, referenceField(msg, 1, 8));
+      ASSERT_EQUALS(replaced.originalOrderRef, referenceField(msg, 9, 8));
+      ASSERT_EQUALS(replaced.newOrderRef, referenceField(msg, 17, 8));
+      ASSERT_EQUALS(replaced.size, referenceField(msg, 25, 4));
+      ASSERT_EQUALS(replaced.price, (double) referenceField(msg, 29, 4));
+      break;
+    }
+  }
+}
+
+void test_decoders() {
+  std::vector<const MessageDecoders*> all = {&scalarDecoders()};
+  if (ssse3Decoders() != nullptr) {
+    all.push_back(ssse3Decoders());
+  }
+  std::mt19937_64 rng(18);
+  const std::pair<char, size_t> types[] = {{'A', 34}, {'E', 21}, {'X', 21}, {'R', 33}};
+  for (const MessageDecoders* decoders : all) {
+    for (const auto &type : types) {
+      // Every value of every byte, on an otherwise random message.
+      for (size_t position = 1; position < type.second; position++) {
+        for (int value = 0; value < 256; value++) {
+          std::string msg(1, type.first);
+          for (size_t i = 1; i < type.second; i++) {
+            msg.push_back((char) rng());
+          }
+          msg[position] = (char) value;
+          checkDecoders(*decoders, msg);
+        }
+      }
+    }
+  }
+}
+
+void test_message_registry() {
+  const char *outputFile = "test_output/registry.out";
+  const char *expectedFile = "test_output/registry_expected.out";
+  // A 12 byte system event, skipped, and a 44 byte trade, handled.
+  std::string event = "S" + bigEndian(5, 8) + "O" + bigEndian(0, 2);
+  std::string trade = "P" + bigEndian(7, 8) + bigEndian(99, 8) + "B" + bigEndian(300, 4) +
+      "SPY     " + bigEndian(2000000, 4) + bigEndian(1234, 8) + bigEndian(0, 2);
+  ASSERT_EQUALS(event.size(), 12);
+  ASSERT_EQUALS(trade.size(), 44);
+
+  {
+    Parser myParser(19700102, std::string(expectedFile));
+    std::string packet = makePacket(1, addMessage(1) + executeMessage(1));
+    myParser.onUDPPacket(packet.data(), packet.size());
+  }
+
+  // The trade straddles the two packets.
+  std::string payload = event + addMessage(1) + trade + trade + event + executeMessage(1) + event;
+  std::string first = makePacket(1, payload.substr(0, 80));
+  std::string second = makePacket(2, payload.substr(80));
+  std::vector<std::string> trades;
+  {
+    Parser myParser(19700102, std::string(outputFile));
+    myParser.registerMessageType('S', 12);
+    myParser.registerMessageType('P', 44, [&](const char* msg, size_t len) {
+      trades.push_back(std::string(msg, len));
+    });
+    myParser.onUDPPacket(first.data(), first.size());
+    myParser.onUDPPacket(second.data(), second.size());
+  }
+  assert(fileContents(outputFile) == fileContents(expectedFile));
+  ASSERT_EQUALS(trades.size(), 2);
+  assert(trades[0] == trade && trades[1] == trade);
+
+  // Built-in types and unusable lengths are rejected.
+  Parser myParser(19700102, std::string(outputFile));
+  int rejected = 0;
+  for (auto registration : std::vector<std::pair<char, size_t>>{{'A', 34}, {'S', 0}, {'S', 256}}) {
+    try {
+      myParser.registerMessageType(registration.first, registration.second);
+    } catch (const std::invalid_argument &) {
+      rejected++;
+    }
+  }
+  ASSERT_EQUALS(rejected, 3);
+
+  // Unregistered types still throw.
+  std::string packet = makePacket(1, event);
+  bool threw = false;
+  try {
+    myParser.onUDPPacket(packet.data(), packet.size());
+  } catch (const std::runtime_error &) {
+    threw = true;
+  }
+  assert(threw);
+}
+
+void test_order_book() {
+  const char *outputFile = "test_output/book.out";
+  auto add = [](uint64_t orderRef, char side, uint32_t size, const char *ticker, uint32_t price) {
+    return "A" + bigEndian(1, 8) + bigEndian(orderRef, 8) + side + bigEndian(size, 4) +
+        ticker + bigEndian(price, 4);
+  };
+  std::string payload =
+      add(1, 'B', 100, "SPY     ", 2000000) +
+      add(2, 'B', 50, "SPY     ", 2000000) +
+      add(3, 'B', 70, "SPY     ", 1999900) +
+      add(4, 'S', 30, "SPY     ", 2000100) +
+      add(5, 'S', 10, "QQQ     ", 3000000) +
+      // Executes 10 of order 1, then cancels all of order 2.
+      "E" + bigEndian(2, 8) + bigEndian(1, 8) + bigEndian(10, 4) +
+      "X" + bigEndian(3, 8) + bigEndian(2, 8) + bigEndian(50, 4) +
+      // Moves order 4 down to 2000050 with size 20.
+      "R" + bigEndian(4, 8) + bigEndian(4, 8) + bigEndian(6, 8) + bigEndian(20, 4) +
+          bigEndian(2000050, 4);
+  std::string packet = makePacket(1, payload);
+
+  {
+    Parser myParser(19700102, std::string(outputFile));
+    assert(myParser.getBook() == nullptr);
+  }
+  ParserConfig config;
+  config.maintainBook = true;
+  Parser myParser(19700102, std::string(outputFile), config);
+  myParser.onUDPPacket(packet.data(), packet.size());
+  const OrderBook *book = myParser.getBook();
+  int spy = myParser.getSymbol("SPY");
+  int qqq = myParser.getSymbol("QQQ");
+  ASSERT_EQUALS(myParser.getSymbol("IWM"), -1);
+
+  TopOfBook top;
+  assert(book->topOfBook(spy, &top));
+  ASSERT_EQUALS(top.bidPrice, 2000000);
+  ASSERT_EQUALS(top.bidSize, 90);
+  ASSERT_EQUALS(top.askPrice, 2000050);
+  ASSERT_EQUALS(top.askSize, 20);
+  assert(book->topOfBook(qqq, &top));
+  ASSERT_EQUALS(top.bidPrice, 0);
+  ASSERT_EQUALS(top.askSize, 10);
+  assert(!book->topOfBook(qqq + 1, &top));
+
+  BookLevel levels[4];
+  ASSERT_EQUALS(book->depth(spy, 'B', levels, 4), 2);
+  ASSERT_EQUALS(levels[0].orders, 1);
+  ASSERT_EQUALS(levels[1].price, 1999900);
+  ASSERT_EQUALS(levels[1].size, 70);
+  ASSERT_EQUALS(book->level(spy, 'S', 2000100).orders, 0);
+
+  // The best bid emptying falls back to the next level, across pages.
+  OrderBook direct;
+  direct.add(0, 'B', 100, 5);
+  direct.add(0, 'B', 100000, 7);
+  direct.add(0, 'S', 100001, 9);
+  direct.add(0, 'S', 300, 4);
+  direct.reduce(0, 'B', 100000, 7, true);
+  direct.reduce(0, 'S', 300, 4, true);
+  assert(direct.topOfBook(0, &top));
+  ASSERT_EQUALS(top.bidPrice, 100);
+  ASSERT_EQUALS(top.bidSize, 5);
+  ASSERT_EQUALS(top.askPrice, 100001);
+  direct.reduce(0, 'B', 100, 5, true);
+  assert(direct.topOfBook(0, &top));
+  ASSERT_EQUALS(top.bidPrice, 0);
+  ASSERT_EQUALS(top.bidSize, 0);
+
+  // A stub quote far from the market is kept apart from the levels near
+  // it, and the best falls back to it and away again.
+  direct.add(1, 'S', 1000000, 5);
+  direct.add(1, 'S', 1999999900, 1);
+  direct.add(1, 'S', 1000100, 3);
+  ASSERT_EQUALS(direct.depth(1, 'S', levels, 4), 3);
+  ASSERT_EQUALS(levels[1].price, 1000100);
+  ASSERT_EQUALS(levels[2].price, 1999999900);
+  direct.reduce(1, 'S', 1000000, 5, true);
+  direct.reduce(1, 'S', 1000100, 3, true);
+  assert(direct.topOfBook(1, &top));
+  ASSERT_EQUALS(top.askPrice, 1999999900);
+  ASSERT_EQUALS(top.askSize, 1);
+  direct.add(1, 'S', 1000000, 2);
+  assert(direct.topOfBook(1, &top));
+  ASSERT_EQUALS(top.askPrice, 1000000);
+  ASSERT_EQUALS(direct.level(1, 'S', 1999999900).orders, 1);
+
+  // Against a map of levels, with prices wandering off the window now and
+  // then.
+  std::mt19937 rng(5);
+  for (char side : {'B', 'S'}) {
+    std::map<uint32_t, BookLevel> reference;
+    std::vector<std::pair<uint32_t, uint32_t>> live;
+    for (int i = 0; i < 20000; i++) {
+      if (live.empty() || rng() % 2) {
+        uint32_t price = rng() % 50 == 0 ? rng() : 1000000 + rng() % 200000;
+        uint32_t size = 1 + rng() % 100;
+        direct.add(2, side, price, size);
+        live.push_back({price, size});
+        BookLevel &level = reference[price];
+        level.price = price;
+        level.orders++;
+        level.size += size;
+      } else {
+        size_t pick = rng() % live.size();
+        uint32_t price = live[pick].first;
+        direct.reduce(2, side, price, live[pick].second, true);
+        BookLevel &level = reference[price];
+        level.size -= live[pick].second;
+        if (--level.orders == 0) {
+          reference.erase(price);
+        }
+        live[pick] = live.back();
+        live.pop_back();
+      }
+      BookLevel best[3];
+      size_t n = direct.depth(2, side, best, 3);
+      ASSERT_EQUALS(n, std::min<size_t>(3, reference.size()));
+      auto expected = reference.begin();
+      auto expectedBid = reference.rbegin();
+      for (size_t j = 0; j < n; j++) {
+        const BookLevel &level = side == 'B' ? (expectedBid++)->second : (expected++)->second;
+        ASSERT_EQUALS(best[j].price, level.price);
+        ASSERT_EQUALS(best[j].orders, level.orders);
+        ASSERT_EQUALS(best[j].size, level.size);
+      }
+    }
+  }
+}
+
+void test_bbo_output() {
+  auto add = [](uint64_t orderRef, char side, uint32_t size, const char *ticker, uint32_t price) {
+    return "A" + bigEndian(1, 8) + bigEndian(orderRef, 8) + side + bigEndian(size, 4) +
+        ticker + bigEndian(price, 4);
+  };
+  auto cancel = [](uint64_t timestamp, uint64_t orderRef, uint32_t size) {
+    return "X" + bigEndian(timestamp, 8) + bigEndian(orderRef, 8) + bigEndian(size, 4);
+  };
+  std::vector<std::string> packets = {
+    // Three updates to SPY and one to QQQ make one BBO message each.
+    makePacket(1, add(1, 'B', 100, "SPY     ", 2000000) +
+        add(2, 'B', 50, "SPY     ", 2000000) +
+        add(3, 'S', 10, "QQQ     ", 3000000) +
+        add(4, 'S', 30, "SPY     ", 2000100)),
+    // Below the best bid, so no BBO message.
+    makePacket(2, add(5, 'B', 70, "SPY     ", 1999900)),
+    // Canceled and re-added in the same packet nets out to no change.
+    makePacket(3, cancel(2, 2, 50) + add(6, 'B', 50, "SPY     ", 2000000)),
+    // The best bid emptying falls back to the next level.
+    makePacket(4, cancel(3, 1, 100) + cancel(4, 6, 50)),
+  };
+
+  std::vector<std::string> records;
+  CallbackSink sink([&](const char* record, size_t len) {
+    records.push_back(std::string(record, len));
+  });
+  ParserConfig config;
+  config.bboOutput = true;
+  config.orderOutput = false;
+  Parser myParser(19700102, sink, config);
+  assert(myParser.getBook() != nullptr);
+  // Out of order, so packets 2 to 4 are caught up one packet at a time.
+  myParser.onUDPPacket(packets[3].data(), packets[3].size());
+  myParser.onUDPPacket(packets[1].data(), packets[1].size());
+  myParser.onUDPPacket(packets[2].data(), packets[2].size());
+  ASSERT_EQUALS(records.size(), 0);
+  myParser.onUDPPacket(packets[0].data(), packets[0].size());
+  ASSERT_EQUALS(records.size(), 3);
+
+  typedef OutputBboLayout L;
+  for (const std::string &record : records) {
+    ASSERT_EQUALS(record.size(), L::SIZE);
+    ASSERT_EQUALS(record[1], 5);
+  }
+  const char *spy = records[0].data();
+  ASSERT_EQUALS(std::string(spy + L::ticker::offset), "SPY");
+  ASSERT_EQUALS(*(double *)(spy + L::bidPrice::offset), 2000000);
+  ASSERT_EQUALS(*(uint64_t *)(spy + L::bidSize::offset), 150);
+  ASSERT_EQUALS(*(double *)(spy + L::askPrice::offset), 2000100);
+  ASSERT_EQUALS(*(uint64_t *)(spy + L::askSize::offset), 30);
+  const char *qqq = records[1].data();
+  ASSERT_EQUALS(std::string(qqq + L::ticker::offset), "QQQ");
+  ASSERT_EQUALS(*(double *)(qqq + L::bidPrice::offset), 0);
+  ASSERT_EQUALS(*(uint64_t *)(qqq + L::askSize::offset), 10);
+  spy = records[2].data();
+  ASSERT_EQUALS(*(uint64_t *)(spy + L::timestamp::offset), 86400000000004);
+  ASSERT_EQUALS(*(double *)(spy + L::bidPrice::offset), 1999900);
+  ASSERT_EQUALS(*(uint64_t *)(spy + L::bidSize::offset), 70);
+}
+
+void test_subscriptions() {
+  auto add = [](uint64_t orderRef, const char *ticker) {
+    return "A" + bigEndian(1, 8) + bigEndian(orderRef, 8) + "B" + bigEndian(100, 4) +
+        ticker + bigEndian(2000000, 4);
+  };
+  auto reduce = [](char type, uint64_t orderRef) {
+    return type + bigEndian(2, 8) + bigEndian(orderRef, 8) + bigEndian(10, 4);
+  };
+  std::string payload =
+      add(1, "SPY     ") + add(2, "QQQ     ") + add(3, "IWM     ") +
+      reduce('E', 2) + reduce('X', 1) +
+      // Order 3 is replaced by order 4, which is then canceled.
+      "R" + bigEndian(2, 8) + bigEndian(3, 8) + bigEndian(4, 8) + bigEndian(20, 4) +
+          bigEndian(2000050, 4) +
+      reduce('X', 4);
+  std::string packet = makePacket(1, payload);
+
+  std::vector<std::string> records;
+  CallbackSink sink([&](const char* record, size_t len) {
+    records.push_back(std::string(record, len));
+  });
+  ParserConfig config;
+  config.subscriptions = {"SPY", "AAPL"};
+  Parser myParser(19700102, sink, config);
+  myParser.onUDPPacket(packet.data(), packet.size());
+  ASSERT_EQUALS(records.size(), 2);
+  ASSERT_EQUALS(records[0][1], 1);
+  ASSERT_EQUALS(std::string(records[0].data() + OutputAddLayout::ticker::offset), "SPY");
+  ASSERT_EQUALS(records[1][1], 3);
+  ASSERT_EQUALS(myParser.getFilteredMessages(), 5);
+  ASSERT_EQUALS(myParser.getSymbol("QQQ"), -1);
+
+  // Refs never added are still unknown.
+  std::string unknown = makePacket(2, reduce('E', 99));
+  bool threw = false;
+  try {
+    myParser.onUDPPacket(unknown.data(), unknown.size());
+  } catch (const std::runtime_error &) {
+    threw = true;
+  }
+  assert(threw);
+
+  // A perfect hash over many tickers.
+  std::vector<std::string> tickers;
+  for (int i = 0; i < 5000; i++) {
+    tickers.push_back("T" + std::to_string(i));
+  }
+  SubscriptionSet set(tickers);
+  for (int i = 0; i < 10000; i++) {
+    char padded[9];
+    snprintf(padded, sizeof(padded), "%-8s", ("T" + std::to_string(i)).c_str());
+    uint64_t key;
+    memcpy(&key, padded, sizeof(key));
+    ASSERT_EQUALS(set.contains(key), i < 5000);
+  }
+  threw = false;
+  try {
+    SubscriptionSet tooLong({"ABCDEFGHI"});
+  } catch (const std::invalid_argument &) {
+    threw = true;
+  }
+  assert(threw);
+
+  // An all nul ticker doesn't match an empty slot.
+  for (int i = 0; i < 10000; i++) {
+    char padded[9];
+    snprintf(padded, sizeof(padded), "%-8s", ("U" + std::to_string(i)).c_str());
+    uint64_t key;
+    memcpy(&key, padded, sizeof(key));
+    assert(!set.contains(key));
+  }
+  assert(!set.contains(0));
+  assert(!SubscriptionSet({"SPY"}).contains(0));
+  assert(!SubscriptionSet({}).contains(0));
+  std::string nulPayload = "A" + bigEndian(1, 8) + bigEndian(1, 8) + "B" + bigEndian(100, 4) +
+      std::string(8, '\0') + bigEndian(2000000, 4) + reduce('E', 1);
+  std::string nulPacket = makePacket(1, nulPayload);
+  records.clear();
+  Parser nulParser(19700102, sink, config);
+  nulParser.onUDPPacket(nulPacket.data(), nulPacket.size());
+  ASSERT_EQUALS(records.size(), 0);
+  ASSERT_EQUALS(nulParser.getFilteredMessages(), 2);
+
+  // Once an ignored order is replaced, its old ref is retired with it.
+  ParserConfig retiring = config;
+  retiring.retirePolicy = RETIRE_IMMEDIATELY;
+  Parser retiringParser(19700102, sink, retiring);
+  retiringParser.onUDPPacket(packet.data(), packet.size());
+  std::string late = makePacket(2, reduce('E', 3));
+  threw = false;
+  try {
+    retiringParser.onUDPPacket(late.data(), late.size());
+  } catch (const std::runtime_error &) {
+    threw = true;
+  }
+  assert(threw);
+  // Under RETIRE_NEVER it is still known as ignored.
+  std::string lateNever = makePacket(3, reduce('E', 3));
+  uint64_t filtered = myParser.getFilteredMessages();
+  myParser.onUDPPacket(lateNever.data(), lateNever.size());
+  ASSERT_EQUALS(myParser.getFilteredMessages(), filtered + 1);
+
+  RefBitmap refs;
+  refs.insert(5);
+  refs.insert(6);
+  refs.insert(1ull << 40);
+  assert(refs.contains(5));
+  assert(!refs.contains(7));
+  assert(refs.contains(1ull << 40));
+  refs.erase(5);
+  assert(!refs.contains(5));
+  assert(refs.contains(6));
+  ASSERT_EQUALS(refs.pageCount(), 2);
+  // A page goes once its last ref does.
+  refs.erase(6);
+  refs.erase(6);
+  ASSERT_EQUALS(refs.pageCount(), 1);
+  assert(!refs.contains(6));
+  refs.insert(6);
+  assert(refs.contains(6));
+  ASSERT_EQUALS(refs.pageCount(), 2);
+}
+
+// A random feed of Adds over a few tickers, with Executed, Canceled and
+// Replaced messages of live orders, cut into packets at random offsets.
+std::vector<std::string> randomFeed(size_t messages, uint32_t seed) {
+  std::mt19937 rng(seed);
+  const char *tickers[] = {"SPY     ", "QQQ     ", "IWM     ", "AAPL    ", "MSFT    "};
+  std::vector<uint64_t> live;
+  uint64_t nextRef = 1;
+  std::string feed;
+  for (size_t i = 0; i < messages; i++) {
+    uint64_t timestamp = i + 1;
+    int op = live.empty() ? 0 : rng() % 4;
+    if (op == 0) {
+      live.push_back(nextRef);
+      feed += "A" + bigEndian(timestamp, 8) + bigEndian(nextRef++, 8) + (rng() % 2 ? "B" : "S") +
+          bigEndian(1 + rng() % 500, 4) + tickers[rng() % 5] + bigEndian(1000 + rng() % 100, 4);
+      continue;
+    }
+    size_t pick = rng() % live.size();
+    uint64_t ref = live[pick];
+    if (op == 3) {
+      live[pick] = nextRef;
+      feed += "R" + bigEndian(timestamp, 8) + bigEndian(ref, 8) + bigEndian(nextRef++, 8) +
+          bigEndian(rng() % 500, 4) + bigEndian(1000 + rng() % 100, 4);
+    } else {
+      feed += (op == 1 ? "E" : "X") + bigEndian(timestamp, 8) + bigEndian(ref, 8) +
+          bigEndian(rng() % 300, 4);
+    }
+  }
+  std::vector<std::string> packets;
+  for (size_t offset = 0; offset < feed.size(); ) {
+    size_t len = std::min<size_t>(1 + rng() % 400, feed.size() - offset);
+    packets.push_back(makePacket(packets.size() + 1, feed.substr(offset, len)));
+    offset += len;
+  }
+  return packets;
+}
+
+void test_sharded_parser() {
+  std::vector<std::string> packets = randomFeed(20000, 7);
+  // Swap neighbouring packets now and then.
+  for (size_t i = 0; i + 1 < packets.size(); i += 7) {
+    std::swap(packets[i], packets[i + 1]);
+  }
+
+  // Orders are erased once they have no size, though the feed may still
+  // refer to them.
+  ParserConfig config;
+  config.retirePolicy = RETIRE_IMMEDIATELY;
+  config.unknownRefPolicy = UNKNOWN_REF_DROP;
+  std::string expected;
+  {
+    CallbackSink sink([&](const char* record, size_t len) { expected.append(record, len); });
+    Parser myParser(19700102, sink, config);
+    for (const std::string &packet : packets) {
+      myParser.onUDPPacket(packet.data(), packet.size());
+    }
+  }
+
+  // Merged, with queues small enough to keep every stage waiting.
+  for (size_t workers : {1, 3, 8}) {
+    std::string records;
+    CallbackSink sink([&](const char* record, size_t len) { records.append(record, len); });
+    PipelineConfig pipeline;
+    pipeline.workers = workers;
+    pipeline.queueSize = 16;
+    pipeline.outputRingSize = 256;
+    ShardedParser myParser(19700102, sink, config, pipeline);
+    for (const std::string &packet : packets) {
+      myParser.onUDPPacket(packet.data(), packet.size());
+    }
+    myParser.flush();
+    assert(records == expected);
+  }
+
+  // Sharded output keeps each order's messages together, in order.
+  {
+    const size_t workers = 3;
+    std::vector<std::string> shardRecords(workers);
+    std::vector<std::unique_ptr<CallbackSink>> sinks;
+    std::vector<OutputSink*> sinkPointers;
+    for (size_t i = 0; i < workers; i++) {
+      std::string &records = shardRecords[i];
+      sinks.emplace_back(new CallbackSink([&records](const char* record, size_t len) {
+        records.append(record, len);
+      }));
+      sinkPointers.push_back(sinks.back().get());
+    }
+    ShardedParser myParser(19700102, sinkPointers, config);
+    for (const std::string &packet : packets) {
+      myParser.onUDPPacket(packet.data(), packet.size());
+    }
+    myParser.flush();
+    size_t total = 0;
+    for (size_t i = 0; i < workers; i++) {
+      total += shardRecords[i].size();
+      for (size_t offset = 0; offset < shardRecords[i].size(); ) {
+        const char *record = shardRecords[i].data() + offset;
+        // Every output message has its order ref, or old order ref, here.
+        uint64_t orderRef;
+        memcpy(&orderRef, record + OutputAddLayout::orderRef::offset, sizeof(orderRef));
+        ASSERT_EQUALS(ShardedParser::shardOf(orderRef, workers), i);
+        offset += *(uint16_t *)(record + 2);
+      }
+    }
+    ASSERT_EQUALS(total, expected.size());
+  }
+
+  // Workers filter subscriptions and keep graveyards as a Parser does,
+  // including for Replaced messages split across them.
+  {
+    ParserConfig filtered = config;
+    filtered.subscriptions = {"SPY", "AAPL"};
+    filtered.retirePolicy = RETIRE_GRAVEYARD;
+    std::string expectedFiltered;
+    {
+      CallbackSink sink([&](const char* record, size_t len) { expectedFiltered.append(record, len); });
+      Parser myParser(19700102, sink, filtered);
+      for (const std::string &packet : packets) {
+        myParser.onUDPPacket(packet.data(), packet.size());
+      }
+      assert(myParser.getFilteredMessages() > 0);
+    }
+    std::string records;
+    CallbackSink sink([&](const char* record, size_t len) { records.append(record, len); });
+    PipelineConfig pipeline;
+    pipeline.workers = 3;
+    ShardedParser myParser(19700102, sink, filtered, pipeline);
+    for (const std::string &packet : packets) {
+      myParser.onUDPPacket(packet.data(), packet.size());
+    }
+    myParser.flush();
+    assert(!expectedFiltered.empty() && expectedFiltered.size() < expected.size());
+    assert(records == expectedFiltered);
+  }
+
+  // Unknown refs are reported on the caller's thread.
+  {
+    DiscardSink sink;
+    ShardedParser myParser(19700102, sink);
+    std::string packet = makePacket(1, executeMessage(99));
+    myParser.onUDPPacket(packet.data(), packet.size());
+    bool threw = false;
+    try {
+      myParser.flush();
+    } catch (const std::runtime_error &) {
+      threw = true;
+    }
+    assert(threw);
+    myParser.flush();
+  }
+  bool threw = false;
+  try {
+    ParserConfig config;
+    config.maintainBook = true;
+    DiscardSink sink;
+    ShardedParser myParser(19700102, sink, config);
+  } catch (const std::invalid_argument &) {
+    threw = true;
+  }
+  assert(threw);
+}
+
+// Channel of each record in records, going by their timestamps.
+void splitRecords(const std::string &records,
+    const std::unordered_map<uint64_t, size_t> &channelOf, std::vector<std::string> *split) {
+  for (size_t offset = 0; offset < records.size(); ) {
+    const char *record = records.data() + offset;
+    size_t len = *(uint16_t *)(record + 2);
+    uint64_t timestamp;
+    memcpy(&timestamp, record + OutputHeaderLayout::timestamp::offset, sizeof(timestamp));
+    (*split)[channelOf.at(timestamp)].append(record, len);
+    offset += len;
+  }
+}
+
+void test_feed_handler() {
+  // Three channels, each with its own orders and sequence numbers, sharing
+  // one clock.
+  const size_t channelCount = 3;
+  std::mt19937 rng(11);
+  std::vector<std::string> feeds(channelCount);
+  std::vector<std::vector<uint64_t>> live(channelCount);
+  std::vector<uint64_t> nextRef(channelCount, 1);
+  for (uint64_t timestamp = 1; timestamp <= 6000; timestamp++) {
+    size_t channel = rng() % channelCount;
+    std::vector<uint64_t> &orders = live[channel];
+    if (orders.empty() || rng() % 2) {
+      orders.push_back(nextRef[channel]);
+      feeds[channel] += "A" + bigEndian(timestamp, 8) + bigEndian(nextRef[channel]++, 8) + "B" +
+          bigEndian(1000, 4) + "SPY     " + bigEndian(1000 + rng() % 100, 4);
+    } else {
+      size_t pick = rng() % orders.size();
+      feeds[channel] += "E" + bigEndian(timestamp, 8) + bigEndian(orders[pick], 8) +
+          bigEndian(1 + rng() % 10, 4);
+    }
+  }
+  std::vector<std::vector<std::string>> packets(channelCount);
+  for (size_t channel = 0; channel < channelCount; channel++) {
+    const std::string &feed = feeds[channel];
+    for (size_t offset = 0; offset < feed.size(); ) {
+      size_t len = std::min<size_t>(1 + rng() % 400, feed.size() - offset);
+      packets[channel].push_back(makePacket(packets[channel].size() + 1, feed.substr(offset, len)));
+      offset += len;
+    }
+  }
+
+  // Each channel alone, through a Parser.
+  std::vector<std::string> expected(channelCount);
+  std::unordered_map<uint64_t, size_t> channelOf;
+  for (size_t channel = 0; channel < channelCount; channel++) {
+    CallbackSink sink([&](const char* record, size_t len) {
+      uint64_t timestamp;
+      memcpy(&timestamp, record + OutputHeaderLayout::timestamp::offset, sizeof(timestamp));
+      channelOf[timestamp] = channel;
+      expected[channel].append(record, len);
+    });
+    Parser myParser(19700102, sink);
+    for (const std::string &packet : packets[channel]) {
+      myParser.onUDPPacket(packet.data(), packet.size());
+    }
+  }
+
+  FeedHandlerConfig config;
+  config.channels.resize(channelCount);
+  config.queueSize = 4;
+  config.outputRingSize = 256;
+  config.maxPacketSize = 512;
+  auto handIn = [&](FeedHandler &handler) {
+    for (size_t i = 0; ; i++) {
+      bool any = false;
+      for (size_t channel = 0; channel < channelCount; channel++) {
+        if (i < packets[channel].size()) {
+          handler.onUDPPacket(channel, packets[channel][i].data(), packets[channel][i].size());
+          any = true;
+        }
+      }
+      if (!any) {
+        break;
+      }
+    }
+  };
+
+  // Merged with buffers small enough that channels go idle waiting on the
+  // caller, each channel's records stay in order among the others'.
+  {
+    std::string records;
+    CallbackSink sink([&](const char* record, size_t len) { records.append(record, len); });
+    FeedHandler handler(19700102, sink, config);
+    ASSERT_EQUALS(handler.getChannelCount(), channelCount);
+    ASSERT_EQUALS(handler.getPort(0), 0);
+    handIn(handler);
+    handler.flush();
+    std::vector<std::string> split(channelCount);
+    splitRecords(records, channelOf, &split);
+    assert(split == expected);
+  }
+
+  // Merged without idle channels, timestamps never go backwards.
+  {
+    FeedHandlerConfig roomy;
+    roomy.channels.resize(channelCount);
+    roomy.idleTimeoutNanos = 0;
+    std::string records;
+    CallbackSink sink([&](const char* record, size_t len) { records.append(record, len); });
+    FeedHandler handler(19700102, sink, roomy);
+    handIn(handler);
+    handler.flush();
+    std::vector<std::string> split(channelCount);
+    splitRecords(records, channelOf, &split);
+    assert(split == expected);
+    uint64_t previous = 0;
+    for (size_t offset = 0; offset < records.size(); ) {
+      uint64_t timestamp;
+      memcpy(&timestamp, records.data() + offset + OutputHeaderLayout::timestamp::offset,
+          sizeof(timestamp));
+      assert(timestamp >= previous);
+      previous = timestamp;
+      offset += *(uint16_t *)(records.data() + offset + 2);
+    }
+    ASSERT_EQUALS(handler.getOrderViolations(), 0);
+  }
+
+  // A silent channel only holds up the merge until it times out.
+  {
+    std::atomic<size_t> written(0);
+    CallbackSink sink([&](const char*, size_t len) { written.fetch_add(len); });
+    FeedHandlerConfig quiet;
+    quiet.channels.resize(2);
+    quiet.idleTimeoutNanos = 1000000;
+    FeedHandler handler(19700102, sink, quiet);
+    for (const std::string &packet : packets[0]) {
+      handler.onUDPPacket(0, packet.data(), packet.size());
+    }
+    for (int attempts = 0; attempts < 500 && written.load() < expected[0].size(); attempts++) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    ASSERT_EQUALS(written.load(), expected[0].size());
+    handler.flush();
+    ASSERT_EQUALS(handler.getOrderViolations(), 0);
+
+    // Its late record, older than those merged without it, is counted.
+    std::string late = makePacket(1, "A" + bigEndian(1, 8) + bigEndian(1, 8) + "B" +
+        bigEndian(100, 4) + "SPY     " + bigEndian(1000, 4));
+    handler.onUDPPacket(1, late.data(), late.size());
+    handler.flush();
+    ASSERT_EQUALS(written.load(), expected[0].size() + OutputAddLayout::SIZE);
+    ASSERT_EQUALS(handler.getOrderViolations(), 1);
+  }
+
+  // Unmerged, each channel writes what a Parser would.
+  {
+    std::vector<std::string> channelRecords(channelCount);
+    std::vector<std::unique_ptr<CallbackSink>> sinks;
+    std::vector<OutputSink*> sinkPointers;
+    for (size_t channel = 0; channel < channelCount; channel++) {
+      std::string &records = channelRecords[channel];
+      sinks.emplace_back(new CallbackSink([&records](const char* record, size_t len) {
+        records.append(record, len);
+      }));
+      sinkPointers.push_back(sinks.back().get());
+    }
+    FeedHandler handler(19700102, sinkPointers, config);
+    handIn(handler);
+    handler.flush();
+    assert(channelRecords == expected);
+  }
+
+  // Errors are rethrown on the caller's thread.
+  {
+    DiscardSink sink;
+    FeedHandler handler(19700102, sink, config);
+    std::string packet = makePacket(1, executeMessage(99));
+    handler.onUDPPacket(1, packet.data(), packet.size());
+    bool threw = false;
+    try {
+      handler.flush();
+    } catch (const std::runtime_error &) {
+      threw = true;
+    }
+    assert(threw);
+    handler.flush();
+
+    threw = false;
+    try {
+      std::string tooLong(config.maxPacketSize + 1, 0);
+      handler.onUDPPacket(0, tooLong.data(), tooLong.size());
+    } catch (const std::invalid_argument &) {
+      threw = true;
+    }
+    assert(threw);
+  }
+
+  // A channel receiving from its own socket, on a pinned thread.
+  {
+    const char *outputFile = "test_output/ARRE_straddled_out_of_order_feed.out";
+    FeedHandlerConfig receiving;
+    receiving.channels.resize(1);
+    receiving.channels[0].receive = true;
+    receiving.channels[0].receiver.address = "127.0.0.1";
+    receiving.channels[0].receiver.timeoutMicros = 10000;
+    receiving.channels[0].cpu = 0;
+    FeedHandler handler(19700102, std::string(outputFile), receiving);
+    assert(handler.getPort(0) != 0);
+
+    int sender = socket(AF_INET, SOCK_DGRAM, 0);
+    sockaddr_in to = {};
+    to.sin_family = AF_INET;
+    to.sin_port = htons(handler.getPort(0));
+    inet_pton(AF_INET, "127.0.0.1", &to.sin_addr);
+    std::string capture = fileContents("test_input/ARRE_straddled_out_of_order.in");
+    for (size_t offset = 0; offset < capture.size(); ) {
+      size_t len = ((uint8_t) capture[offset] << 8) | (uint8_t) capture[offset + 1];
+      sendto(sender, capture.data() + offset, len, 0, (sockaddr*) &to, sizeof(to));
+      offset += len;
+    }
+    close(sender);
+
+    std::string expectedFile = fileContents("test_output/ARRE_straddled_out_of_order.out");
+    for (int attempts = 0; attempts < 100 && fileContents(outputFile) != expectedFile; attempts++) {
+      handler.flush();
+      std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    assert(fileContents(outputFile) == expectedFile);
+  }
+
+  bool threw = false;
+  try {
+    FeedHandler handler(19700102, std::vector<OutputSink*>(), config);
+  } catch (const std::invalid_argument &) {
+    threw = true;
+  }
+  assert(threw);
+}
 
 int main(int argc, char **argv) {
   if (mkdir("./test_output", 0755) != 0) {
@@ -943,8 +2668,37 @@ int main(int argc, char **argv) {
 
   // // Test packets.
   test_add_replaced_replaced_executed_single_packet();
+  test_add_replaced_replaced_executed_straddled();
   test_add_replaced_replaced_executed_out_of_order();
   test_add_replaced_replaced_executed_straddled_out_of_order();
+  test_batch();
+  test_message_batches();
+  test_replay();
+  test_receiver();
+  test_packet_pool();
+  test_reorder_window();
+  test_reorder_overflow();
+  test_gap_recovery();
+  test_bad_packets();
+  test_message_registry();
+  test_order_book();
+  test_bbo_output();
+  test_subscriptions();
+  test_sharded_parser();
+  test_feed_handler();
+
+  // Test output.
+  test_message_layout();
+  test_decoders();
+  test_flush_policy();
+  test_async_output();
+  test_output_sinks();
+  test_broadcast_ring();
+
+  // Test order state.
+  test_order_table();
+  test_symbol_table();
+  test_retire_policy();
 
   return 0;
 }
\ No newline at end of file